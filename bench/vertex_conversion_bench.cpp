@@ -0,0 +1,85 @@
+// Compares ConvertVertices with the per vertex loop MeshModel::LoadMesh used
+// before, on meshes with a million vertices and more.
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "VertexConversion.h"
+
+// The loop as it was, branching on the tex coords for every vertex
+static void convertPerVertex(const float *positions, const float *texCoords,
+			     size_t count, Vertex *vertices) {
+  for (size_t i = 0; i < count; i++) {
+    vertices[i].pos = {positions[i * 3], positions[i * 3 + 1],
+		       positions[i * 3 + 2]};
+
+    if (texCoords) {
+      vertices[i].tex = {texCoords[i * 3], texCoords[i * 3 + 1]};
+    } else {
+      vertices[i].tex = {0.0f, 0.0f};
+    }
+
+    vertices[i].col = {1.0f, 1.0f, 1.0f};
+  }
+}
+
+// Best of several runs in milliseconds
+template <typename Convert> static double measure(Convert convert) {
+  double best = 0.0;
+  for (int run = 0; run < 10; run++) {
+    auto start = std::chrono::steady_clock::now();
+    convert();
+    double time = std::chrono::duration<double, std::milli>(
+		      std::chrono::steady_clock::now() - start)
+		      .count();
+    best = run == 0 ? time : std::min(best, time);
+  }
+  return best;
+}
+
+int main() {
+  std::mt19937 random(42);
+  std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+
+  for (size_t count : {size_t(1) << 20, size_t(1) << 22}) {
+    std::vector<float> positions(count * 3);
+    std::vector<float> texCoords(count * 3);
+    for (auto &value : positions) {
+      value = distribution(random);
+    }
+    for (auto &value : texCoords) {
+      value = distribution(random);
+    }
+
+    std::vector<Vertex> expected(count);
+    std::vector<Vertex> actual(count);
+
+    for (bool withTexCoords : {true, false}) {
+      const float *tex = withTexCoords ? texCoords.data() : nullptr;
+
+      double loopTime = measure([&] {
+	convertPerVertex(positions.data(), tex, count, expected.data());
+      });
+      double kernelTime = measure([&] {
+	ConvertVertices(positions.data(), tex, count, glm::vec3(1.0f),
+			actual.data());
+      });
+
+      bool same = memcmp(expected.data(), actual.data(),
+			 sizeof(Vertex) * count) == 0;
+      std::cout << count << " vertices" << (withTexCoords ? "" : ", no uvs")
+		<< ": loop " << loopTime << " ms, kernel " << kernelTime
+		<< " ms, " << loopTime / kernelTime << "x"
+		<< (same ? "" : " MISMATCH") << std::endl;
+      if (!same) {
+	return 1;
+      }
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,192 @@
+#include "GeometryPool.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+
+
+GeometryPool::GeometryPool()
+{
+}
+
+GeometryPool::GeometryPool(vkx::Allocator newAllocator, VkDevice newDevice, std::vector<uint32_t> queueFamilies,
+	VertexFormat newVertexFormat, uint32_t newMaxVertices, uint32_t newMaxIndices)
+{
+	allocator = newAllocator;
+	device = newDevice;
+	vertexFormat = newVertexFormat;
+	vertexStride = getVertexStride(vertexFormat);
+
+	// Remove duplicate families, more than one left means uploads and draws run on different families
+	std::sort(queueFamilies.begin(), queueFamilies.end());
+	queueFamilies.erase(std::unique(queueFamilies.begin(), queueFamilies.end()), queueFamilies.end());
+	if (queueFamilies.size() > 1)
+	{
+		sharingMode = VK_SHARING_MODE_CONCURRENT;
+	}
+
+	vertexBufferMemory = vkx::CreateBuffer(allocator, device, vertexStride * newMaxVertices,
+		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, queueFamilies, &vertexBuffer);
+	indexBufferMemory = vkx::CreateBuffer(allocator, device, sizeof(uint32_t) * newMaxIndices,
+		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, queueFamilies, &indexBuffer);
+	shortIndexBufferMemory = vkx::CreateBuffer(allocator, device, sizeof(uint16_t) * newMaxIndices,
+		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, queueFamilies, &shortIndexBuffer);
+
+	// Everything is free to begin with
+	freeVertices.push_back({ 0, newMaxVertices });
+	freeIndices.push_back({ 0, newMaxIndices });
+	freeShortIndices.push_back({ 0, newMaxIndices });
+}
+
+GeometryRange GeometryPool::allocate(uint32_t vertexCount, uint32_t indexCount, VkIndexType indexType)
+{
+	GeometryRange range = {};
+	range.vertexCount = vertexCount;
+	range.indexCount = indexCount;
+	range.indexType = indexType;
+
+	// 16 bit indices can't address more than 65536 vertices
+	if (indexType == VK_INDEX_TYPE_UINT16 && vertexCount > 65536)
+	{
+		throw std::runtime_error("Too many vertices for 16 bit indices!");
+	}
+
+	uint32_t vertexOffset = 0;
+	if (!takeRange(freeVertices, vertexCount, &vertexOffset))
+	{
+		throw std::runtime_error("Geometry pool is out of vertex space!");
+	}
+	if (!takeRange(getFreeIndices(indexType), indexCount, &range.firstIndex))
+	{
+		returnRange(freeVertices, vertexOffset, vertexCount);
+		throw std::runtime_error("Geometry pool is out of index space!");
+	}
+	range.vertexOffset = static_cast<int32_t>(vertexOffset);
+
+	return range;
+}
+
+void GeometryPool::free(GeometryRange range)
+{
+	returnRange(freeVertices, static_cast<uint32_t>(range.vertexOffset), range.vertexCount);
+	returnRange(getFreeIndices(range.indexType), range.firstIndex, range.indexCount);
+}
+
+void GeometryPool::upload(vkx::UploadBatch &uploads, GeometryRange range,
+	const void * vertices, const void * indices)
+{
+	VkDeviceSize indexSize = range.indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+
+	uploads.CopyToBuffer(vertices, vertexStride * range.vertexCount, vertexBuffer,
+		vertexStride * range.vertexOffset, sharingMode);
+	uploads.CopyToBuffer(indices, indexSize * range.indexCount, getIndexBuffer(range.indexType),
+		indexSize * range.firstIndex, sharingMode);
+}
+
+VertexFormat GeometryPool::getVertexFormat()
+{
+	return vertexFormat;
+}
+
+VkBuffer GeometryPool::getVertexBuffer()
+{
+	return vertexBuffer;
+}
+
+VkBuffer GeometryPool::getIndexBuffer(VkIndexType indexType)
+{
+	return indexType == VK_INDEX_TYPE_UINT16 ? shortIndexBuffer : indexBuffer;
+}
+
+void GeometryPool::bind(VkCommandBuffer commandBuffer, VkIndexType indexType)
+{
+	VkDeviceSize offsets[] = { 0 };
+	vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertexBuffer, offsets);
+	bindIndices(commandBuffer, indexType);
+}
+
+void GeometryPool::bindIndices(VkCommandBuffer commandBuffer, VkIndexType indexType)
+{
+	vkCmdBindIndexBuffer(commandBuffer, getIndexBuffer(indexType), 0, indexType);
+}
+
+void GeometryPool::destroy()
+{
+	vkDestroyBuffer(device, vertexBuffer, nullptr);
+	allocator.Free(vertexBufferMemory);
+	vkDestroyBuffer(device, indexBuffer, nullptr);
+	allocator.Free(indexBufferMemory);
+	vkDestroyBuffer(device, shortIndexBuffer, nullptr);
+	allocator.Free(shortIndexBufferMemory);
+	vertexBuffer = VK_NULL_HANDLE;
+	indexBuffer = VK_NULL_HANDLE;
+	shortIndexBuffer = VK_NULL_HANDLE;
+}
+
+
+GeometryPool::~GeometryPool()
+{
+}
+
+std::vector<GeometryPool::FreeRange> & GeometryPool::getFreeIndices(VkIndexType indexType)
+{
+	return indexType == VK_INDEX_TYPE_UINT16 ? freeShortIndices : freeIndices;
+}
+
+bool GeometryPool::takeRange(std::vector<FreeRange> &freeList, uint32_t count, uint32_t * offset)
+{
+	if (count == 0)
+	{
+		*offset = 0;
+		return true;
+	}
+
+	// First fit
+	for (size_t i = 0; i < freeList.size(); i++)
+	{
+		if (freeList[i].count < count)
+		{
+			continue;
+		}
+
+		*offset = freeList[i].offset;
+		freeList[i].offset += count;
+		freeList[i].count -= count;
+		if (freeList[i].count == 0)
+		{
+			freeList.erase(freeList.begin() + i);
+		}
+		return true;
+	}
+
+	return false;
+}
+
+void GeometryPool::returnRange(std::vector<FreeRange> &freeList, uint32_t offset, uint32_t count)
+{
+	if (count == 0)
+	{
+		return;
+	}
+
+	auto next = std::lower_bound(freeList.begin(), freeList.end(), offset,
+		[](const FreeRange &range, uint32_t value) { return range.offset < value; });
+	auto it = freeList.insert(next, { offset, count });
+
+	// Merge with following range
+	if (it + 1 != freeList.end() && it->offset + it->count == (it + 1)->offset)
+	{
+		it->count += (it + 1)->count;
+		freeList.erase(it + 1);
+	}
+
+	// Merge with preceding range
+	if (it != freeList.begin() && (it - 1)->offset + (it - 1)->count == it->offset)
+	{
+		(it - 1)->count += it->count;
+		freeList.erase(it);
+	}
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+
+#include "Utilities.h"
+
+// Location of one mesh inside the pool, in elements not bytes
+struct GeometryRange {
+	int32_t vertexOffset = 0;
+	uint32_t vertexCount = 0;
+	uint32_t firstIndex = 0; // into the index buffer of indexType
+	uint32_t indexCount = 0;
+	VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+};
+
+// Shared vertex and index buffers every mesh is packed into, so drawing only
+// needs binds per index type and offsets. Indices are relative to the mesh's
+// vertexOffset, meshes with up to 65536 vertices can use 16 bit ones.
+class GeometryPool
+{
+public:
+	GeometryPool();
+	GeometryPool(vkx::Allocator newAllocator, VkDevice newDevice, std::vector<uint32_t> queueFamilies,
+		VertexFormat newVertexFormat, uint32_t newMaxVertices, uint32_t newMaxIndices);
+
+	GeometryRange allocate(uint32_t vertexCount, uint32_t indexCount, VkIndexType indexType);
+	void free(GeometryRange range);
+
+	// Queue copies of vertex/index data into range, vertices have to be in the pool's format
+	// and indices of the range's indexType
+	void upload(vkx::UploadBatch &uploads, GeometryRange range,
+		const void * vertices, const void * indices);
+
+	VertexFormat getVertexFormat();
+
+	VkBuffer getVertexBuffer();
+	VkBuffer getIndexBuffer(VkIndexType indexType);
+
+	// Binds the vertex buffer and the index buffer of indexType
+	void bind(VkCommandBuffer commandBuffer, VkIndexType indexType);
+	void bindIndices(VkCommandBuffer commandBuffer, VkIndexType indexType);
+
+	void destroy();
+
+	~GeometryPool();
+
+private:
+	// Free ranges sorted by offset, neighbours are merged on free
+	struct FreeRange {
+		uint32_t offset;
+		uint32_t count;
+	};
+
+	VertexFormat vertexFormat = VertexFormat::Full;
+	VkDeviceSize vertexStride = sizeof(Vertex);
+	VkBuffer vertexBuffer = VK_NULL_HANDLE;
+	vkx::Allocation vertexBufferMemory;
+	std::vector<FreeRange> freeVertices;
+
+	VkBuffer indexBuffer = VK_NULL_HANDLE;
+	vkx::Allocation indexBufferMemory;
+	std::vector<FreeRange> freeIndices;
+
+	VkBuffer shortIndexBuffer = VK_NULL_HANDLE;
+	vkx::Allocation shortIndexBufferMemory;
+	std::vector<FreeRange> freeShortIndices;
+
+	vkx::Allocator allocator;
+	VkDevice device = VK_NULL_HANDLE;
+
+	// Buffers are shared by the transfer and graphics families
+	VkSharingMode sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	std::vector<FreeRange> & getFreeIndices(VkIndexType indexType);
+
+	static bool takeRange(std::vector<FreeRange> &freeList, uint32_t count, uint32_t * offset);
+	static void returnRange(std::vector<FreeRange> &freeList, uint32_t offset, uint32_t count);
+};
@@ -0,0 +1,278 @@
+#include "Ktx2.h"
+
+#include "MipGeneration.h"
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+
+namespace
+{
+	const uint8_t KTX2_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+	// File header and index, followed by one Ktx2FileLevel per level
+	struct Ktx2Header
+	{
+		uint8_t identifier[12];
+		uint32_t vkFormat;
+		uint32_t typeSize;
+		uint32_t pixelWidth;
+		uint32_t pixelHeight;
+		uint32_t pixelDepth;
+		uint32_t layerCount;
+		uint32_t faceCount;
+		uint32_t levelCount;
+		uint32_t supercompressionScheme;
+		uint32_t dfdByteOffset;
+		uint32_t dfdByteLength;
+		uint32_t kvdByteOffset;
+		uint32_t kvdByteLength;
+		uint64_t sgdByteOffset;
+		uint64_t sgdByteLength;
+	};
+	static_assert(sizeof(Ktx2Header) == 80, "KTX2 header layout");
+
+	struct Ktx2FileLevel
+	{
+		uint64_t byteOffset;
+		uint64_t byteLength;
+		uint64_t uncompressedByteLength;
+	};
+
+	// Khronos data format colour models of the block formats
+	const uint8_t KHR_DF_MODEL_BC1A = 128;
+	const uint8_t KHR_DF_MODEL_BC3 = 130;
+	const uint8_t KHR_DF_MODEL_BC7 = 134;
+	const uint8_t KHR_DF_MODEL_ASTC = 162;
+
+	struct BlockFormat
+	{
+		VkFormat format;
+		uint32_t size;
+		uint32_t width;
+		uint32_t height;
+		uint8_t model;
+		bool srgb;
+	};
+
+	const BlockFormat BLOCK_FORMATS[] = {
+		{ VK_FORMAT_BC1_RGB_UNORM_BLOCK, 8, 4, 4, KHR_DF_MODEL_BC1A, false },
+		{ VK_FORMAT_BC1_RGB_SRGB_BLOCK, 8, 4, 4, KHR_DF_MODEL_BC1A, true },
+		{ VK_FORMAT_BC1_RGBA_UNORM_BLOCK, 8, 4, 4, KHR_DF_MODEL_BC1A, false },
+		{ VK_FORMAT_BC1_RGBA_SRGB_BLOCK, 8, 4, 4, KHR_DF_MODEL_BC1A, true },
+		{ VK_FORMAT_BC3_UNORM_BLOCK, 16, 4, 4, KHR_DF_MODEL_BC3, false },
+		{ VK_FORMAT_BC3_SRGB_BLOCK, 16, 4, 4, KHR_DF_MODEL_BC3, true },
+		{ VK_FORMAT_BC7_UNORM_BLOCK, 16, 4, 4, KHR_DF_MODEL_BC7, false },
+		{ VK_FORMAT_BC7_SRGB_BLOCK, 16, 4, 4, KHR_DF_MODEL_BC7, true },
+		{ VK_FORMAT_ASTC_4x4_UNORM_BLOCK, 16, 4, 4, KHR_DF_MODEL_ASTC, false },
+		{ VK_FORMAT_ASTC_4x4_SRGB_BLOCK, 16, 4, 4, KHR_DF_MODEL_ASTC, true },
+		{ VK_FORMAT_ASTC_6x6_UNORM_BLOCK, 16, 6, 6, KHR_DF_MODEL_ASTC, false },
+		{ VK_FORMAT_ASTC_6x6_SRGB_BLOCK, 16, 6, 6, KHR_DF_MODEL_ASTC, true },
+		{ VK_FORMAT_ASTC_8x8_UNORM_BLOCK, 16, 8, 8, KHR_DF_MODEL_ASTC, false },
+		{ VK_FORMAT_ASTC_8x8_SRGB_BLOCK, 16, 8, 8, KHR_DF_MODEL_ASTC, true },
+	};
+
+	const BlockFormat * findBlockFormat(VkFormat format)
+	{
+		for (auto & blockFormat : BLOCK_FORMATS)
+		{
+			if (blockFormat.format == format)
+			{
+				return &blockFormat;
+			}
+		}
+		return nullptr;
+	}
+
+	// Basic data format descriptor with a single sample covering the whole block
+	std::vector<uint32_t> makeDataFormatDescriptor(const BlockFormat & blockFormat)
+	{
+		const uint32_t blockWords = 6;
+		const uint32_t sampleWords = 4;
+		const uint32_t blockSize = (blockWords + sampleWords) * sizeof(uint32_t);
+
+		std::vector<uint32_t> dfd;
+		dfd.push_back(sizeof(uint32_t) + blockSize);				// total size
+		dfd.push_back(0);											// Khronos vendor, basic descriptor type
+		dfd.push_back(2 | (blockSize << 16));						// version 1.3, block size
+		dfd.push_back(blockFormat.model | (1 << 8) |				// BT.709 primaries
+			((blockFormat.srgb ? 2 : 1) << 16));					// sRGB or linear transfer
+		dfd.push_back((blockFormat.width - 1) | ((blockFormat.height - 1) << 8));
+		dfd.push_back(blockFormat.size);							// bytes of plane 0
+		dfd.push_back(0);
+		dfd.push_back((blockFormat.size * 8 - 1) << 16);			// bit 0 on, colour channel
+		dfd.push_back(0);											// sample position
+		dfd.push_back(0);											// lower
+		dfd.push_back(UINT32_MAX);									// upper
+		return dfd;
+	}
+
+	size_t alignOffset(size_t offset, size_t alignment)
+	{
+		return (offset + alignment - 1) / alignment * alignment;
+	}
+}
+
+
+
+uint64_t Ktx2Info::getDataSize() const
+{
+	uint64_t size = 0;
+	for (auto & level : levels)
+	{
+		size += level.size;
+	}
+	return size;
+}
+
+Ktx2Info ReadKtx2Info(const std::string & path)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file.is_open())
+	{
+		throw std::runtime_error("Failed to open a KTX2 file! (" + path + ")");
+	}
+
+	Ktx2Header header;
+	if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+		!std::equal(std::begin(KTX2_IDENTIFIER), std::end(KTX2_IDENTIFIER), header.identifier))
+	{
+		throw std::runtime_error("Not a KTX2 file! (" + path + ")");
+	}
+	if (header.supercompressionScheme != 0 || header.pixelDepth > 1 || header.layerCount > 1 ||
+		header.faceCount != 1 || header.pixelWidth == 0 || header.pixelHeight == 0)
+	{
+		throw std::runtime_error("Unsupported KTX2 file, only plain 2D images are read! (" + path + ")");
+	}
+	const BlockFormat * blockFormat = findBlockFormat(static_cast<VkFormat>(header.vkFormat));
+	if (!blockFormat)
+	{
+		throw std::runtime_error("Unsupported KTX2 format! (" + path + ")");
+	}
+
+	// No levels means the reader is supposed to generate them, only level 0 is stored then
+	uint32_t levelCount = std::max(header.levelCount, 1u);
+	if (levelCount > GetMipLevelCount(header.pixelWidth, header.pixelHeight))
+	{
+		throw std::runtime_error("KTX2 file has more levels than its size allows! (" + path + ")");
+	}
+	std::vector<Ktx2FileLevel> fileLevels(levelCount);
+	if (!file.read(reinterpret_cast<char *>(fileLevels.data()), sizeof(Ktx2FileLevel) * levelCount))
+	{
+		throw std::runtime_error("Truncated KTX2 file! (" + path + ")");
+	}
+
+	file.seekg(0, std::ios::end);
+	uint64_t fileSize = static_cast<uint64_t>(file.tellg());
+
+	Ktx2Info info;
+	info.format = static_cast<VkFormat>(header.vkFormat);
+	info.width = header.pixelWidth;
+	info.height = header.pixelHeight;
+	info.levels.resize(levelCount);
+	for (uint32_t i = 0; i < levelCount; i++)
+	{
+		auto & level = info.levels[i];
+		level.offset = fileLevels[i].byteOffset;
+		level.size = fileLevels[i].byteLength;
+		level.width = GetMipWidth(header.pixelWidth, i);
+		level.height = GetMipHeight(header.pixelHeight, i);
+
+		// Copies to the image read exactly this much from the staged data
+		uint64_t blocksX = (level.width + blockFormat->width - 1) / blockFormat->width;
+		uint64_t blocksY = (level.height + blockFormat->height - 1) / blockFormat->height;
+		if (level.size != blocksX * blocksY * blockFormat->size)
+		{
+			throw std::runtime_error("KTX2 level size doesn't match its format! (" + path + ")");
+		}
+		if (level.offset > fileSize || level.size > fileSize - level.offset)
+		{
+			throw std::runtime_error("Truncated KTX2 file! (" + path + ")");
+		}
+	}
+	return info;
+}
+
+void ReadKtx2Levels(const std::string & path, const Ktx2Info & info, void * pixels)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file.is_open())
+	{
+		throw std::runtime_error("Failed to open a KTX2 file! (" + path + ")");
+	}
+
+	char * out = static_cast<char *>(pixels);
+	for (auto & level : info.levels)
+	{
+		file.seekg(static_cast<std::streamoff>(level.offset));
+		if (!file.read(out, static_cast<std::streamsize>(level.size)))
+		{
+			throw std::runtime_error("Truncated KTX2 file! (" + path + ")");
+		}
+		out += level.size;
+	}
+}
+
+void WriteKtx2(const std::string & path, VkFormat format, uint32_t width, uint32_t height,
+	const std::vector<std::vector<uint8_t>> & levels)
+{
+	const BlockFormat * blockFormat = findBlockFormat(format);
+	if (!blockFormat)
+	{
+		throw std::runtime_error("KTX2 writer doesn't know the format!");
+	}
+
+	uint32_t levelCount = static_cast<uint32_t>(levels.size());
+	auto dfd = makeDataFormatDescriptor(*blockFormat);
+
+	Ktx2Header header = {};
+	std::copy(std::begin(KTX2_IDENTIFIER), std::end(KTX2_IDENTIFIER), header.identifier);
+	header.vkFormat = format;
+	header.typeSize = 1;
+	header.pixelWidth = width;
+	header.pixelHeight = height;
+	header.faceCount = 1;
+	header.levelCount = levelCount;
+	header.dfdByteOffset = static_cast<uint32_t>(sizeof(header) + sizeof(Ktx2FileLevel) * levelCount);
+	header.dfdByteLength = static_cast<uint32_t>(sizeof(uint32_t) * dfd.size());
+
+	// Level data starts at multiples of the block size, the smallest level comes first
+	std::vector<Ktx2FileLevel> fileLevels(levelCount);
+	size_t offset = header.dfdByteOffset + header.dfdByteLength;
+	for (uint32_t i = levelCount; i-- > 0;)
+	{
+		offset = alignOffset(offset, blockFormat->size);
+		fileLevels[i].byteOffset = offset;
+		fileLevels[i].byteLength = levels[i].size();
+		fileLevels[i].uncompressedByteLength = levels[i].size();
+		offset += levels[i].size();
+	}
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+	{
+		throw std::runtime_error("Failed to create a KTX2 file! (" + path + ")");
+	}
+
+	size_t written = 0;
+	auto put = [&](const void * src, size_t bytes)
+	{
+		file.write(static_cast<const char *>(src), bytes);
+		written += bytes;
+	};
+
+	put(&header, sizeof(header));
+	put(fileLevels.data(), sizeof(Ktx2FileLevel) * levelCount);
+	put(dfd.data(), sizeof(uint32_t) * dfd.size());
+	for (uint32_t i = levelCount; i-- > 0;)
+	{
+		static const char zeros[16] = {};
+		put(zeros, fileLevels[i].byteOffset - written);
+		put(levels[i].data(), levels[i].size());
+	}
+
+	if (!file)
+	{
+		throw std::runtime_error("Failed to write a KTX2 file! (" + path + ")");
+	}
+}
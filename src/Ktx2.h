@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan_core.h>
+
+// One mip level as stored in a KTX2 file
+struct Ktx2Level
+{
+	uint64_t offset = 0;			// from the start of the file
+	uint64_t size = 0;
+	uint32_t width = 0;
+	uint32_t height = 0;
+};
+
+// What a KTX2 file holds. Only single 2D images without supercompression are read, which is
+// what texture_encoder writes and what GPU block formats need.
+struct Ktx2Info
+{
+	VkFormat format = VK_FORMAT_UNDEFINED;
+	uint32_t width = 0;
+	uint32_t height = 0;
+	std::vector<Ktx2Level> levels;	// level 0 first
+
+	// Bytes of all levels stored back to back
+	uint64_t getDataSize() const;
+};
+
+// Reads the header and level index, throws for files that can't be used as described above and
+// for level sizes or offsets that don't fit the format, size and file
+Ktx2Info ReadKtx2Info(const std::string & path);
+
+// Reads every level into pixels, back to back with level 0 first
+void ReadKtx2Levels(const std::string & path, const Ktx2Info & info, void * pixels);
+
+// Writes a block compressed image with levels[i] holding mip level i. format has to be a BC1,
+// BC3, BC7 or ASTC 4x4, 6x6 or 8x8 format, the data format descriptor is made for those.
+void WriteKtx2(const std::string & path, VkFormat format, uint32_t width, uint32_t height,
+	const std::vector<std::vector<uint8_t>> & levels);
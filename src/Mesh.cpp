@@ -1,25 +1,69 @@
 #include "Mesh.h"
+#include "VertexConversion.h"
 
 
 
+MeshView MeshData::view() const
+{
+	MeshView meshView;
+	meshView.vertices = vertices.data();
+	meshView.vertexCount = static_cast<uint32_t>(vertices.size());
+	meshView.indices = indices.data();
+	meshView.indexCount = static_cast<uint32_t>(indices.size());
+	meshView.lods = lods.data();
+	meshView.lodCount = static_cast<uint32_t>(lods.size());
+	meshView.meshlets = meshlets.data();
+	meshView.meshletCount = static_cast<uint32_t>(meshlets.size());
+	meshView.materialIndex = materialIndex;
+	meshView.bounds = bounds;
+	return meshView;
+}
+
 Mesh::Mesh()
 {
 }
 
-Mesh::Mesh(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, 
-	VkQueue transferQueue, VkCommandPool transferCommandPool, 
-	std::vector<Vertex>* vertices, std::vector<uint32_t> * indices,
-	int newTexId)
+Mesh::Mesh(GeometryPool * newPool, vkx::UploadBatch &uploads, const MeshView &data, int newTexId)
 {
-	vertexCount = vertices->size();
-	indexCount = indices->size();
-	physicalDevice = newPhysicalDevice;
-	device = newDevice;
-	createVertexBuffer(transferQueue, transferCommandPool, vertices);
-	createIndexBuffer(transferQueue, transferCommandPool, indices);
+	pool = newPool;
+
+	// Reserve space in the pool and queue the copies (submitted later with the rest of the batch).
+	// The data is copied into staging memory right away, it doesn't have to outlive this call.
+	// Indices are relative to vertexOffset, so any mesh that small halves its index memory and bandwidth with 16 bits
+	VkIndexType indexType = data.vertexCount <= 65536 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+	geometry = pool->allocate(data.vertexCount, data.indexCount, indexType);
+
+	std::vector<uint16_t> shortIndices;
+	const void * indices = data.indices;
+	if (indexType == VK_INDEX_TYPE_UINT16)
+	{
+		shortIndices.assign(data.indices, data.indices + data.indexCount);
+		indices = shortIndices.data();
+	}
+
+	if (pool->getVertexFormat() == VertexFormat::Compact)
+	{
+		std::vector<CompactVertex> compactVertices(data.vertexCount);
+		QuantizeVertices(data.vertices, data.vertexCount, data.bounds, compactVertices.data());
+		pool->upload(uploads, geometry, compactVertices.data(), indices);
+	}
+	else
+	{
+		pool->upload(uploads, geometry, data.vertices, indices);
+	}
 
 	model.model = glm::mat4(1.0f);
 	texId = newTexId;
+	bounds = data.bounds;
+
+	lods.assign(data.lods, data.lods + data.lodCount);
+	if (lods.empty())
+	{
+		MeshLod lod;
+		lod.indexCount = data.indexCount;
+		lods.push_back(lod);
+	}
+	meshlets.assign(data.meshlets, data.meshlets + data.meshletCount);
 }
 
 void Mesh::setModel(glm::mat4 newModel)
@@ -37,97 +81,74 @@ int Mesh::getTexId()
 	return texId;
 }
 
-int Mesh::getVertexCount()
+void Mesh::setTexId(int newTexId)
 {
-	return vertexCount;
+	texId = newTexId;
 }
 
-VkBuffer Mesh::getVertexBuffer()
+glm::vec4 Mesh::getBounds()
 {
-	return vertexBuffer;
+	return bounds;
 }
 
-int Mesh::getIndexCount()
+int Mesh::getVertexCount()
 {
-	return indexCount;
+	return geometry.vertexCount;
 }
 
-VkBuffer Mesh::getIndexBuffer()
+int32_t Mesh::getVertexOffset()
 {
-	return indexBuffer;
+	return geometry.vertexOffset;
 }
 
-void Mesh::destroyBuffers()
+size_t Mesh::getLodCount()
 {
-	vkDestroyBuffer(device, vertexBuffer, nullptr);
-	vkFreeMemory(device, vertexBufferMemory, nullptr);
-	vkDestroyBuffer(device, indexBuffer, nullptr);
-	vkFreeMemory(device, indexBufferMemory, nullptr);
+	return lods.size();
 }
 
-
-Mesh::~Mesh()
+size_t Mesh::selectLod(float pixelsPerUnit, size_t current)
 {
+	// Errors grow with every level, the current one is kept while it's good enough
+	current = std::min(current, lods.size() - 1);
+	size_t lod = 0;
+	while (lod + 1 < lods.size())
+	{
+		float limit = lod + 1 > current ? LOD_ERROR_PIXELS / LOD_HYSTERESIS : LOD_ERROR_PIXELS;
+		if (lods[lod + 1].error * pixelsPerUnit > limit)
+		{
+			break;
+		}
+		lod++;
+	}
+	return lod;
 }
 
-void Mesh::createVertexBuffer(VkQueue transferQueue, VkCommandPool transferCommandPool, std::vector<Vertex>* vertices)
+int Mesh::getIndexCount(size_t lod)
 {
-	// Get size of buffer needed for vertices
-	VkDeviceSize bufferSize = sizeof(Vertex) * vertices->size();
-
-	// Temporary buffer to "stage" vertex data before transferring to GPU
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
-
-	// Create Staging Buffer and Allocate Memory to it
-	createBuffer(physicalDevice, device, bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		&stagingBuffer, &stagingBufferMemory);
-
-	// MAP MEMORY TO VERTEX BUFFER
-	void * data;																// 1. Create pointer to a point in normal memory
-	vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);			// 2. "Map" the vertex buffer memory to that point
-	memcpy(data, vertices->data(), (size_t)bufferSize);							// 3. Copy memory from vertices vector to the point
-	vkUnmapMemory(device, stagingBufferMemory);									// 4. Unmap the vertex buffer memory
-
-	// Create buffer with TRANSFER_DST_BIT to mark as recipient of transfer data (also VERTEX_BUFFER)
-	// Buffer memory is to be DEVICE_LOCAL_BIT meaning memory is on the GPU and only accessible by it and not CPU (host)
-	createBuffer(physicalDevice, device, bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &vertexBuffer, &vertexBufferMemory);
-
-	// Copy staging buffer to vertex buffer on GPU
-	copyBuffer(device, transferQueue, transferCommandPool, stagingBuffer, vertexBuffer, bufferSize);
+	return lods[lod].indexCount;
+}
 
-	// Clean up staging buffer parts
-	vkDestroyBuffer(device, stagingBuffer, nullptr);
-	vkFreeMemory(device, stagingBufferMemory, nullptr);
+uint32_t Mesh::getFirstIndex(size_t lod)
+{
+	return geometry.firstIndex + lods[lod].firstIndex;
 }
 
-void Mesh::createIndexBuffer(VkQueue transferQueue, VkCommandPool transferCommandPool, std::vector<uint32_t>* indices)
+const std::vector<Meshlet> & Mesh::getMeshlets()
 {
-	// Get size of buffer needed for indices
-	VkDeviceSize bufferSize = sizeof(uint32_t) * indices->size();
-	
-	// Temporary buffer to "stage" index data before transferring to GPU
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
-	createBuffer(physicalDevice, device, bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &stagingBuffer, &stagingBufferMemory);
+	return meshlets;
+}
 
-	// MAP MEMORY TO INDEX BUFFER
-	void * data;																
-	vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);			
-	memcpy(data, indices->data(), (size_t)bufferSize);							
-	vkUnmapMemory(device, stagingBufferMemory);
+VkIndexType Mesh::getIndexType()
+{
+	return geometry.indexType;
+}
 
-	// Create buffer for INDEX data on GPU access only area
-	createBuffer(physicalDevice, device, bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &indexBuffer, &indexBufferMemory);
+void Mesh::destroyBuffers()
+{
+	pool->free(geometry);
+}
 
-	// Copy from staging buffer to GPU access buffer
-	copyBuffer(device, transferQueue, transferCommandPool, stagingBuffer, indexBuffer, bufferSize);
 
-	// Destroy + Release Staging Buffer resources
-	vkDestroyBuffer(device, stagingBuffer, nullptr);
-	vkFreeMemory(device, stagingBufferMemory, nullptr);
+Mesh::~Mesh()
+{
 }
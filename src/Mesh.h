@@ -6,30 +6,84 @@
 #include <vector>
 
 #include "Utilities.h"
+#include "GeometryPool.h"
+#include "MeshOptimizer.h"
 
 struct Model {
 	glm::mat4 model;
 };
 
+// Push constant block of shader.vert, instanced.vert only uses bounds and texId
+struct PushModel {
+	glm::mat4 model;
+	glm::vec4 bounds; // Dequantises CompactVertex positions
+	uint32_t texId; // Element of the bindless texture array
+};
+
+// Index range of one level of detail, relative to the mesh's first index
+struct MeshLod {
+	uint32_t firstIndex = 0;
+	uint32_t indexCount = 0;
+	float error = 0.0f; // Largest distance to the full detail surface, in model units
+};
+
+// Vertices and indices of one mesh, ready to be uploaded. Only points at
+// the data, which may live in a MeshData or a mapped MeshCache.
+struct MeshView {
+	const Vertex * vertices = nullptr;
+	uint32_t vertexCount = 0;
+	const uint32_t * indices = nullptr;
+	uint32_t indexCount = 0; // Of all levels of detail
+	const MeshLod * lods = nullptr; // Full detail first, a single level covering all indices if none
+	uint32_t lodCount = 0;
+	const Meshlet * meshlets = nullptr; // Of the full detail level, may be none
+	uint32_t meshletCount = 0;
+	uint32_t materialIndex = 0;
+	glm::vec4 bounds; // Model space bounding sphere, centre in xyz and radius in w
+};
+
+// Mesh as imported, owning its data
+struct MeshData {
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+	std::vector<MeshLod> lods;
+	std::vector<Meshlet> meshlets;
+	uint32_t materialIndex = 0;
+	glm::vec4 bounds;
+
+	MeshView view() const;
+};
+
 class Mesh
 {
 public:
 	Mesh();
-	Mesh(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, 
-		VkQueue transferQueue, VkCommandPool transferCommandPool, 
-		std::vector<Vertex> * vertices, std::vector<uint32_t> * indices,
-		int newTexId);
+	Mesh(GeometryPool * newPool, vkx::UploadBatch &uploads, const MeshView &data, int newTexId);
 
 	void setModel(glm::mat4 newModel);
 	Model getModel();
 
 	int getTexId();
+	void setTexId(int newTexId);
+
+	// Model space bounding sphere, centre in xyz and radius in w
+	glm::vec4 getBounds();
 
 	int getVertexCount();
-	VkBuffer getVertexBuffer();
+	int32_t getVertexOffset();
+
+	size_t getLodCount();
+	// Coarsest level whose error stays below LOD_ERROR_PIXELS when a model space unit covers
+	// pixelsPerUnit pixels on screen. Coarser levels than current need LOD_HYSTERESIS headroom.
+	size_t selectLod(float pixelsPerUnit, size_t current);
 
-	int getIndexCount();
-	VkBuffer getIndexBuffer();
+	int getIndexCount(size_t lod = 0);
+	uint32_t getFirstIndex(size_t lod = 0);
+
+	// Clusters of the full detail level, ranges are relative to getFirstIndex()
+	const std::vector<Meshlet> & getMeshlets();
+	// Index buffer of the pool the indices live in
+	VkIndexType getIndexType();
 
 	void destroyBuffers();
 
@@ -38,19 +92,12 @@ public:
 private:
 	Model model;
 	int texId;
+	glm::vec4 bounds;
+	std::vector<MeshLod> lods;
+	std::vector<Meshlet> meshlets;
 
-	int vertexCount;
-	VkBuffer vertexBuffer;
-	VkDeviceMemory vertexBufferMemory;
-
-	int indexCount;
-	VkBuffer indexBuffer;
-	VkDeviceMemory indexBufferMemory;
-
-	VkPhysicalDevice physicalDevice;
-	VkDevice device;
-
-	void createVertexBuffer(VkQueue transferQueue, VkCommandPool transferCommandPool, std::vector<Vertex> * vertices);
-	void createIndexBuffer(VkQueue transferQueue, VkCommandPool transferCommandPool, std::vector<uint32_t> * indices);
+	// Vertices and indices live in the shared pool buffers
+	GeometryRange geometry;
+	GeometryPool * pool;
 };
 
@@ -0,0 +1,434 @@
+#include "MeshCache.h"
+#include "MeshOptimizer.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	const char CACHE_MAGIC[4] = { 'L', 'V', 'M', 'C' };
+	// Bump whenever the layout below or the import itself changes
+	const uint32_t CACHE_VERSION = 4;
+	// Vertex and index arrays start at multiples of this
+	const size_t CACHE_ALIGNMENT = 16;
+
+	// Followed by the source path, then every texture name as length and
+	// characters, then the mesh table and the mesh data
+	struct CacheHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint32_t vertexSize;
+		uint32_t importFlags;
+		int64_t sourceTime;
+		uint64_t sourceSize;
+		uint32_t pathLength;
+		uint32_t textureCount;
+		uint32_t meshCount;
+		uint32_t optimization;
+	};
+
+	struct CacheMesh
+	{
+		uint64_t vertexOffset; // from the start of the file
+		uint64_t indexOffset;
+		uint64_t meshletOffset;
+		uint32_t vertexCount;
+		uint32_t indexCount;
+		uint32_t materialIndex;
+		uint32_t lodCount;
+		float bounds[4];
+		MeshLod lods[MAX_MESH_LODS];
+		uint32_t meshletCount;
+		uint32_t padding;
+	};
+
+	size_t alignOffset(size_t offset)
+	{
+		return (offset + CACHE_ALIGNMENT - 1) / CACHE_ALIGNMENT * CACHE_ALIGNMENT;
+	}
+
+	// True if count elements of elementSize fit into the file at offset
+	bool fits(uint64_t offset, uint64_t count, size_t elementSize, size_t fileSize)
+	{
+		return offset % CACHE_ALIGNMENT == 0 && offset <= fileSize &&
+			count <= (fileSize - offset) / elementSize;
+	}
+}
+
+
+
+MeshCache::MeshCache()
+{
+}
+
+bool MeshCache::open(const std::string & sourceFile, unsigned int importFlags, uint32_t optimization)
+{
+	close();
+	if (!map(getCachePath(sourceFile)))
+	{
+		return false;
+	}
+
+	// A stale or broken cache is treated like a missing one
+	if (!parse(sourceFile, importFlags, optimization))
+	{
+		close();
+		return false;
+	}
+
+	return true;
+}
+
+void MeshCache::write(const std::string & sourceFile, unsigned int importFlags, uint32_t optimization,
+	const std::vector<std::string> & textureNames, const std::vector<MeshData> & meshes)
+{
+	CacheHeader header = {};
+	if (!getSourceStamp(sourceFile, &header.sourceTime, &header.sourceSize))
+	{
+		throw std::runtime_error("Failed to read model file time! (" + sourceFile + ")");
+	}
+	memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+	header.version = CACHE_VERSION;
+	header.vertexSize = sizeof(Vertex);
+	header.importFlags = importFlags;
+	header.optimization = optimization;
+	header.pathLength = static_cast<uint32_t>(sourceFile.size());
+	header.textureCount = static_cast<uint32_t>(textureNames.size());
+	header.meshCount = static_cast<uint32_t>(meshes.size());
+
+	// Lay the file out first, the mesh table holds absolute offsets
+	size_t offset = sizeof(CacheHeader) + sourceFile.size();
+	for (auto & name : textureNames)
+	{
+		offset += sizeof(uint32_t) + name.size();
+	}
+	offset = alignOffset(offset) + sizeof(CacheMesh) * meshes.size();
+
+	std::vector<CacheMesh> table(meshes.size());
+	for (size_t i = 0; i < meshes.size(); i++)
+	{
+		auto & entry = table[i];
+		entry.vertexCount = static_cast<uint32_t>(meshes[i].vertices.size());
+		entry.indexCount = static_cast<uint32_t>(meshes[i].indices.size());
+		entry.materialIndex = meshes[i].materialIndex;
+		memcpy(entry.bounds, &meshes[i].bounds, sizeof(entry.bounds));
+		entry.lodCount = static_cast<uint32_t>(std::min<size_t>(meshes[i].lods.size(), MAX_MESH_LODS));
+		std::copy(meshes[i].lods.begin(), meshes[i].lods.begin() + entry.lodCount, entry.lods);
+
+		entry.vertexOffset = alignOffset(offset);
+		offset = entry.vertexOffset + sizeof(Vertex) * entry.vertexCount;
+		entry.indexOffset = alignOffset(offset);
+		offset = entry.indexOffset + sizeof(uint32_t) * entry.indexCount;
+		entry.meshletCount = static_cast<uint32_t>(meshes[i].meshlets.size());
+		entry.meshletOffset = alignOffset(offset);
+		offset = entry.meshletOffset + sizeof(Meshlet) * entry.meshletCount;
+	}
+
+	// Written next to the cache and renamed over it, a reader never sees half a file
+	auto cachePath = getCachePath(sourceFile);
+	auto tempPath = cachePath + ".tmp";
+	{
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		if (!file.is_open())
+		{
+			throw std::runtime_error("Failed to create mesh cache! (" + cachePath + ")");
+		}
+
+		size_t written = 0;
+		auto put = [&](const void * src, size_t bytes)
+		{
+			file.write(static_cast<const char *>(src), bytes);
+			written += bytes;
+		};
+		auto pad = [&]()
+		{
+			static const char zeros[CACHE_ALIGNMENT] = {};
+			put(zeros, alignOffset(written) - written);
+		};
+
+		put(&header, sizeof(header));
+		put(sourceFile.data(), sourceFile.size());
+		for (auto & name : textureNames)
+		{
+			uint32_t length = static_cast<uint32_t>(name.size());
+			put(&length, sizeof(length));
+			put(name.data(), name.size());
+		}
+		pad();
+		put(table.data(), sizeof(CacheMesh) * table.size());
+		for (auto & mesh : meshes)
+		{
+			pad();
+			put(mesh.vertices.data(), sizeof(Vertex) * mesh.vertices.size());
+			pad();
+			put(mesh.indices.data(), sizeof(uint32_t) * mesh.indices.size());
+			pad();
+			put(mesh.meshlets.data(), sizeof(Meshlet) * mesh.meshlets.size());
+		}
+
+		if (!file.flush())
+		{
+			throw std::runtime_error("Failed to write mesh cache! (" + cachePath + ")");
+		}
+	}
+
+	std::error_code error;
+	std::filesystem::rename(tempPath, cachePath, error);
+	if (error)
+	{
+		std::filesystem::remove(tempPath, error);
+		throw std::runtime_error("Failed to replace mesh cache! (" + cachePath + ")");
+	}
+}
+
+std::vector<std::string> MeshCache::getTextureNames()
+{
+	return textureNames;
+}
+
+std::vector<MeshView> MeshCache::getMeshes()
+{
+	return meshes;
+}
+
+void MeshCache::close()
+{
+	if (data)
+	{
+#ifdef _WIN32
+		UnmapViewOfFile(data);
+		CloseHandle(mapping);
+		mapping = nullptr;
+#else
+		munmap(const_cast<char *>(data), size);
+#endif
+	}
+
+	data = nullptr;
+	size = 0;
+	textureNames.clear();
+	meshes.clear();
+}
+
+MeshCache::~MeshCache()
+{
+	close();
+}
+
+bool MeshCache::map(const std::string & path)
+{
+	// The file itself can be closed again, the mapping keeps it open
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0)
+	{
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	}
+	CloseHandle(file);
+	if (!mapping)
+	{
+		return false;
+	}
+
+	data = static_cast<const char *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+	if (!data)
+	{
+		CloseHandle(mapping);
+		mapping = nullptr;
+		return false;
+	}
+	size = static_cast<size_t>(fileSize.QuadPart);
+#else
+	int file = ::open(path.c_str(), O_RDONLY);
+	if (file < 0)
+	{
+		return false;
+	}
+
+	struct stat fileStat;
+	void * view = MAP_FAILED;
+	if (fstat(file, &fileStat) == 0 && fileStat.st_size > 0)
+	{
+		view = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+	}
+	::close(file);
+	if (view == MAP_FAILED)
+	{
+		return false;
+	}
+
+	data = static_cast<const char *>(view);
+	size = static_cast<size_t>(fileStat.st_size);
+#endif
+
+	return true;
+}
+
+bool MeshCache::parse(const std::string & sourceFile, unsigned int importFlags, uint32_t optimization)
+{
+	size_t offset = 0;
+	auto read = [&](void * dst, size_t bytes)
+	{
+		if (bytes > size - offset)
+		{
+			return false;
+		}
+		memcpy(dst, data + offset, bytes);
+		offset += bytes;
+		return true;
+	};
+
+	CacheHeader header;
+	if (!read(&header, sizeof(header)) ||
+		memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+		header.version != CACHE_VERSION ||
+		header.vertexSize != sizeof(Vertex) ||
+		header.importFlags != importFlags ||
+		header.optimization != optimization)
+	{
+		return false;
+	}
+
+	// Key of the cache, the source must not have changed since it was written
+	int64_t sourceTime;
+	uint64_t sourceSize;
+	if (!getSourceStamp(sourceFile, &sourceTime, &sourceSize) ||
+		header.sourceTime != sourceTime || header.sourceSize != sourceSize)
+	{
+		return false;
+	}
+
+	std::string path(header.pathLength, '\0');
+	if (!read(&path[0], path.size()) || path != sourceFile)
+	{
+		return false;
+	}
+
+	textureNames.resize(header.textureCount);
+	for (auto & name : textureNames)
+	{
+		uint32_t length;
+		if (!read(&length, sizeof(length)))
+		{
+			return false;
+		}
+		name.resize(length);
+		if (!read(&name[0], length))
+		{
+			return false;
+		}
+	}
+
+	offset = alignOffset(offset);
+	if (offset > size)
+	{
+		return false;
+	}
+
+	meshes.resize(header.meshCount);
+	for (auto & meshView : meshes)
+	{
+		const char * entryData = data + offset;
+		CacheMesh entry;
+		if (!read(&entry, sizeof(entry)) ||
+			!fits(entry.vertexOffset, entry.vertexCount, sizeof(Vertex), size) ||
+			!fits(entry.indexOffset, entry.indexCount, sizeof(uint32_t), size) ||
+			!fits(entry.meshletOffset, entry.meshletCount, sizeof(Meshlet), size) ||
+			entry.materialIndex >= textureNames.size() ||
+			entry.lodCount > MAX_MESH_LODS)
+		{
+			return false;
+		}
+		for (uint32_t i = 0; i < entry.lodCount; i++)
+		{
+			if (entry.lods[i].firstIndex > entry.indexCount ||
+				entry.lods[i].indexCount > entry.indexCount - entry.lods[i].firstIndex)
+			{
+				return false;
+			}
+		}
+
+		// Out of range indices would reach the GPU as they are
+		auto indices = reinterpret_cast<const uint32_t *>(data + entry.indexOffset);
+		for (uint32_t i = 0; i < entry.indexCount; i++)
+		{
+			if (indices[i] >= entry.vertexCount)
+			{
+				return false;
+			}
+		}
+
+		// Meshlets only cover the full detail level
+		auto meshlets = reinterpret_cast<const Meshlet *>(data + entry.meshletOffset);
+		uint32_t fullDetailCount = entry.lodCount > 0 ? entry.lods[0].indexCount : entry.indexCount;
+		for (uint32_t i = 0; i < entry.meshletCount; i++)
+		{
+			if (meshlets[i].firstIndex > fullDetailCount ||
+				meshlets[i].indexCount > fullDetailCount - meshlets[i].firstIndex)
+			{
+				return false;
+			}
+		}
+
+		// The mapping is page aligned, so the arrays are aligned too
+		meshView.vertices = reinterpret_cast<const Vertex *>(data + entry.vertexOffset);
+		meshView.vertexCount = entry.vertexCount;
+		meshView.indices = indices;
+		meshView.indexCount = entry.indexCount;
+		meshView.lods = reinterpret_cast<const MeshLod *>(entryData + offsetof(CacheMesh, lods));
+		meshView.lodCount = entry.lodCount;
+		meshView.meshlets = meshlets;
+		meshView.meshletCount = entry.meshletCount;
+		meshView.materialIndex = entry.materialIndex;
+		memcpy(&meshView.bounds, entry.bounds, sizeof(entry.bounds));
+	}
+
+	return true;
+}
+
+std::string MeshCache::getCachePath(const std::string & sourceFile)
+{
+	return sourceFile + ".meshcache";
+}
+
+bool MeshCache::getSourceStamp(const std::string & sourceFile, int64_t * time, uint64_t * fileSize)
+{
+	std::error_code error;
+	auto writeTime = std::filesystem::last_write_time(sourceFile, error);
+	if (error)
+	{
+		return false;
+	}
+	auto bytes = std::filesystem::file_size(sourceFile, error);
+	if (error)
+	{
+		return false;
+	}
+
+	*time = static_cast<int64_t>(writeTime.time_since_epoch().count());
+	*fileSize = static_cast<uint64_t>(bytes);
+	return true;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "Mesh.h"
+
+// Binary copy of an imported model: the final vertices, indices, levels of
+// detail and meshlets of every mesh plus the texture of every material. A
+// cache is only used for the source path, modification time, import flags
+// and optimization passes (MeshOptimization) it was written for.
+// Reading it maps the file once, meshes point straight into the mapping.
+class MeshCache
+{
+public:
+	MeshCache();
+	MeshCache(const MeshCache &) = delete;
+	MeshCache & operator=(const MeshCache &) = delete;
+
+	// Maps the cache of sourceFile, false if there is none or it is stale
+	bool open(const std::string & sourceFile, unsigned int importFlags, uint32_t optimization);
+
+	// Replaces the cache of sourceFile, textureNames holds one entry per material
+	static void write(const std::string & sourceFile, unsigned int importFlags, uint32_t optimization,
+		const std::vector<std::string> & textureNames, const std::vector<MeshData> & meshes);
+
+	std::vector<std::string> getTextureNames();
+	// Valid until the cache is closed
+	std::vector<MeshView> getMeshes();
+
+	void close();
+
+	~MeshCache();
+
+private:
+	const char * data = nullptr;
+	size_t size = 0;
+#ifdef _WIN32
+	void * mapping = nullptr;
+#endif
+
+	std::vector<std::string> textureNames;
+	std::vector<MeshView> meshes;
+
+	bool map(const std::string & path);
+	bool parse(const std::string & sourceFile, unsigned int importFlags, uint32_t optimization);
+
+	static std::string getCachePath(const std::string & sourceFile);
+	static bool getSourceStamp(const std::string & sourceFile, int64_t * time, uint64_t * fileSize);
+};
@@ -1,4 +1,9 @@
 #include "MeshModel.h"
+#include "VertexConversion.h"
+
+#include <algorithm>
+#include <cstring>
+#include <numeric>
 
 
 
@@ -9,7 +14,7 @@ MeshModel::MeshModel()
 MeshModel::MeshModel(std::vector<Mesh> newMeshList)
 {
 	meshList = newMeshList;
-	model = glm::mat4(1.0f);
+	instances = { glm::mat4(1.0f) };
 }
 
 size_t MeshModel::getMeshCount()
@@ -29,12 +34,43 @@ Mesh * MeshModel::getMesh(size_t index)
 
 glm::mat4 MeshModel::getModel()
 {
-	return model;
+	return instances[0];
 }
 
 void MeshModel::setModel(glm::mat4 newModel)
 {
-	model = newModel;
+	instances[0] = newModel;
+}
+
+size_t MeshModel::addInstance(glm::mat4 newModel)
+{
+	instances.push_back(newModel);
+	return instances.size() - 1;
+}
+
+size_t MeshModel::getInstanceCount()
+{
+	return instances.size();
+}
+
+glm::mat4 MeshModel::getInstance(size_t index)
+{
+	if (index >= instances.size())
+	{
+		throw std::runtime_error("Attempted to access invalid Instance index!");
+	}
+
+	return instances[index];
+}
+
+void MeshModel::setInstance(size_t index, glm::mat4 newModel)
+{
+	if (index >= instances.size())
+	{
+		throw std::runtime_error("Attempted to access invalid Instance index!");
+	}
+
+	instances[index] = newModel;
 }
 
 void MeshModel::destroyMeshModel()
@@ -78,73 +114,200 @@ std::vector<std::string> MeshModel::LoadMaterials(const aiScene * scene)
 	return textureList;
 }
 
-std::vector<Mesh> MeshModel::LoadNode(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VkQueue transferQueue, VkCommandPool transferCommandPool, aiNode * node, const aiScene * scene, std::vector<int> matToTex)
+std::vector<MeshData> MeshModel::LoadScene(const aiScene * scene, ThreadPool & threads, uint32_t optimization,
+	VertexCacheStats * before, VertexCacheStats * after)
 {
-	std::vector<Mesh> meshList;
+	std::vector<aiMesh *> meshes;
+	LoadNode(scene->mRootNode, scene, meshes);
 
-	// Go through each mesh at this node and create it, then add it to our meshList
-	for (size_t i = 0; i < node->mNumMeshes; i++)
+	// One job per mesh, the largest first so a big mesh doesn't end up last on one thread
+	std::vector<size_t> order(meshes.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::sort(order.begin(), order.end(), [&meshes](size_t a, size_t b)
 	{
-		meshList.push_back(
-			LoadMesh(newPhysicalDevice, newDevice, transferQueue, transferCommandPool, scene->mMeshes[node->mMeshes[i]], scene, matToTex)
-		);
+		return meshes[a]->mNumVertices > meshes[b]->mNumVertices;
+	});
+
+	// Every job writes only its own elements
+	std::vector<MeshData> meshList(meshes.size());
+	std::vector<VertexCacheStats> meshBefore(meshes.size());
+	std::vector<VertexCacheStats> meshAfter(meshes.size());
+	for (auto i : order)
+	{
+		threads.submit([&meshList, &meshes, &meshBefore, &meshAfter, optimization, i](size_t)
+		{
+			meshList[i] = LoadMesh(meshes[i]);
+
+			// Points and lines have no cache behaviour worth optimizing
+			auto & meshData = meshList[i];
+			if (optimization == MESH_OPTIMIZE_NONE || meshes[i]->mPrimitiveTypes != aiPrimitiveType_TRIANGLE)
+			{
+				return;
+			}
+			meshBefore[i] = AnalyzeVertexCache(meshData.indices.data(), meshData.indices.size(), meshData.vertices.size());
+			OptimizeMesh(meshData, optimization);
+			meshAfter[i] = AnalyzeVertexCache(meshData.indices.data(), meshData.lods[0].indexCount, meshData.vertices.size());
+		});
 	}
+	threads.wait();
 
-	// Go through each node attached to this node and load it, then append their meshes to this node's mesh list
-	for (size_t i = 0; i < node->mNumChildren; i++)
+	for (size_t i = 0; i < meshes.size(); i++)
 	{
-		std::vector<Mesh> newList = LoadNode(newPhysicalDevice, newDevice, transferQueue, transferCommandPool, node->mChildren[i], scene, matToTex);
-		meshList.insert(meshList.end(), newList.begin(), newList.end());
+		if (before)
+		{
+			before->add(meshBefore[i]);
+		}
+		if (after)
+		{
+			after->add(meshAfter[i]);
+		}
 	}
 
 	return meshList;
 }
 
-Mesh MeshModel::LoadMesh(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VkQueue transferQueue, VkCommandPool transferCommandPool, aiMesh * mesh, const aiScene * scene, std::vector<int> matToTex)
+void MeshModel::LoadNode(aiNode * node, const aiScene * scene, std::vector<aiMesh *> & meshes)
+{
+	// Go through each mesh at this node and add it to the list
+	for (size_t i = 0; i < node->mNumMeshes; i++)
+	{
+		meshes.push_back(scene->mMeshes[node->mMeshes[i]]);
+	}
+
+	// Go through each node attached to this node and append its meshes after this node's
+	for (size_t i = 0; i < node->mNumChildren; i++)
+	{
+		LoadNode(node->mChildren[i], scene, meshes);
+	}
+}
+
+MeshData MeshModel::LoadMesh(aiMesh * mesh)
 {
-	std::vector<Vertex> vertices;
-	std::vector<uint32_t> indices;
+	MeshData meshData;
+	auto & vertices = meshData.vertices;
+	auto & indices = meshData.indices;
 
 	// Resize vertex list to hold all vertices for mesh
 	vertices.resize(mesh->mNumVertices);
 
-	// Go through each vertex and copy it across to our vertices
-	for (size_t i = 0; i < mesh->mNumVertices; i++)
-	{
-		// Set position
-		vertices[i].pos = { mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z };
-
-		// Set tex coords (if they exist)
-		if (mesh->mTextureCoords[0])
-		{
-			vertices[i].tex = { mesh->mTextureCoords[0][i].x, mesh->mTextureCoords[0][i].y };
-		}
-		else
-		{
-			vertices[i].tex = { 0.0f, 0.0f };
-		}
+	// Copy positions and tex coords (if they exist) across to our vertices in bulk,
+	// colour is just white for now
+	static_assert(sizeof(aiVector3D) == 3 * sizeof(float), "Vertex conversion expects float vectors");
+	ConvertVertices(&mesh->mVertices[0].x,
+		mesh->mTextureCoords[0] ? &mesh->mTextureCoords[0][0].x : nullptr,
+		mesh->mNumVertices, glm::vec3(1.0f, 1.0f, 1.0f), vertices.data());
 
-		// Set colour (just use white for now)
-		vertices[i].col = { 1.0f, 1.0f, 1.0f };
+	// Size the index list up front, faces are triangles after aiProcess_Triangulate
+	// except for points and lines
+	size_t indexCount = 0;
+	for (size_t i = 0; i < mesh->mNumFaces; i++)
+	{
+		indexCount += mesh->mFaces[i].mNumIndices;
 	}
+	indices.resize(indexCount);
 
 	// Iterate over indices through faces and copy across
+	uint32_t * index = indices.data();
 	for (size_t i = 0; i < mesh->mNumFaces; i++)
 	{
 		// Get a face
-		aiFace face = mesh->mFaces[i];
+		const aiFace & face = mesh->mFaces[i];
 
 		// Go through face's indices and add to list
-		for (size_t j = 0; j < face.mNumIndices; j++)
+		memcpy(index, face.mIndices, sizeof(uint32_t) * face.mNumIndices);
+		index += face.mNumIndices;
+	}
+
+	// Bounding sphere for culling, centred on the bounding box
+	glm::vec3 boundsMin = vertices.empty() ? glm::vec3(0.0f) : vertices[0].pos;
+	glm::vec3 boundsMax = boundsMin;
+	for (auto const & vertex : vertices)
+	{
+		boundsMin = glm::min(boundsMin, vertex.pos);
+		boundsMax = glm::max(boundsMax, vertex.pos);
+	}
+
+	glm::vec3 centre = (boundsMin + boundsMax) * 0.5f;
+	float radius = 0.0f;
+	for (auto const & vertex : vertices)
+	{
+		radius = glm::max(radius, glm::length(vertex.pos - centre));
+	}
+
+	meshData.materialIndex = mesh->mMaterialIndex;
+	meshData.bounds = glm::vec4(centre, radius);
+
+	// Full detail only, OptimizeMesh may add simplified levels
+	MeshLod lod;
+	lod.indexCount = static_cast<uint32_t>(indices.size());
+	meshData.lods.push_back(lod);
+
+	return meshData;
+}
+
+void MeshModel::OptimizeMesh(MeshData & meshData, uint32_t optimization)
+{
+	auto & vertices = meshData.vertices;
+	auto & indices = meshData.indices;
+	auto & lods = meshData.lods;
+	bool vertexCache = (optimization & MESH_OPTIMIZE_VERTEX_CACHE) != 0;
+
+	// Triangle order first, the overdraw pass moves whole clusters and the vertex
+	// order follows the final triangle order
+	if (vertexCache)
+	{
+		auto clusters = OptimizeVertexCache(indices.data(), indices.size(), vertices.size());
+		if (optimization & MESH_OPTIMIZE_OVERDRAW)
+		{
+			OptimizeOverdraw(indices.data(), indices.size(), vertices.data(), clusters);
+		}
+	}
+
+	// Every level halves the one before and is appended to the indices, so all of them
+	// share the vertices. Errors add up since each level only knows its predecessor.
+	if (optimization & MESH_OPTIMIZE_LODS)
+	{
+		std::vector<uint32_t> previous = indices;
+		float error = 0.0f;
+		while (lods.size() < MAX_MESH_LODS)
 		{
-			indices.push_back(face.mIndices[j]);
+			float lodError = 0.0f;
+			auto simplified = SimplifyMesh(previous.data(), previous.size(), vertices.data(), vertices.size(),
+				previous.size() / 2, &lodError);
+
+			// A level that barely shrinks isn't worth its index memory
+			if (simplified.empty() || simplified.size() > previous.size() * 3 / 4)
+			{
+				break;
+			}
+			if (vertexCache)
+			{
+				OptimizeVertexCache(simplified.data(), simplified.size(), vertices.size());
+			}
+
+			error += lodError;
+			MeshLod lod;
+			lod.firstIndex = static_cast<uint32_t>(indices.size());
+			lod.indexCount = static_cast<uint32_t>(simplified.size());
+			lod.error = error;
+			lods.push_back(lod);
+
+			indices.insert(indices.end(), simplified.begin(), simplified.end());
+			previous = std::move(simplified);
 		}
 	}
 
-	// Create new mesh with details and return it
-	Mesh newMesh = Mesh(newPhysicalDevice, newDevice, transferQueue, transferCommandPool, &vertices, &indices, matToTex[mesh->mMaterialIndex]);
+	// Full detail decides the vertex order, coarser levels use a subset of it
+	if (vertexCache)
+	{
+		vertices.resize(OptimizeVertexFetch(vertices.data(), vertices.size(), indices.data(), indices.size()));
+	}
 
-	return newMesh;
+	// Renumbering keeps the triangle order, so the meshlets can be cut last
+	if (optimization & MESH_OPTIMIZE_MESHLETS)
+	{
+		meshData.meshlets = BuildMeshlets(indices.data(), lods[0].indexCount, vertices.data(), vertices.size());
+	}
 }
 
 
@@ -7,6 +7,8 @@
 #include <assimp/scene.h>
 
 #include "Mesh.h"
+#include "MeshOptimizer.h"
+#include "ThreadPool.h"
 
 class MeshModel
 {
@@ -17,21 +19,34 @@ public:
 	size_t getMeshCount();
 	Mesh * getMesh(size_t index);
 
+	// The model transform is the transform of instance 0
 	glm::mat4 getModel();
 	void setModel(glm::mat4 newModel);
 
+	// Every instance draws the same meshes with its own transform
+	size_t addInstance(glm::mat4 newModel);
+	size_t getInstanceCount();
+	glm::mat4 getInstance(size_t index);
+	void setInstance(size_t index, glm::mat4 newModel);
+
 	void destroyMeshModel();
 
 	static std::vector<std::string> LoadMaterials(const aiScene * scene);
-	static std::vector<Mesh> LoadNode(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VkQueue transferQueue, VkCommandPool transferCommandPool,
-		aiNode * node, const aiScene * scene, std::vector<int> matToTex);
-	static Mesh LoadMesh(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VkQueue transferQueue, VkCommandPool transferCommandPool,
-		aiMesh * mesh, const aiScene * scene, std::vector<int> matToTex);
+	// Converts every mesh of the scene into our vertex format on threads, in node order, and
+	// runs the optimization passes (MeshOptimization flags) on it. Nothing is uploaded yet.
+	// before and after receive the cache statistics of the optimized meshes if not null.
+	static std::vector<MeshData> LoadScene(const aiScene * scene, ThreadPool & threads, uint32_t optimization,
+		VertexCacheStats * before = nullptr, VertexCacheStats * after = nullptr);
+	// Appends the meshes of node and its children
+	static void LoadNode(aiNode * node, const aiScene * scene, std::vector<aiMesh *> & meshes);
+	static MeshData LoadMesh(aiMesh * mesh);
+	// Only for triangle lists, adds the simplified levels of detail and meshlets
+	static void OptimizeMesh(MeshData & meshData, uint32_t optimization);
 
 	~MeshModel();
 
 private:
 	std::vector<Mesh> meshList;
-	glm::mat4 model;
+	std::vector<glm::mat4> instances;
 };
 
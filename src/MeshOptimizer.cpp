@@ -0,0 +1,634 @@
+#include "MeshOptimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <unordered_map>
+
+
+
+void VertexCacheStats::add(const VertexCacheStats & other)
+{
+	transformed += other.transformed;
+	triangles += other.triangles;
+	vertices += other.vertices;
+}
+
+float VertexCacheStats::getAcmr() const
+{
+	return triangles ? static_cast<float>(transformed) / static_cast<float>(triangles) : 0.0f;
+}
+
+float VertexCacheStats::getAtvr() const
+{
+	return vertices ? static_cast<float>(transformed) / static_cast<float>(vertices) : 0.0f;
+}
+
+VertexCacheStats AnalyzeVertexCache(const uint32_t * indices, size_t indexCount, size_t vertexCount,
+	uint32_t cacheSize)
+{
+	VertexCacheStats stats;
+	stats.triangles = indexCount / 3;
+
+	// A vertex is cached if fewer than cacheSize misses happened since it was last transformed
+	const uint64_t notCached = UINT64_MAX;
+	std::vector<uint64_t> cacheTime(vertexCount, notCached);
+	uint64_t time = 0;
+	for (size_t i = 0; i < indexCount; i++)
+	{
+		uint32_t v = indices[i];
+		if (cacheTime[v] == notCached)
+		{
+			stats.vertices++;
+		}
+		else if (time - cacheTime[v] < cacheSize)
+		{
+			continue;
+		}
+
+		cacheTime[v] = time++;
+		stats.transformed++;
+	}
+
+	return stats;
+}
+
+std::vector<uint32_t> OptimizeVertexCache(uint32_t * indices, size_t indexCount, size_t vertexCount,
+	uint32_t cacheSize)
+{
+	std::vector<uint32_t> clusters;
+	size_t triangleCount = indexCount / 3;
+	if (triangleCount == 0)
+	{
+		return clusters;
+	}
+
+	// Triangles using each vertex, offsets into one shared list
+	std::vector<uint32_t> live(vertexCount, 0);
+	for (size_t i = 0; i < triangleCount * 3; i++)
+	{
+		live[indices[i]]++;
+	}
+	std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+	for (size_t v = 0; v < vertexCount; v++)
+	{
+		adjacencyOffsets[v + 1] = adjacencyOffsets[v] + live[v];
+	}
+	std::vector<uint32_t> adjacency(triangleCount * 3);
+	std::vector<uint32_t> adjacencyFill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		for (size_t k = 0; k < 3; k++)
+		{
+			adjacency[adjacencyFill[indices[t * 3 + k]]++] = static_cast<uint32_t>(t);
+		}
+	}
+
+	std::vector<uint32_t> output;
+	output.reserve(triangleCount * 3);
+	std::vector<bool> emitted(triangleCount, false);
+	std::vector<int64_t> cacheTime(vertexCount, 0);
+	int64_t timeStamp = cacheSize + 1;
+	std::vector<uint32_t> deadEnds;
+	std::vector<uint32_t> candidates;
+	size_t cursor = 0;
+
+	// Next vertex with live triangles if the fan ran dry, the most recently used first
+	auto skipDeadEnd = [&]() -> int64_t
+	{
+		while (!deadEnds.empty())
+		{
+			uint32_t v = deadEnds.back();
+			deadEnds.pop_back();
+			if (live[v] > 0)
+			{
+				return v;
+			}
+		}
+		for (; cursor < vertexCount; cursor++)
+		{
+			if (live[cursor] > 0)
+			{
+				return static_cast<int64_t>(cursor);
+			}
+		}
+		return -1;
+	};
+
+	int64_t fanning = skipDeadEnd();
+	clusters.push_back(0);
+	while (fanning >= 0)
+	{
+		// Emit every remaining triangle around the fanning vertex
+		candidates.clear();
+		for (uint32_t a = adjacencyOffsets[fanning]; a < adjacencyOffsets[fanning + 1]; a++)
+		{
+			uint32_t t = adjacency[a];
+			if (emitted[t])
+			{
+				continue;
+			}
+
+			for (size_t k = 0; k < 3; k++)
+			{
+				uint32_t v = indices[t * 3 + k];
+				output.push_back(v);
+				deadEnds.push_back(v);
+				candidates.push_back(v);
+				live[v]--;
+				if (timeStamp - cacheTime[v] > cacheSize)
+				{
+					cacheTime[v] = timeStamp++;
+				}
+			}
+			emitted[t] = true;
+		}
+
+		// Prefer the candidate that is still cached after its remaining triangles, then the
+		// oldest one so it is used before it falls out
+		int64_t next = -1;
+		int64_t bestPriority = -1;
+		for (auto v : candidates)
+		{
+			if (live[v] == 0)
+			{
+				continue;
+			}
+
+			int64_t priority = 0;
+			if (timeStamp - cacheTime[v] + 2 * static_cast<int64_t>(live[v]) <= cacheSize)
+			{
+				priority = timeStamp - cacheTime[v];
+			}
+			if (priority > bestPriority)
+			{
+				bestPriority = priority;
+				next = v;
+			}
+		}
+
+		// A dead end flushes the locality, the overdraw pass may reorder from here
+		if (next < 0)
+		{
+			next = skipDeadEnd();
+			uint32_t firstTriangle = static_cast<uint32_t>(output.size() / 3);
+			if (next >= 0 && firstTriangle != clusters.back())
+			{
+				clusters.push_back(firstTriangle);
+			}
+		}
+		fanning = next;
+	}
+
+	memcpy(indices, output.data(), sizeof(uint32_t) * output.size());
+
+	return clusters;
+}
+
+void OptimizeOverdraw(uint32_t * indices, size_t indexCount, const Vertex * vertices,
+	const std::vector<uint32_t> & clusters)
+{
+	size_t triangleCount = indexCount / 3;
+	if (clusters.size() < 2)
+	{
+		return;
+	}
+
+	// Area weighted centre of the mesh and of every cluster, plus the cluster's average normal
+	glm::vec3 meshCentre(0.0f);
+	float meshArea = 0.0f;
+	std::vector<glm::vec3> clusterCentres(clusters.size(), glm::vec3(0.0f));
+	std::vector<glm::vec3> clusterNormals(clusters.size(), glm::vec3(0.0f));
+	for (size_t c = 0; c < clusters.size(); c++)
+	{
+		size_t end = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+		float clusterArea = 0.0f;
+		for (size_t t = clusters[c]; t < end; t++)
+		{
+			glm::vec3 p0 = vertices[indices[t * 3]].pos;
+			glm::vec3 p1 = vertices[indices[t * 3 + 1]].pos;
+			glm::vec3 p2 = vertices[indices[t * 3 + 2]].pos;
+
+			glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+			float area = glm::length(normal);
+			glm::vec3 centre = (p0 + p1 + p2) * (area / 3.0f);
+
+			clusterCentres[c] += centre;
+			clusterNormals[c] += normal;
+			clusterArea += area;
+			meshCentre += centre;
+			meshArea += area;
+		}
+		if (clusterArea > 0.0f)
+		{
+			clusterCentres[c] /= clusterArea;
+		}
+	}
+	if (meshArea > 0.0f)
+	{
+		meshCentre /= meshArea;
+	}
+
+	// How far the cluster points away from the centre
+	std::vector<float> sortKeys(clusters.size(), 0.0f);
+	for (size_t c = 0; c < clusters.size(); c++)
+	{
+		float normalLength = glm::length(clusterNormals[c]);
+		if (normalLength > 0.0f)
+		{
+			sortKeys[c] = glm::dot(clusterCentres[c] - meshCentre, clusterNormals[c] / normalLength);
+		}
+	}
+
+	std::vector<size_t> order(clusters.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&sortKeys](size_t a, size_t b)
+	{
+		return sortKeys[a] > sortKeys[b];
+	});
+
+	std::vector<uint32_t> sorted;
+	sorted.reserve(triangleCount * 3);
+	for (auto c : order)
+	{
+		size_t end = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+		sorted.insert(sorted.end(), indices + clusters[c] * 3, indices + end * 3);
+	}
+	memcpy(indices, sorted.data(), sizeof(uint32_t) * sorted.size());
+}
+
+size_t OptimizeVertexFetch(Vertex * vertices, size_t vertexCount, uint32_t * indices, size_t indexCount)
+{
+	const uint32_t unused = UINT32_MAX;
+	std::vector<uint32_t> remap(vertexCount, unused);
+	uint32_t nextVertex = 0;
+	for (size_t i = 0; i < indexCount; i++)
+	{
+		uint32_t & newIndex = remap[indices[i]];
+		if (newIndex == unused)
+		{
+			newIndex = nextVertex++;
+		}
+		indices[i] = newIndex;
+	}
+
+	std::vector<Vertex> reordered(nextVertex);
+	for (size_t v = 0; v < vertexCount; v++)
+	{
+		if (remap[v] != unused)
+		{
+			reordered[remap[v]] = vertices[v];
+		}
+	}
+	std::copy(reordered.begin(), reordered.end(), vertices);
+
+	return nextVertex;
+}
+
+namespace
+{
+	// Symmetric 4x4 matrix of summed squared plane distances
+	struct Quadric
+	{
+		double a00 = 0, a01 = 0, a02 = 0, a11 = 0, a12 = 0, a22 = 0;
+		double b0 = 0, b1 = 0, b2 = 0;
+		double c = 0;
+
+		void addPlane(glm::vec3 n, double d)
+		{
+			a00 += n.x * n.x; a01 += n.x * n.y; a02 += n.x * n.z;
+			a11 += n.y * n.y; a12 += n.y * n.z; a22 += n.z * n.z;
+			b0 += n.x * d; b1 += n.y * d; b2 += n.z * d;
+			c += d * d;
+		}
+
+		void add(const Quadric & other)
+		{
+			a00 += other.a00; a01 += other.a01; a02 += other.a02;
+			a11 += other.a11; a12 += other.a12; a22 += other.a22;
+			b0 += other.b0; b1 += other.b1; b2 += other.b2;
+			c += other.c;
+		}
+
+		double evaluate(glm::vec3 point) const
+		{
+			double x = point.x;
+			double y = point.y;
+			double z = point.z;
+			double result = a00 * x * x + a11 * y * y + a22 * z * z +
+				2.0 * (a01 * x * y + a02 * x * z + a12 * y * z) +
+				2.0 * (b0 * x + b1 * y + b2 * z) + c;
+			return result > 0.0 ? result : 0.0;
+		}
+	};
+
+	struct Collapse
+	{
+		uint32_t from;
+		uint32_t to;
+		double cost;
+	};
+}
+
+std::vector<uint32_t> SimplifyMesh(const uint32_t * indices, size_t indexCount, const Vertex * vertices,
+	size_t vertexCount, size_t targetIndexCount, float * error)
+{
+	std::vector<uint32_t> result(indices, indices + indexCount / 3 * 3);
+	double maxCost = 0.0;
+
+	// Plane of every triangle, a vertex starts with the planes of its triangles
+	std::vector<Quadric> quadrics(vertexCount);
+	for (size_t t = 0; t < result.size(); t += 3)
+	{
+		glm::vec3 p0 = vertices[result[t]].pos;
+		glm::vec3 p1 = vertices[result[t + 1]].pos;
+		glm::vec3 p2 = vertices[result[t + 2]].pos;
+		glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+		float length = glm::length(normal);
+		if (length == 0.0f)
+		{
+			continue;
+		}
+		normal /= length;
+
+		Quadric plane;
+		plane.addPlane(normal, -glm::dot(normal, p0));
+		for (size_t k = 0; k < 3; k++)
+		{
+			quadrics[result[t + k]].add(plane);
+		}
+	}
+
+	// Edges used by a single triangle are borders
+	std::unordered_map<uint64_t, uint32_t> edgeUse;
+	for (size_t t = 0; t < result.size(); t += 3)
+	{
+		for (size_t k = 0; k < 3; k++)
+		{
+			uint64_t a = result[t + k];
+			uint64_t b = result[t + (k + 1) % 3];
+			edgeUse[a < b ? (a << 32 | b) : (b << 32 | a)]++;
+		}
+	}
+	std::vector<bool> locked(vertexCount, false);
+	for (auto const & edge : edgeUse)
+	{
+		if (edge.second == 1)
+		{
+			locked[edge.first >> 32] = true;
+			locked[edge.first & 0xffffffff] = true;
+		}
+	}
+
+	std::vector<uint32_t> adjacencyOffsets(vertexCount + 1);
+	std::vector<uint32_t> adjacency;
+	std::vector<Collapse> collapses;
+	std::vector<bool> touched(vertexCount);
+	std::vector<uint32_t> remap(vertexCount);
+
+	// Each pass collapses the cheapest edges whose neighbourhoods don't overlap, then rebuilds
+	while (result.size() > targetIndexCount)
+	{
+		// Triangles around every vertex
+		std::fill(adjacencyOffsets.begin(), adjacencyOffsets.end(), 0);
+		for (auto v : result)
+		{
+			adjacencyOffsets[v + 1]++;
+		}
+		for (size_t v = 0; v < vertexCount; v++)
+		{
+			adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+		}
+		adjacency.resize(result.size());
+		std::vector<uint32_t> adjacencyFill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+		for (size_t i = 0; i < result.size(); i++)
+		{
+			adjacency[adjacencyFill[result[i]]++] = static_cast<uint32_t>(i / 3);
+		}
+
+		// Cheapest direction of every edge, only unlocked vertices move. Interior edges show up
+		// twice, the second copy is skipped as touched.
+		collapses.clear();
+		for (size_t t = 0; t < result.size(); t += 3)
+		{
+			for (size_t k = 0; k < 3; k++)
+			{
+				uint32_t a = result[t + k];
+				uint32_t b = result[t + (k + 1) % 3];
+
+				Collapse best = { 0, 0, -1.0 };
+				for (auto direction : { std::make_pair(a, b), std::make_pair(b, a) })
+				{
+					if (locked[direction.first])
+					{
+						continue;
+					}
+					Quadric merged = quadrics[direction.first];
+					merged.add(quadrics[direction.second]);
+					double cost = merged.evaluate(vertices[direction.second].pos);
+					if (best.cost < 0.0 || cost < best.cost)
+					{
+						best = { direction.first, direction.second, cost };
+					}
+				}
+				if (best.cost >= 0.0)
+				{
+					collapses.push_back(best);
+				}
+			}
+		}
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse & a, const Collapse & b)
+		{
+			return a.cost < b.cost;
+		});
+
+		std::fill(touched.begin(), touched.end(), false);
+		for (size_t v = 0; v < vertexCount; v++)
+		{
+			remap[v] = static_cast<uint32_t>(v);
+		}
+
+		size_t trianglesToRemove = (result.size() - targetIndexCount + 2) / 3;
+		size_t removed = 0;
+		for (auto const & collapse : collapses)
+		{
+			if (removed >= trianglesToRemove)
+			{
+				break;
+			}
+			if (touched[collapse.from] || touched[collapse.to])
+			{
+				continue;
+			}
+
+			// Triangles that keep existing must not flip
+			bool flips = false;
+			size_t shared = 0;
+			glm::vec3 target = vertices[collapse.to].pos;
+			for (uint32_t a = adjacencyOffsets[collapse.from]; a < adjacencyOffsets[collapse.from + 1]; a++)
+			{
+				const uint32_t * triangle = &result[adjacency[a] * 3];
+				if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to)
+				{
+					shared++;
+					continue;
+				}
+
+				glm::vec3 p[3];
+				glm::vec3 moved[3];
+				for (size_t k = 0; k < 3; k++)
+				{
+					p[k] = vertices[triangle[k]].pos;
+					moved[k] = triangle[k] == collapse.from ? target : p[k];
+				}
+				glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+				glm::vec3 after = glm::cross(moved[1] - moved[0], moved[2] - moved[0]);
+				if (glm::dot(before, after) <= 0.0f)
+				{
+					flips = true;
+					break;
+				}
+			}
+			if (flips || shared == 0)
+			{
+				continue;
+			}
+
+			// Everything around from changes, none of it may collapse again this pass
+			for (uint32_t a = adjacencyOffsets[collapse.from]; a < adjacencyOffsets[collapse.from + 1]; a++)
+			{
+				for (size_t k = 0; k < 3; k++)
+				{
+					touched[result[adjacency[a] * 3 + k]] = true;
+				}
+			}
+			remap[collapse.from] = collapse.to;
+			quadrics[collapse.to].add(quadrics[collapse.from]);
+			maxCost = std::max(maxCost, collapse.cost);
+			removed += shared;
+		}
+
+		if (removed == 0)
+		{
+			break;
+		}
+
+		// Drop the triangles that became degenerate
+		size_t write = 0;
+		for (size_t t = 0; t < result.size(); t += 3)
+		{
+			uint32_t a = remap[result[t]];
+			uint32_t b = remap[result[t + 1]];
+			uint32_t c = remap[result[t + 2]];
+			if (a != b && b != c && a != c)
+			{
+				result[write++] = a;
+				result[write++] = b;
+				result[write++] = c;
+			}
+		}
+		result.resize(write);
+	}
+
+	if (error)
+	{
+		*error = static_cast<float>(std::sqrt(maxCost));
+	}
+
+	return result;
+}
+
+std::vector<Meshlet> BuildMeshlets(const uint32_t * indices, size_t indexCount, const Vertex * vertices,
+	size_t vertexCount)
+{
+	std::vector<Meshlet> meshlets;
+	size_t triangleCount = indexCount / 3;
+
+	// Meshlet a vertex was last counted for, plus one
+	std::vector<uint32_t> usedBy(vertexCount, 0);
+	size_t first = 0;
+	while (first < triangleCount)
+	{
+		auto id = static_cast<uint32_t>(meshlets.size() + 1);
+		uint32_t vertexTotal = 0;
+		size_t end = first;
+		for (; end < triangleCount && end - first < MAX_MESHLET_TRIANGLES; end++)
+		{
+			uint32_t added = 0;
+			for (size_t k = 0; k < 3; k++)
+			{
+				added += usedBy[indices[end * 3 + k]] != id ? 1 : 0;
+			}
+			if (vertexTotal + added > MAX_MESHLET_VERTICES)
+			{
+				break;
+			}
+			for (size_t k = 0; k < 3; k++)
+			{
+				usedBy[indices[end * 3 + k]] = id;
+			}
+			vertexTotal += added;
+		}
+
+		Meshlet meshlet;
+		meshlet.firstIndex = static_cast<uint32_t>(first * 3);
+		meshlet.indexCount = static_cast<uint32_t>((end - first) * 3);
+
+		// Sphere around the bounding box, like the mesh bounds
+		glm::vec3 boundsMin = vertices[indices[first * 3]].pos;
+		glm::vec3 boundsMax = boundsMin;
+		for (size_t i = first * 3; i < end * 3; i++)
+		{
+			boundsMin = glm::min(boundsMin, vertices[indices[i]].pos);
+			boundsMax = glm::max(boundsMax, vertices[indices[i]].pos);
+		}
+		glm::vec3 centre = (boundsMin + boundsMax) * 0.5f;
+		float radius = 0.0f;
+		for (size_t i = first * 3; i < end * 3; i++)
+		{
+			radius = glm::max(radius, glm::length(vertices[indices[i]].pos - centre));
+		}
+		meshlet.bounds = glm::vec4(centre, radius);
+
+		// Average normal as axis, the widest normal decides the angle
+		std::vector<glm::vec3> normals;
+		glm::vec3 axis(0.0f);
+		for (size_t t = first; t < end; t++)
+		{
+			glm::vec3 p0 = vertices[indices[t * 3]].pos;
+			glm::vec3 p1 = vertices[indices[t * 3 + 1]].pos;
+			glm::vec3 p2 = vertices[indices[t * 3 + 2]].pos;
+			glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+			float length = glm::length(normal);
+			if (length > 0.0f)
+			{
+				normals.push_back(normal / length);
+				axis += normal / length;
+			}
+		}
+
+		meshlet.cone = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+		float axisLength = glm::length(axis);
+		if (axisLength > 0.0f)
+		{
+			axis /= axisLength;
+			float minDot = 1.0f;
+			for (auto const & normal : normals)
+			{
+				minDot = glm::min(minDot, glm::dot(normal, axis));
+			}
+
+			// Nearly a hemisphere of normals or more, some triangle always faces the camera
+			if (minDot > 0.1f)
+			{
+				meshlet.cone = glm::vec4(axis, std::sqrt(1.0f - minDot * minDot));
+			}
+		}
+
+		meshlets.push_back(meshlet);
+		first = end;
+	}
+
+	return meshlets;
+}
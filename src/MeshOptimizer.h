@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Utilities.h"
+
+// Passes run on imported meshes, the flags are stored with the mesh cache
+enum MeshOptimization : uint32_t
+{
+	MESH_OPTIMIZE_NONE = 0,
+	MESH_OPTIMIZE_VERTEX_CACHE = 1,		// triangle order for the post-transform cache, vertex order for fetches
+	MESH_OPTIMIZE_OVERDRAW = 2,			// cluster order, only together with MESH_OPTIMIZE_VERTEX_CACHE
+	MESH_OPTIMIZE_LODS = 4,				// simplified index ranges, up to MAX_MESH_LODS in total
+	MESH_OPTIMIZE_MESHLETS = 8,			// clusters of the full detail level for culling
+};
+
+// Full detail level included
+const uint32_t MAX_MESH_LODS = 4;
+// Meshlet limits, what mesh shading hardware handles best
+const uint32_t MAX_MESHLET_VERTICES = 64;
+const uint32_t MAX_MESHLET_TRIANGLES = 124;
+
+// Contiguous triangles of a mesh that are culled on their own
+struct Meshlet
+{
+	uint32_t firstIndex = 0;		// relative to the mesh's first index
+	uint32_t indexCount = 0;
+	glm::vec4 bounds;				// model space bounding sphere, centre in xyz and radius in w
+	glm::vec4 cone;					// normal cone axis in xyz, w is the sine of its half angle, 1 if it never faces away
+};
+
+// Simulated FIFO size, small enough to hold on every GPU we care about
+const uint32_t VERTEX_CACHE_SIZE = 16;
+
+// Result of simulating a FIFO post-transform cache, counts add up across meshes
+struct VertexCacheStats
+{
+	uint64_t transformed = 0;		// cache misses
+	uint64_t triangles = 0;
+	uint64_t vertices = 0;			// vertices referenced by the triangles
+
+	void add(const VertexCacheStats & other);
+
+	// Average cache miss ratio, transformed vertices per triangle (0.5 at best, 3 at worst)
+	float getAcmr() const;
+	// Average transform to vertex ratio (1 at best)
+	float getAtvr() const;
+};
+
+VertexCacheStats AnalyzeVertexCache(const uint32_t * indices, size_t indexCount, size_t vertexCount,
+	uint32_t cacheSize = VERTEX_CACHE_SIZE);
+
+// Reorders triangles for the post-transform cache (Tipsify, Sander et al. 2007). Returns the
+// first triangle of every cluster, clusters start wherever the fan hit a dead end.
+std::vector<uint32_t> OptimizeVertexCache(uint32_t * indices, size_t indexCount, size_t vertexCount,
+	uint32_t cacheSize = VERTEX_CACHE_SIZE);
+
+// Sorts the clusters so the ones facing away from the mesh centre are drawn first, they are
+// the most likely to occlude the rest. Triangle order inside a cluster stays the same.
+void OptimizeOverdraw(uint32_t * indices, size_t indexCount, const Vertex * vertices,
+	const std::vector<uint32_t> & clusters);
+
+// Collapses edges in order of quadric error (Garland & Heckbert 1997) until at most
+// targetIndexCount indices are left or nothing can collapse any more. Every vertex moves onto a
+// neighbour, so the result indexes the same vertices. Border vertices stay where they are,
+// texture seams are borders after the import split their vertices. error receives the
+// largest distance error of a collapse, in model units.
+std::vector<uint32_t> SimplifyMesh(const uint32_t * indices, size_t indexCount, const Vertex * vertices,
+	size_t vertexCount, size_t targetIndexCount, float * error);
+
+// Splits the triangles in their current order into runs of at most MAX_MESHLET_VERTICES distinct
+// vertices and MAX_MESHLET_TRIANGLES triangles, so a cache optimized order gives compact meshlets
+// and every meshlet stays a contiguous index range
+std::vector<Meshlet> BuildMeshlets(const uint32_t * indices, size_t indexCount, const Vertex * vertices,
+	size_t vertexCount);
+
+// Renumbers the vertices in order of first use and drops unreferenced ones, returns the
+// new vertex count
+size_t OptimizeVertexFetch(Vertex * vertices, size_t vertexCount, uint32_t * indices, size_t indexCount);
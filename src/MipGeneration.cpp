@@ -0,0 +1,122 @@
+#include "MipGeneration.h"
+
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MIP_GENERATION_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+#if defined(MIP_GENERATION_SSE2)
+	// Two destination texels per iteration from 4 texels of both source rows, the sums are
+	// taken in 16 bits. Returns the first destination column left to do.
+	uint32_t downsampleRowSimd(const uint8_t * row0, const uint8_t * row1, uint32_t dstWidth,
+		uint32_t srcWidth, uint8_t * dst)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i rounding = _mm_set1_epi16(2);
+
+		// Only columns with both source texels in range
+		uint32_t pairs = std::min(dstWidth, srcWidth / 2);
+		uint32_t x = 0;
+		for (; x + 2 <= pairs; x += 2)
+		{
+			__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row0 + x * 8));
+			__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row1 + x * 8));
+
+			// Vertical sums of texels 0 1 and 2 3
+			__m128i low = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+			__m128i high = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+
+			// Horizontal sums end up in the lower half of each
+			low = _mm_add_epi16(low, _mm_srli_si128(low, 8));
+			high = _mm_add_epi16(high, _mm_srli_si128(high, 8));
+
+			__m128i sum = _mm_unpacklo_epi64(low, high);
+			sum = _mm_srli_epi16(_mm_add_epi16(sum, rounding), 2);
+			_mm_storel_epi64(reinterpret_cast<__m128i *>(dst + x * 4), _mm_packus_epi16(sum, sum));
+		}
+		return x;
+	}
+#endif
+
+	void downsampleRowScalar(const uint8_t * row0, const uint8_t * row1, uint32_t firstX,
+		uint32_t dstWidth, uint32_t srcWidth, uint8_t * dst)
+	{
+		for (uint32_t x = firstX; x < dstWidth; x++)
+		{
+			uint32_t x0 = x * 2;
+			uint32_t x1 = std::min(x0 + 1, srcWidth - 1);
+			for (uint32_t c = 0; c < 4; c++)
+			{
+				uint32_t sum = row0[x0 * 4 + c] + row0[x1 * 4 + c] + row1[x0 * 4 + c] + row1[x1 * 4 + c];
+				dst[x * 4 + c] = static_cast<uint8_t>((sum + 2) >> 2);
+			}
+		}
+	}
+}
+
+
+
+uint32_t GetMipLevelCount(uint32_t width, uint32_t height)
+{
+	uint32_t levels = 1;
+	for (uint32_t size = std::max(width, height); size > 1; size /= 2)
+	{
+		levels++;
+	}
+	return levels;
+}
+
+uint32_t GetMipWidth(uint32_t width, uint32_t level)
+{
+	return std::max(width >> level, 1u);
+}
+
+uint32_t GetMipHeight(uint32_t height, uint32_t level)
+{
+	return std::max(height >> level, 1u);
+}
+
+size_t GetMipChainSize(uint32_t width, uint32_t height, uint32_t levelCount)
+{
+	size_t size = 0;
+	for (uint32_t level = 0; level < levelCount; level++)
+	{
+		size += size_t(GetMipWidth(width, level)) * GetMipHeight(height, level) * 4;
+	}
+	return size;
+}
+
+void DownsampleRgba8(const uint8_t * src, uint32_t srcWidth, uint32_t srcHeight, uint8_t * dst)
+{
+#if defined(MIP_GENERATION_SSE2)
+	uint32_t dstWidth = GetMipWidth(srcWidth, 1);
+	uint32_t dstHeight = GetMipHeight(srcHeight, 1);
+	for (uint32_t y = 0; y < dstHeight; y++)
+	{
+		const uint8_t * row0 = src + size_t(y * 2) * srcWidth * 4;
+		const uint8_t * row1 = src + size_t(std::min(y * 2 + 1, srcHeight - 1)) * srcWidth * 4;
+		uint8_t * out = dst + size_t(y) * dstWidth * 4;
+
+		uint32_t done = downsampleRowSimd(row0, row1, dstWidth, srcWidth, out);
+		downsampleRowScalar(row0, row1, done, dstWidth, srcWidth, out);
+	}
+#else
+	DownsampleRgba8Scalar(src, srcWidth, srcHeight, dst);
+#endif
+}
+
+void DownsampleRgba8Scalar(const uint8_t * src, uint32_t srcWidth, uint32_t srcHeight, uint8_t * dst)
+{
+	uint32_t dstWidth = GetMipWidth(srcWidth, 1);
+	uint32_t dstHeight = GetMipHeight(srcHeight, 1);
+	for (uint32_t y = 0; y < dstHeight; y++)
+	{
+		const uint8_t * row0 = src + size_t(y * 2) * srcWidth * 4;
+		const uint8_t * row1 = src + size_t(std::min(y * 2 + 1, srcHeight - 1)) * srcWidth * 4;
+		downsampleRowScalar(row0, row1, 0, dstWidth, srcWidth, dst + size_t(y) * dstWidth * 4);
+	}
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Levels of a full mip chain down to 1x1, level 0 included
+uint32_t GetMipLevelCount(uint32_t width, uint32_t height);
+
+// Size of level in an RGBA8 chain, at least 1 in both directions
+uint32_t GetMipWidth(uint32_t width, uint32_t level);
+uint32_t GetMipHeight(uint32_t height, uint32_t level);
+
+// Bytes of the first levelCount RGBA8 levels stored back to back
+size_t GetMipChainSize(uint32_t width, uint32_t height, uint32_t levelCount);
+
+// Writes the next level of an RGBA8 image to dst, every texel the rounded average of a 2x2
+// box. Odd sizes above 1 drop their last row or column, a size of 1 is averaged with itself.
+// Uses SSE2 when the build targets it, plain C++ otherwise.
+void DownsampleRgba8(const uint8_t * src, uint32_t srcWidth, uint32_t srcHeight, uint8_t * dst);
+
+// Same without SIMD
+void DownsampleRgba8Scalar(const uint8_t * src, uint32_t srcWidth, uint32_t srcHeight, uint8_t * dst);
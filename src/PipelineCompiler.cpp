@@ -0,0 +1,67 @@
+#include "PipelineCompiler.h"
+
+#include <vkx/tapi.hpp>
+#include <vkx/util.hpp>
+
+
+
+PipelineCompiler::PipelineCompiler(vkx::Device device, VkPipelineCache pipelineCache, size_t threadCount)
+	: device(device), pipelineCache(pipelineCache), threads(threadCount)
+{
+}
+
+template <typename Build>
+std::shared_future<vkx::Pipeline> PipelineCompiler::submit(Build build)
+{
+	// ThreadPool jobs have to be copyable, so the promise is shared
+	auto promise = std::make_shared<std::promise<vkx::Pipeline>>();
+	auto future = promise->get_future().share();
+
+	threads.submit([promise, build](size_t)
+	{
+		try
+		{
+			promise->set_value(build());
+		}
+		catch (...)
+		{
+			promise->set_exception(std::current_exception());
+		}
+	});
+
+	return future;
+}
+
+std::shared_future<vkx::Pipeline> PipelineCompiler::compile(GraphicsPipelineDescription description)
+{
+	auto shared = std::make_shared<GraphicsPipelineDescription>(std::move(description));
+	return submit([this, shared]()
+	{
+		auto & desc = *shared;
+		auto vertexInput = vkx::MakePipelineVertexInputStateCreateInfo(desc.vertexBindings, desc.vertexAttributes);
+		auto viewportState = vkx::MakePipelineViewportStateCreateInfo(desc.viewports, desc.scissors);
+		auto colourBlending = vkx::helper::MakePipelineColorBlendStateCreateInfo(desc.colourBlendAttachments);
+
+		auto createInfo = vkx::MakeGraphicsPipelineCreateInfo(
+			desc.shaderStages, &vertexInput, &desc.inputAssembly, nullptr,
+			&viewportState, &desc.rasterizer, &desc.multisampling,
+			&desc.depthStencil, &colourBlending, nullptr,
+			desc.layout, desc.renderPass, desc.subpass, VK_NULL_HANDLE, -1);
+
+		return vkx::CreatePipeline(device, pipelineCache, &createInfo, nullptr);
+	});
+}
+
+std::shared_future<vkx::Pipeline> PipelineCompiler::compile(ComputePipelineDescription description)
+{
+	return submit([this, description]()
+	{
+		VkComputePipelineCreateInfo createInfo = {};
+		createInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		createInfo.stage = vkx::MakePipelineShaderStageCreateInfo(VK_SHADER_STAGE_COMPUTE_BIT, description.shaderModule);
+		createInfo.layout = description.layout;
+		createInfo.basePipelineIndex = -1;
+
+		return vkx::CreatePipeline(device, pipelineCache, &createInfo, nullptr);
+	});
+}
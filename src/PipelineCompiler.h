@@ -0,0 +1,61 @@
+#pragma once
+
+#include <future>
+#include <memory>
+#include <vector>
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vkx/raii.hpp>
+
+#include "ThreadPool.h"
+
+// Everything a graphics pipeline is built from, owned so the pipeline can
+// be compiled after the code describing it returned. The create info
+// structs pointing into the vectors are only made at compile time.
+struct GraphicsPipelineDescription
+{
+	std::vector<vkx::ShaderModule> shaderModules; // kept alive until compiled
+	std::vector<VkPipelineShaderStageCreateInfo> shaderStages;
+	std::vector<VkVertexInputBindingDescription> vertexBindings;
+	std::vector<VkVertexInputAttributeDescription> vertexAttributes;
+	VkPipelineInputAssemblyStateCreateInfo inputAssembly;
+	std::vector<VkViewport> viewports;
+	std::vector<VkRect2D> scissors;
+	VkPipelineRasterizationStateCreateInfo rasterizer;
+	VkPipelineMultisampleStateCreateInfo multisampling;
+	VkPipelineDepthStencilStateCreateInfo depthStencil;
+	std::vector<VkPipelineColorBlendAttachmentState> colourBlendAttachments;
+	VkPipelineLayout layout;
+	VkRenderPass renderPass;
+	uint32_t subpass;
+};
+
+struct ComputePipelineDescription
+{
+	vkx::ShaderModule shaderModule;
+	VkPipelineLayout layout;
+};
+
+// Compiles pipelines on its own worker threads, all against one pipeline
+// cache. A failed compile rethrows its error from the future's get().
+// Destroying the compiler finishes every queued compile first.
+class PipelineCompiler
+{
+public:
+	PipelineCompiler(vkx::Device device, VkPipelineCache pipelineCache, size_t threadCount);
+	PipelineCompiler(const PipelineCompiler &) = delete;
+	PipelineCompiler & operator=(const PipelineCompiler &) = delete;
+
+	std::shared_future<vkx::Pipeline> compile(GraphicsPipelineDescription description);
+	std::shared_future<vkx::Pipeline> compile(ComputePipelineDescription description);
+
+private:
+	vkx::Device device;
+	VkPipelineCache pipelineCache;
+	ThreadPool threads;
+
+	template <typename Build>
+	std::shared_future<vkx::Pipeline> submit(Build build);
+};
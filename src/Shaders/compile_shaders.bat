@@ -2,4 +2,12 @@ C:/VulkanSDK/1.1.114.0/Bin32/glslangValidator.exe -V shader.vert
 C:/VulkanSDK/1.1.114.0/Bin32/glslangValidator.exe -V shader.frag
 C:/VulkanSDK/1.1.114.0/Bin32/glslangValidator.exe -o second_vert.spv -V second.vert
 C:/VulkanSDK/1.1.114.0/Bin32/glslangValidator.exe -o second_frag.spv -V second.frag
+C:/VulkanSDK/1.1.114.0/Bin32/glslangValidator.exe -o indirect_vert.spv -V indirect.vert
+C:/VulkanSDK/1.1.114.0/Bin32/glslangValidator.exe -o cull_comp.spv -V cull.comp
+C:/VulkanSDK/1.1.114.0/Bin32/glslangValidator.exe -o depth_reduce_comp.spv -V depth_reduce.comp
+C:/VulkanSDK/1.1.114.0/Bin32/glslangValidator.exe -o instanced_vert.spv -V instanced.vert
+C:/VulkanSDK/1.1.114.0/Bin32/glslangValidator.exe -DCOMPACT_VERTICES -o vert_compact.spv -V shader.vert
+C:/VulkanSDK/1.1.114.0/Bin32/glslangValidator.exe -DCOMPACT_VERTICES -o instanced_vert_compact.spv -V instanced.vert
+C:/VulkanSDK/1.1.114.0/Bin32/glslangValidator.exe -DCOMPACT_VERTICES -o indirect_vert_compact.spv -V indirect.vert
+C:/VulkanSDK/1.1.114.0/Bin32/glslangValidator.exe -DBINDLESS_TEXTURES -o frag_bindless.spv -V shader.frag
 pause
\ No newline at end of file
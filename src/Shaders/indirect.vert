@@ -0,0 +1,56 @@
+#version 450 		// Use GLSL 4.5
+
+#ifdef COMPACT_VERTICES
+// snorm16 position relative to the mesh's bounding sphere, no colour
+layout(location = 0) in vec4 pos;
+layout(location = 2) in vec2 tex;
+#else
+layout(location = 0) in vec3 pos;
+layout(location = 1) in vec3 col;
+layout(location = 2) in vec2 tex;
+#endif
+
+layout(set = 0, binding = 0) uniform UboViewProjection {
+	mat4 projection;
+	mat4 view;
+} uboViewProjection;
+
+struct DrawData {
+	vec4 bounds;
+	vec4 cullBounds;
+	vec4 cone;
+	uint modelIndex;
+	uint texId;
+	uint batchIndex;
+	uint batchFirst;
+};
+
+// One entry per indirect command, selected through firstInstance
+layout(set = 2, binding = 0) readonly buffer Draws {
+	DrawData draws[];
+};
+
+// One transform per model instance
+layout(set = 2, binding = 1) readonly buffer Transforms {
+	mat4 models[];
+};
+
+layout(location = 0) out vec3 fragCol;
+layout(location = 1) out vec2 fragTex;
+layout(location = 2) flat out uint fragTexId;
+
+void main() {
+	DrawData draw = draws[gl_InstanceIndex];
+#ifdef COMPACT_VERTICES
+	vec3 position = draw.bounds.xyz + pos.xyz * draw.bounds.w;
+	vec3 colour = vec3(1.0);
+#else
+	vec3 position = pos;
+	vec3 colour = col;
+#endif
+	gl_Position = uboViewProjection.projection * uboViewProjection.view * models[draw.modelIndex] * vec4(position, 1.0);
+	
+	fragCol = colour;
+	fragTex = tex;
+	fragTexId = draw.texId;
+}
@@ -0,0 +1,46 @@
+#version 450 		// Use GLSL 4.5
+
+#ifdef COMPACT_VERTICES
+// snorm16 position relative to the mesh's bounding sphere, no colour
+layout(location = 0) in vec4 pos;
+layout(location = 2) in vec2 tex;
+#else
+layout(location = 0) in vec3 pos;
+layout(location = 1) in vec3 col;
+layout(location = 2) in vec2 tex;
+#endif
+
+// Per instance transform, instance rate binding (takes locations 3 - 6)
+layout(location = 3) in mat4 model;
+
+layout(set = 0, binding = 0) uniform UboViewProjection {
+	mat4 projection;
+	mat4 view;
+} uboViewProjection;
+
+// Only the mesh bounds and texture are pushed, the transform is an attribute
+layout(push_constant) uniform PushModel {
+#ifdef COMPACT_VERTICES
+	layout(offset = 64) vec4 bounds;
+#endif
+	layout(offset = 80) uint texId;
+} pushModel;
+
+layout(location = 0) out vec3 fragCol;
+layout(location = 1) out vec2 fragTex;
+layout(location = 2) flat out uint fragTexId;
+
+void main() {
+#ifdef COMPACT_VERTICES
+	vec3 position = pushModel.bounds.xyz + pos.xyz * pushModel.bounds.w;
+	vec3 colour = vec3(1.0);
+#else
+	vec3 position = pos;
+	vec3 colour = col;
+#endif
+	gl_Position = uboViewProjection.projection * uboViewProjection.view * model * vec4(position, 1.0);
+	
+	fragCol = colour;
+	fragTex = tex;
+	fragTexId = pushModel.texId;
+}
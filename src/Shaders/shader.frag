@@ -1,12 +1,25 @@
 #version 450
+#ifdef BINDLESS_TEXTURES
+#extension GL_EXT_nonuniform_qualifier : require
+#endif
 
 layout(location = 0) in vec3 fragCol;
 layout(location = 1) in vec2 fragTex;
+layout(location = 2) flat in uint fragTexId;
 
+#ifdef BINDLESS_TEXTURES
+// Every texture, bound once per frame
+layout(set = 1, binding = 0) uniform sampler2D textures[];
+#else
 layout(set = 1, binding = 0) uniform sampler2D textureSampler;
+#endif
 
 layout(location = 0) out vec4 outColour; 	// Final output colour (must also have location
 
 void main() {
+#ifdef BINDLESS_TEXTURES
+	outColour = texture(textures[nonuniformEXT(fragTexId)], fragTex);
+#else
 	outColour = texture(textureSampler, fragTex);
+#endif
 }
\ No newline at end of file
@@ -1,8 +1,14 @@
 #version 450 		// Use GLSL 4.5
 
+#ifdef COMPACT_VERTICES
+// snorm16 position relative to the mesh's bounding sphere, no colour
+layout(location = 0) in vec4 pos;
+layout(location = 2) in vec2 tex;
+#else
 layout(location = 0) in vec3 pos;
 layout(location = 1) in vec3 col;
 layout(location = 2) in vec2 tex;
+#endif
 
 layout(set = 0, binding = 0) uniform UboViewProjection {
 	mat4 projection;
@@ -16,14 +22,25 @@ layout(set = 0, binding = 1) uniform UboModel {
 
 layout(push_constant) uniform PushModel {
 	mat4 model;
+	vec4 bounds;	// centre and radius positions are relative to
+	uint texId;		// element of the texture array, BINDLESS_TEXTURES only
 } pushModel;
 
 layout(location = 0) out vec3 fragCol;
 layout(location = 1) out vec2 fragTex;
+layout(location = 2) flat out uint fragTexId;
 
 void main() {
-	gl_Position = uboViewProjection.projection * uboViewProjection.view * pushModel.model * vec4(pos, 1.0);
+#ifdef COMPACT_VERTICES
+	vec3 position = pushModel.bounds.xyz + pos.xyz * pushModel.bounds.w;
+	vec3 colour = vec3(1.0);
+#else
+	vec3 position = pos;
+	vec3 colour = col;
+#endif
+	gl_Position = uboViewProjection.projection * uboViewProjection.view * pushModel.model * vec4(position, 1.0);
 	
-	fragCol = col;
+	fragCol = colour;
 	fragTex = tex;
+	fragTexId = pushModel.texId;
 }
\ No newline at end of file
@@ -0,0 +1,407 @@
+#include "TextureCompression.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+	// Texels of one block as floats, row by row
+	struct Block
+	{
+		float texels[16][4];
+	};
+
+	void fetchBlock(const uint8_t * rgba, uint32_t width, uint32_t height, uint32_t blockX, uint32_t blockY,
+		Block * block)
+	{
+		for (uint32_t y = 0; y < 4; y++)
+		{
+			uint32_t sourceY = std::min(blockY * 4 + y, height - 1);
+			for (uint32_t x = 0; x < 4; x++)
+			{
+				uint32_t sourceX = std::min(blockX * 4 + x, width - 1);
+				const uint8_t * texel = rgba + (size_t(sourceY) * width + sourceX) * 4;
+				for (uint32_t c = 0; c < 4; c++)
+				{
+					block->texels[y * 4 + x][c] = texel[c];
+				}
+			}
+		}
+	}
+
+	// Line through the block that the texels spread along the most, in the first channels
+	// components. Power iteration on the covariance, starting at the bounding box diagonal.
+	void findPrincipalAxis(const Block & block, uint32_t channels, float mean[4], float axis[4])
+	{
+		float low[4], high[4];
+		for (uint32_t c = 0; c < channels; c++)
+		{
+			mean[c] = 0.0f;
+			low[c] = 255.0f;
+			high[c] = 0.0f;
+			for (auto & texel : block.texels)
+			{
+				mean[c] += texel[c] / 16.0f;
+				low[c] = std::min(low[c], texel[c]);
+				high[c] = std::max(high[c], texel[c]);
+			}
+			axis[c] = high[c] - low[c];
+		}
+
+		float covariance[4][4] = {};
+		for (auto & texel : block.texels)
+		{
+			for (uint32_t i = 0; i < channels; i++)
+			{
+				for (uint32_t j = 0; j < channels; j++)
+				{
+					covariance[i][j] += (texel[i] - mean[i]) * (texel[j] - mean[j]);
+				}
+			}
+		}
+
+		for (int iteration = 0; iteration < 8; iteration++)
+		{
+			float next[4] = {};
+			float length = 0.0f;
+			for (uint32_t i = 0; i < channels; i++)
+			{
+				for (uint32_t j = 0; j < channels; j++)
+				{
+					next[i] += covariance[i][j] * axis[j];
+				}
+				length = std::max(length, std::abs(next[i]));
+			}
+			if (length == 0.0f)
+			{
+				break;
+			}
+			for (uint32_t i = 0; i < channels; i++)
+			{
+				axis[i] = next[i] / length;
+			}
+		}
+
+		float length = 0.0f;
+		for (uint32_t c = 0; c < channels; c++)
+		{
+			length += axis[c] * axis[c];
+		}
+		length = std::sqrt(length);
+		for (uint32_t c = 0; c < channels; c++)
+		{
+			axis[c] = length > 0.0f ? axis[c] / length : 0.0f;
+		}
+	}
+
+	// Ends of the texels' projection onto the principal axis
+	void findEndpoints(const Block & block, uint32_t channels, float start[4], float end[4])
+	{
+		float mean[4], axis[4];
+		findPrincipalAxis(block, channels, mean, axis);
+
+		float lowest = 0.0f, highest = 0.0f;
+		for (auto & texel : block.texels)
+		{
+			float t = 0.0f;
+			for (uint32_t c = 0; c < channels; c++)
+			{
+				t += (texel[c] - mean[c]) * axis[c];
+			}
+			lowest = std::min(lowest, t);
+			highest = std::max(highest, t);
+		}
+		for (uint32_t c = 0; c < channels; c++)
+		{
+			start[c] = std::min(std::max(mean[c] + axis[c] * lowest, 0.0f), 255.0f);
+			end[c] = std::min(std::max(mean[c] + axis[c] * highest, 0.0f), 255.0f);
+		}
+	}
+
+	float squaredError(const float * a, const float * b, uint32_t channels)
+	{
+		float error = 0.0f;
+		for (uint32_t c = 0; c < channels; c++)
+		{
+			error += (a[c] - b[c]) * (a[c] - b[c]);
+		}
+		return error;
+	}
+
+	// Picks the closest palette entry for every texel, returns the total error
+	float chooseIndices(const Block & block, const float palette[][4], uint32_t paletteSize, uint32_t channels,
+		uint8_t indices[16])
+	{
+		float total = 0.0f;
+		for (uint32_t i = 0; i < 16; i++)
+		{
+			float best = squaredError(block.texels[i], palette[0], channels);
+			indices[i] = 0;
+			for (uint32_t p = 1; p < paletteSize; p++)
+			{
+				float error = squaredError(block.texels[i], palette[p], channels);
+				if (error < best)
+				{
+					best = error;
+					indices[i] = static_cast<uint8_t>(p);
+				}
+			}
+			total += best;
+		}
+		return total;
+	}
+
+	uint16_t packRgb565(const float colour[4])
+	{
+		uint32_t r = static_cast<uint32_t>(std::lround(colour[0] * 31.0f / 255.0f));
+		uint32_t g = static_cast<uint32_t>(std::lround(colour[1] * 63.0f / 255.0f));
+		uint32_t b = static_cast<uint32_t>(std::lround(colour[2] * 31.0f / 255.0f));
+		return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+	}
+
+	void unpackRgb565(uint16_t packed, float colour[4])
+	{
+		uint32_t r = (packed >> 11) & 31;
+		uint32_t g = (packed >> 5) & 63;
+		uint32_t b = packed & 31;
+		colour[0] = static_cast<float>((r << 3) | (r >> 2));
+		colour[1] = static_cast<float>((g << 2) | (g >> 4));
+		colour[2] = static_cast<float>((b << 3) | (b >> 2));
+		colour[3] = 255.0f;
+	}
+
+	void encodeBc1Block(const Block & block, uint8_t * out)
+	{
+		float start[4], end[4];
+		findEndpoints(block, 3, start, end);
+
+		// The larger endpoint has to come first for the four colour mode
+		uint16_t colour0 = packRgb565(end);
+		uint16_t colour1 = packRgb565(start);
+		if (colour0 < colour1)
+		{
+			std::swap(colour0, colour1);
+		}
+
+		float palette[4][4];
+		unpackRgb565(colour0, palette[0]);
+		unpackRgb565(colour1, palette[1]);
+		for (uint32_t c = 0; c < 3; c++)
+		{
+			palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+			palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+		}
+
+		uint8_t indices[16] = {};
+		if (colour0 != colour1)
+		{
+			chooseIndices(block, palette, 4, 3, indices);
+		}
+
+		uint32_t bits = 0;
+		for (uint32_t i = 0; i < 16; i++)
+		{
+			bits |= uint32_t(indices[i]) << (i * 2);
+		}
+		memcpy(out, &colour0, 2);
+		memcpy(out + 2, &colour1, 2);
+		memcpy(out + 4, &bits, 4);
+	}
+
+	const uint32_t BC7_WEIGHTS[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+	// Mode 6 endpoint, 7 bits per channel plus a shared lowest bit
+	struct Bc7Endpoint
+	{
+		uint8_t colour[4];
+		uint8_t pbit;
+
+		void expand(float out[4]) const
+		{
+			for (uint32_t c = 0; c < 4; c++)
+			{
+				out[c] = static_cast<float>((colour[c] << 1) | pbit);
+			}
+		}
+	};
+
+	Bc7Endpoint quantizeBc7Endpoint(const float value[4])
+	{
+		Bc7Endpoint best = {};
+		float bestError = INFINITY;
+		for (uint8_t pbit = 0; pbit < 2; pbit++)
+		{
+			Bc7Endpoint endpoint = {};
+			endpoint.pbit = pbit;
+			for (uint32_t c = 0; c < 4; c++)
+			{
+				long quantized = std::lround((value[c] - pbit) / 2.0f);
+				endpoint.colour[c] = static_cast<uint8_t>(std::min(std::max(quantized, 0L), 127L));
+			}
+			float expanded[4];
+			endpoint.expand(expanded);
+			float error = squaredError(value, expanded, 4);
+			if (error < bestError)
+			{
+				bestError = error;
+				best = endpoint;
+			}
+		}
+		return best;
+	}
+
+	float chooseBc7Indices(const Block & block, const Bc7Endpoint & e0, const Bc7Endpoint & e1, uint8_t indices[16])
+	{
+		float low[4], high[4];
+		e0.expand(low);
+		e1.expand(high);
+
+		float palette[16][4];
+		for (uint32_t i = 0; i < 16; i++)
+		{
+			for (uint32_t c = 0; c < 4; c++)
+			{
+				uint32_t value = ((64 - BC7_WEIGHTS[i]) * uint32_t(low[c]) + BC7_WEIGHTS[i] * uint32_t(high[c]) + 32) >> 6;
+				palette[i][c] = static_cast<float>(value);
+			}
+		}
+		return chooseIndices(block, palette, 16, 4, indices);
+	}
+
+	// Endpoints that minimise the squared error for fixed indices, false if all indices match
+	bool refineEndpoints(const Block & block, const uint8_t indices[16], float start[4], float end[4])
+	{
+		float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+		float ax[4] = {}, bx[4] = {};
+		for (uint32_t i = 0; i < 16; i++)
+		{
+			float b = BC7_WEIGHTS[indices[i]] / 64.0f;
+			float a = 1.0f - b;
+			aa += a * a;
+			ab += a * b;
+			bb += b * b;
+			for (uint32_t c = 0; c < 4; c++)
+			{
+				ax[c] += a * block.texels[i][c];
+				bx[c] += b * block.texels[i][c];
+			}
+		}
+
+		float determinant = aa * bb - ab * ab;
+		if (std::abs(determinant) < 1e-6f)
+		{
+			return false;
+		}
+		for (uint32_t c = 0; c < 4; c++)
+		{
+			start[c] = std::min(std::max((ax[c] * bb - bx[c] * ab) / determinant, 0.0f), 255.0f);
+			end[c] = std::min(std::max((bx[c] * aa - ax[c] * ab) / determinant, 0.0f), 255.0f);
+		}
+		return true;
+	}
+
+	// Appends bits to a 128 bit block, lowest bit first
+	struct BitWriter
+	{
+		uint8_t * out;
+		uint32_t position = 0;
+
+		void write(uint32_t value, uint32_t count)
+		{
+			for (uint32_t i = 0; i < count; i++, position++)
+			{
+				if (value & (1u << i))
+				{
+					out[position / 8] |= static_cast<uint8_t>(1u << (position % 8));
+				}
+			}
+		}
+	};
+
+	void encodeBc7Block(const Block & block, uint8_t * out)
+	{
+		float start[4], end[4];
+		findEndpoints(block, 4, start, end);
+
+		Bc7Endpoint e0 = quantizeBc7Endpoint(start);
+		Bc7Endpoint e1 = quantizeBc7Endpoint(end);
+		uint8_t indices[16];
+		float error = chooseBc7Indices(block, e0, e1, indices);
+
+		// One least squares pass, kept only if it helps after quantization
+		if (refineEndpoints(block, indices, start, end))
+		{
+			Bc7Endpoint refined0 = quantizeBc7Endpoint(start);
+			Bc7Endpoint refined1 = quantizeBc7Endpoint(end);
+			uint8_t refinedIndices[16];
+			float refinedError = chooseBc7Indices(block, refined0, refined1, refinedIndices);
+			if (refinedError < error)
+			{
+				e0 = refined0;
+				e1 = refined1;
+				memcpy(indices, refinedIndices, sizeof(indices));
+			}
+		}
+
+		// The first index is stored without its top bit, which has to be 0
+		if (indices[0] >= 8)
+		{
+			std::swap(e0, e1);
+			for (auto & index : indices)
+			{
+				index = static_cast<uint8_t>(15 - index);
+			}
+		}
+
+		memset(out, 0, BC7_BLOCK_SIZE);
+		BitWriter writer{ out };
+		writer.write(1u << 6, 7);
+		for (uint32_t c = 0; c < 4; c++)
+		{
+			writer.write(e0.colour[c], 7);
+			writer.write(e1.colour[c], 7);
+		}
+		writer.write(e0.pbit, 1);
+		writer.write(e1.pbit, 1);
+		writer.write(indices[0], 3);
+		for (uint32_t i = 1; i < 16; i++)
+		{
+			writer.write(indices[i], 4);
+		}
+	}
+
+	template <typename EncodeBlock>
+	void encodeBlocks(const uint8_t * rgba, uint32_t width, uint32_t height, uint32_t blockSize, uint8_t * blocks,
+		EncodeBlock encodeBlock)
+	{
+		uint32_t blocksX = (width + 3) / 4;
+		uint32_t blocksY = (height + 3) / 4;
+		for (uint32_t y = 0; y < blocksY; y++)
+		{
+			for (uint32_t x = 0; x < blocksX; x++)
+			{
+				Block block;
+				fetchBlock(rgba, width, height, x, y, &block);
+				encodeBlock(block, blocks + (size_t(y) * blocksX + x) * blockSize);
+			}
+		}
+	}
+}
+
+
+
+size_t GetCompressedSize(uint32_t width, uint32_t height, uint32_t blockSize)
+{
+	return size_t((width + 3) / 4) * ((height + 3) / 4) * blockSize;
+}
+
+void EncodeBc1(const uint8_t * rgba, uint32_t width, uint32_t height, uint8_t * blocks)
+{
+	encodeBlocks(rgba, width, height, BC1_BLOCK_SIZE, blocks, encodeBc1Block);
+}
+
+void EncodeBc7(const uint8_t * rgba, uint32_t width, uint32_t height, uint8_t * blocks)
+{
+	encodeBlocks(rgba, width, height, BC7_BLOCK_SIZE, blocks, encodeBc7Block);
+}
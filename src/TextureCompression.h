@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Bytes per 4x4 block
+const uint32_t BC1_BLOCK_SIZE = 8;
+const uint32_t BC7_BLOCK_SIZE = 16;
+
+// Bytes of a width x height image in 4x4 blocks of blockSize bytes
+size_t GetCompressedSize(uint32_t width, uint32_t height, uint32_t blockSize);
+
+// Encodes an RGBA8 image to opaque BC1, alpha is dropped. Blocks along the right and bottom
+// edge of sizes that aren't multiples of 4 repeat the last column and row.
+void EncodeBc1(const uint8_t * rgba, uint32_t width, uint32_t height, uint8_t * blocks);
+
+// Same for BC7 with alpha. Every block uses mode 6, one pair of RGBA endpoints along the
+// principal axis of the block refined by least squares, which is good enough for colour
+// textures and a lot faster than searching all partitions.
+void EncodeBc7(const uint8_t * rgba, uint32_t width, uint32_t height, uint8_t * blocks);
@@ -0,0 +1,93 @@
+#include "ThreadPool.h"
+
+
+
+ThreadPool::ThreadPool(size_t threadCount)
+{
+	for (size_t i = 0; i < threadCount; i++)
+	{
+		threads.emplace_back(&ThreadPool::work, this, i);
+	}
+}
+
+size_t ThreadPool::getThreadCount()
+{
+	return threads.size();
+}
+
+void ThreadPool::submit(std::function<void(size_t worker)> job)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		jobs.push_back(std::move(job));
+	}
+	jobAvailable.notify_one();
+}
+
+void ThreadPool::wait()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	jobsDone.wait(lock, [this] { return jobs.empty() && runningJobs == 0; });
+
+	// Report a failure once, the pool stays usable
+	if (error)
+	{
+		auto thrown = error;
+		error = nullptr;
+		std::rethrow_exception(thrown);
+	}
+}
+
+void ThreadPool::work(size_t worker)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true)
+	{
+		jobAvailable.wait(lock, [this] { return stopping || !jobs.empty(); });
+		if (jobs.empty())
+		{
+			// Only reached when stopping
+			return;
+		}
+
+		auto job = std::move(jobs.front());
+		jobs.pop_front();
+		runningJobs++;
+
+		lock.unlock();
+		std::exception_ptr jobError;
+		try
+		{
+			job(worker);
+		}
+		catch (...)
+		{
+			jobError = std::current_exception();
+		}
+		lock.lock();
+
+		if (jobError && !error)
+		{
+			error = jobError;
+		}
+		runningJobs--;
+		if (jobs.empty() && runningJobs == 0)
+		{
+			jobsDone.notify_all();
+		}
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	jobAvailable.notify_all();
+
+	for (auto & thread : threads)
+	{
+		thread.join();
+	}
+}
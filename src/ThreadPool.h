@@ -0,0 +1,43 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads running queued jobs. Jobs get the index of
+// the worker running them, so per thread resources can be picked without
+// locking.
+class ThreadPool
+{
+public:
+	ThreadPool(size_t threadCount);
+	ThreadPool(const ThreadPool &) = delete;
+	ThreadPool & operator=(const ThreadPool &) = delete;
+
+	size_t getThreadCount();
+
+	void submit(std::function<void(size_t worker)> job);
+
+	// Block until every submitted job has finished, rethrows the first
+	// exception thrown by one of them
+	void wait();
+
+	~ThreadPool();
+
+private:
+	std::vector<std::thread> threads;
+	std::deque<std::function<void(size_t)>> jobs;
+	size_t runningJobs = 0;
+	bool stopping = false;
+	std::exception_ptr error;
+
+	std::mutex mutex;
+	std::condition_variable jobAvailable;
+	std::condition_variable jobsDone;
+
+	void work(size_t worker);
+};
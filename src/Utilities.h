@@ -8,8 +8,34 @@
 
 #include <glm/glm.hpp>
 
+#include <vkx/memory.hpp>
+#include <vkx/upload.hpp>
+
 const int MAX_OBJECTS = 20;
+// Size of the bindless texture array, devices may allow fewer
+const uint32_t MAX_TEXTURES = 4096;
 const int MAX_FRAME_DRAWS = 2;
+// Capacity of the shared vertex/index buffers all meshes are packed into
+const uint32_t MAX_POOL_VERTICES = 1 << 20;
+const uint32_t MAX_POOL_INDICES = 1 << 22;
+// Limits of the indirect drawing path
+const uint32_t MAX_INDIRECT_DRAWS = 1 << 16;
+// A batch per texture set and index type, the count buffer has an entry for
+// each
+const uint32_t MAX_INDIRECT_BATCHES = MAX_OBJECTS * 2;
+// Instances of all models together
+const uint32_t MAX_INSTANCES = 1 << 16;
+// Smallest share of the mesh draws worth a secondary command buffer
+const size_t MIN_DRAWS_PER_RECORDING_JOB = 64;
+// Largest screen space error of a mesh level of detail
+const float LOD_ERROR_PIXELS = 1.0f;
+// A coarser level is only taken once its error is this much below
+// LOD_ERROR_PIXELS, so a mesh near a threshold doesn't switch every frame
+const float LOD_HYSTERESIS = 1.5f;
+// Enough for a 32768 x 32768 depth pyramid
+const uint32_t MAX_PYRAMID_LEVELS = 16;
+// Written on cleanup, seeds the pipeline cache of the next run
+const char *const PIPELINE_CACHE_FILE = "pipeline_cache.bin";
 
 const std::vector<const char *> deviceExtensions = {
     VK_KHR_SWAPCHAIN_EXTENSION_NAME};
@@ -21,10 +47,56 @@ struct Vertex {
   glm::vec2 tex; // Texture Coords (u, v)
 };
 
+// Layout of the vertices in the geometry pool, picked at init
+enum class VertexFormat {
+  Full,	   // Vertex
+  Compact, // CompactVertex, the colour is always white
+};
+
+// 12 byte vertex, dequantised by the *_compact vertex shaders
+struct CompactVertex {
+  uint16_t pos[4]; // snorm16 relative to the mesh's bounding sphere, w unused
+  uint32_t tex;	   // Texture Coords as two half floats, u in the low bits
+};
+
+inline uint32_t getVertexStride(VertexFormat format) {
+  return format == VertexFormat::Compact ? sizeof(CompactVertex)
+					 : sizeof(Vertex);
+}
+
+// Per draw data read by indirect.vert and cull.comp (std430 layout)
+struct DrawData {
+  glm::vec4 bounds;	// Model space bounding sphere of the mesh
+  glm::vec4 cullBounds; // Sphere cull.comp tests, the mesh's or its meshlet's
+  glm::vec4 cone;	// Meshlet normal cone (axis, sine), w is 1 if none
+  uint32_t modelIndex; // Index into the transform buffer
+  uint32_t texId;      // Sampler descriptor the draw was batched by
+  uint32_t batchIndex; // Draw count the culling pass compacts into
+  uint32_t batchFirst; // First command of the batch
+};
+
+// Culling flags, see cull.comp
+const uint32_t CULL_COMPACT = 1;   // Survivors are appended, draw counts read
+				   // from the count buffer
+const uint32_t CULL_OCCLUSION = 2; // Test against the depth pyramid
+const uint32_t CULL_BACKFACE = 4;  // Test meshlet normal cones
+
+// Per frame input of cull.comp (std140 layout)
+struct CullData {
+  glm::mat4 pyramidViewProjection; // Camera the depth pyramid was rendered with
+  glm::vec4 frustum[6];		   // World space planes, normals point inside
+  glm::vec2 pyramidSize;
+  uint32_t drawCount;
+  uint32_t flags;
+  glm::vec4 cameraPosition; // World space, w unused
+};
+
 // Indices (locations) of Queue Families (if they exist at all)
 struct QueueFamilyIndices {
   int graphicsFamily = -1;     // Location of Graphics Queue Family
   int presentationFamily = -1; // Location of Presentation Queue Family
+  int transferFamily = -1;     // Location of Transfer Queue Family, may be
+			       // the same as graphicsFamily
 
   // Check if queue families are valid
   bool isValid() { return graphicsFamily >= 0 && presentationFamily >= 0; }
@@ -66,238 +138,17 @@ static std::vector<char> readFile(const std::string &filename) {
   return fileBuffer;
 }
 
-static uint32_t findMemoryTypeIndex(VkPhysicalDevice physicalDevice,
-				    uint32_t allowedTypes,
-				    VkMemoryPropertyFlags properties) {
-  // Get properties of physical device memory
-  VkPhysicalDeviceMemoryProperties memoryProperties;
-  vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
-
-  for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
-    if ((allowedTypes & (1 << i)) // Index of memory type must match
-				  // corresponding bit in allowedTypes
-	&& (memoryProperties.memoryTypes[i].propertyFlags & properties) ==
-	       properties) // Desired property bit flags are part of memory
-			   // type's property flags
-    {
-      // This memory type is valid, so return its index
-      return i;
-    }
-  }
-}
-
-static void createBuffer(VkPhysicalDevice physicalDevice, VkDevice device,
+static void createBuffer(vkx::Allocator &allocator, VkDevice device,
 			 VkDeviceSize bufferSize,
 			 VkBufferUsageFlags bufferUsage,
 			 VkMemoryPropertyFlags bufferProperties,
-			 VkBuffer *buffer, VkDeviceMemory *bufferMemory) {
-  // CREATE VERTEX BUFFER
-  // Information to create a buffer (doesn't include assigning memory)
-  VkBufferCreateInfo bufferInfo = {};
-  bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-  bufferInfo.size =
-      bufferSize; // Size of buffer (size of 1 vertex * number of vertices)
-  bufferInfo.usage = bufferUsage; // Multiple types of buffer possible
-  bufferInfo.sharingMode =
-      VK_SHARING_MODE_EXCLUSIVE; // Similar to Swap Chain images, can share
-				 // vertex buffers
-
-  VkResult result = vkCreateBuffer(device, &bufferInfo, nullptr, buffer);
-  if (result != VK_SUCCESS) {
-    throw std::runtime_error("Failed to create a Vertex Buffer!");
-  }
-
-  // GET BUFFER MEMORY REQUIREMENTS
-  VkMemoryRequirements memRequirements;
-  vkGetBufferMemoryRequirements(device, *buffer, &memRequirements);
-
-  // ALLOCATE MEMORY TO BUFFER
-  VkMemoryAllocateInfo memoryAllocInfo = {};
-  memoryAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-  memoryAllocInfo.allocationSize = memRequirements.size;
-  memoryAllocInfo.memoryTypeIndex = findMemoryTypeIndex(
-      physicalDevice,
-      memRequirements.memoryTypeBits, // Index of memory type on Physical Device
-				      // that has required bit flags
-      bufferProperties); // VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT	: CPU can
-			 // interact with memory
-			 // VK_MEMORY_PROPERTY_HOST_COHERENT_BIT	: Allows
-			 // placement of data straight into buffer after mapping
-			 // (otherwise would have to specify manually) Allocate
-			 // memory to VkDeviceMemory
-  result = vkAllocateMemory(device, &memoryAllocInfo, nullptr, bufferMemory);
-  if (result != VK_SUCCESS) {
-    throw std::runtime_error("Failed to allocate Vertex Buffer Memory!");
-  }
-
-  // Allocate memory to given vertex buffer
-  vkBindBufferMemory(device, *buffer, *bufferMemory, 0);
-}
-
-static VkCommandBuffer beginCommandBuffer(VkDevice device,
-					  VkCommandPool commandPool) {
-  // Command buffer to hold transfer commands
-  VkCommandBuffer commandBuffer;
-
-  // Command Buffer details
-  VkCommandBufferAllocateInfo allocInfo = {};
-  allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-  allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-  allocInfo.commandPool = commandPool;
-  allocInfo.commandBufferCount = 1;
-
-  // Allocate command buffer from pool
-  vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer);
-
-  // Information to begin the command buffer record
-  VkCommandBufferBeginInfo beginInfo = {};
-  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-  beginInfo.flags =
-      VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT; // We're only using the
-						   // command buffer once, so
-						   // set up for one time submit
-
-  // Begin recording transfer commands
-  vkBeginCommandBuffer(commandBuffer, &beginInfo);
-
-  return commandBuffer;
-}
-
-static void endAndSubmitCommandBuffer(VkDevice device,
-				      VkCommandPool commandPool, VkQueue queue,
-				      VkCommandBuffer commandBuffer) {
-  // End commands
-  vkEndCommandBuffer(commandBuffer);
-
-  // Queue submission information
-  VkSubmitInfo submitInfo = {};
-  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-  submitInfo.commandBufferCount = 1;
-  submitInfo.pCommandBuffers = &commandBuffer;
-
-  // Submit transfer command to transfer queue and wait until it finishes
-  vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE);
-  vkQueueWaitIdle(queue);
-
-  // Free temporary command buffer back to pool
-  vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
-}
-
-static void copyBuffer(VkDevice device, VkQueue transferQueue,
-		       VkCommandPool transferCommandPool, VkBuffer srcBuffer,
-		       VkBuffer dstBuffer, VkDeviceSize bufferSize) {
-  // Create buffer
-  VkCommandBuffer transferCommandBuffer =
-      beginCommandBuffer(device, transferCommandPool);
-
-  // Region of data to copy from and to
-  VkBufferCopy bufferCopyRegion = {};
-  bufferCopyRegion.srcOffset = 0;
-  bufferCopyRegion.dstOffset = 0;
-  bufferCopyRegion.size = bufferSize;
-
-  // Command to copy src buffer to dst buffer
-  vkCmdCopyBuffer(transferCommandBuffer, srcBuffer, dstBuffer, 1,
-		  &bufferCopyRegion);
-
-  endAndSubmitCommandBuffer(device, transferCommandPool, transferQueue,
-			    transferCommandBuffer);
-}
-
-static void copyImageBuffer(VkDevice device, VkQueue transferQueue,
-			    VkCommandPool transferCommandPool,
-			    VkBuffer srcBuffer, VkImage image, uint32_t width,
-			    uint32_t height) {
-  // Create buffer
-  VkCommandBuffer transferCommandBuffer =
-      beginCommandBuffer(device, transferCommandPool);
-
-  VkBufferImageCopy imageRegion = {};
-  imageRegion.bufferOffset = 0; // Offset into data
-  imageRegion.bufferRowLength =
-      0; // Row length of data to calculate data spacing
-  imageRegion.bufferImageHeight = 0; // Image height to calculate data spacing
-  imageRegion.imageSubresource.aspectMask =
-      VK_IMAGE_ASPECT_COLOR_BIT;	     // Which aspect of image to copy
-  imageRegion.imageSubresource.mipLevel = 0; // Mipmap level to copy
-  imageRegion.imageSubresource.baseArrayLayer =
-      0; // Starting array layer (if array)
-  imageRegion.imageSubresource.layerCount =
-      1; // Number of layers to copy starting at baseArrayLayer
-  imageRegion.imageOffset = {
-      0, 0, 0}; // Offset into image (as opposed to raw data in bufferOffset)
-  imageRegion.imageExtent = {width, height,
-			     1}; // Size of region to copy as (x, y, z) values
-
-  // Copy buffer to given image
-  vkCmdCopyBufferToImage(transferCommandBuffer, srcBuffer, image,
-			 VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &imageRegion);
-
-  endAndSubmitCommandBuffer(device, transferCommandPool, transferQueue,
-			    transferCommandBuffer);
-}
-
-static void transitionImageLayout(VkDevice device, VkQueue queue,
-				  VkCommandPool commandPool, VkImage image,
-				  VkImageLayout oldLayout,
-				  VkImageLayout newLayout) {
-  // Create buffer
-  VkCommandBuffer commandBuffer = beginCommandBuffer(device, commandPool);
-
-  VkImageMemoryBarrier imageMemoryBarrier = {};
-  imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-  imageMemoryBarrier.oldLayout = oldLayout; // Layout to transition from
-  imageMemoryBarrier.newLayout = newLayout; // Layout to transition to
-  imageMemoryBarrier.srcQueueFamilyIndex =
-      VK_QUEUE_FAMILY_IGNORED; // Queue family to transition from
-  imageMemoryBarrier.dstQueueFamilyIndex =
-      VK_QUEUE_FAMILY_IGNORED; // Queue family to transition to
-  imageMemoryBarrier.image =
-      image; // Image being accessed and modified as part of barrier
-  imageMemoryBarrier.subresourceRange.aspectMask =
-      VK_IMAGE_ASPECT_COLOR_BIT; // Aspect of image being altered
-  imageMemoryBarrier.subresourceRange.baseMipLevel =
-      0; // First mip level to start alterations on
-  imageMemoryBarrier.subresourceRange.levelCount =
-      1; // Number of mip levels to alter starting from baseMipLevel
-  imageMemoryBarrier.subresourceRange.baseArrayLayer =
-      0; // First layer to start alterations on
-  imageMemoryBarrier.subresourceRange.layerCount =
-      1; // Number of layers to alter starting from baseArrayLayer
-
-  VkPipelineStageFlags srcStage;
-  VkPipelineStageFlags dstStage;
-
-  // If transitioning from new image to image ready to receive data...
-  if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED &&
-      newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) {
-    imageMemoryBarrier.srcAccessMask =
-	0; // Memory access stage transition must after...
-    imageMemoryBarrier.dstAccessMask =
-	VK_ACCESS_TRANSFER_WRITE_BIT; // Memory access stage transition must
-				      // before...
-
-    srcStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-    dstStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-  }
-  // If transitioning from transfer destination to shader readable...
-  else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL &&
-	   newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
-    imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    imageMemoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-    srcStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-    dstStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-  }
-
-  vkCmdPipelineBarrier(
-      commandBuffer, srcStage,
-      dstStage,	  // Pipeline stages (match to src and dst AccessMasks)
-      0,	  // Dependency flags
-      0, nullptr, // Memory Barrier count + data
-      0, nullptr, // Buffer Memory Barrier count + data
-      1, &imageMemoryBarrier // Image Memory Barrier count + data
-  );
-
-  endAndSubmitCommandBuffer(device, commandPool, queue, commandBuffer);
+			 VkBuffer *buffer, vkx::Allocation *bufferMemory) {
+  // Create the buffer and bind it to a range of a shared memory block instead
+  // of giving every buffer its own vkAllocateMemory
+  // VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT	: CPU can interact with memory,
+  // the allocation comes back persistently mapped (bufferMemory->mapped)
+  // VK_MEMORY_PROPERTY_HOST_COHERENT_BIT	: Allows placement of data
+  // straight into buffer after mapping
+  *bufferMemory = vkx::CreateBuffer(allocator, device, bufferSize, bufferUsage,
+				    bufferProperties, buffer);
 }
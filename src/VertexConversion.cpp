@@ -0,0 +1,139 @@
+#include "VertexConversion.h"
+
+#include <glm/gtc/packing.hpp>
+
+#if defined(__AVX2__)
+#define VERTEX_CONVERSION_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VERTEX_CONVERSION_SSE2
+#include <emmintrin.h>
+#endif
+
+// The kernels write pos, col and tex as 8 consecutive floats
+static_assert(sizeof(Vertex) == 8 * sizeof(float), "Vertex layout changed");
+static_assert(offsetof(Vertex, col) == 3 * sizeof(float), "Vertex layout changed");
+static_assert(offsetof(Vertex, tex) == 6 * sizeof(float), "Vertex layout changed");
+
+namespace
+{
+#if defined(VERTEX_CONVERSION_AVX2)
+	// Two vertices per iteration. Every load reads 8 floats starting at the
+	// first vertex, so the last one handled here must have another after it.
+	template <bool HasTexCoords>
+	size_t convertSimd(const float * positions, const float * texCoords, size_t count,
+		glm::vec3 colour, Vertex * vertices)
+	{
+		float * out = reinterpret_cast<float *>(vertices);
+		const __m256 constant = _mm256_setr_ps(0.0f, 0.0f, 0.0f, colour.x, colour.y, colour.z, 0.0f, 0.0f);
+		const __m256i first = _mm256_setr_epi32(0, 1, 2, 0, 0, 0, 0, 1);
+		const __m256i second = _mm256_setr_epi32(3, 4, 5, 0, 0, 0, 3, 4);
+
+		size_t i = 0;
+		for (; i + 3 <= count; i += 2)
+		{
+			__m256 p = _mm256_loadu_ps(positions + i * 3);
+			__m256 first0 = _mm256_blend_ps(constant, _mm256_permutevar8x32_ps(p, first), 0x07);
+			__m256 second0 = _mm256_blend_ps(constant, _mm256_permutevar8x32_ps(p, second), 0x07);
+			if (HasTexCoords)
+			{
+				__m256 t = _mm256_loadu_ps(texCoords + i * 3);
+				first0 = _mm256_blend_ps(first0, _mm256_permutevar8x32_ps(t, first), 0xC0);
+				second0 = _mm256_blend_ps(second0, _mm256_permutevar8x32_ps(t, second), 0xC0);
+			}
+			_mm256_storeu_ps(out + i * 8, first0);
+			_mm256_storeu_ps(out + i * 8 + 8, second0);
+		}
+		return i;
+	}
+#elif defined(VERTEX_CONVERSION_SSE2)
+	// One vertex per iteration as two halves. Every load reads 4 floats
+	// starting at the vertex, so the last one handled here must have another
+	// after it.
+	template <bool HasTexCoords>
+	size_t convertSimd(const float * positions, const float * texCoords, size_t count,
+		glm::vec3 colour, Vertex * vertices)
+	{
+		float * out = reinterpret_cast<float *>(vertices);
+		const __m128 xyzMask = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+		const __m128 lowConstant = _mm_setr_ps(0.0f, 0.0f, 0.0f, colour.x);
+		const __m128 highConstant = _mm_setr_ps(colour.y, colour.z, 0.0f, 0.0f);
+
+		size_t i = 0;
+		for (; i + 2 <= count; i++)
+		{
+			// x y z r
+			__m128 p = _mm_loadu_ps(positions + i * 3);
+			_mm_storeu_ps(out + i * 8, _mm_or_ps(_mm_and_ps(p, xyzMask), lowConstant));
+
+			// g b u v
+			__m128 high = highConstant;
+			if (HasTexCoords)
+			{
+				__m128 t = _mm_loadu_ps(texCoords + i * 3);
+				high = _mm_shuffle_ps(highConstant, t, _MM_SHUFFLE(1, 0, 1, 0));
+			}
+			_mm_storeu_ps(out + i * 8 + 4, high);
+		}
+		return i;
+	}
+#endif
+}
+
+
+
+void ConvertVertices(const float * positions, const float * texCoords, size_t count,
+	glm::vec3 colour, Vertex * vertices)
+{
+	size_t done = 0;
+#if defined(VERTEX_CONVERSION_AVX2) || defined(VERTEX_CONVERSION_SSE2)
+	// Decide once per mesh, not per vertex
+	done = texCoords ?
+		convertSimd<true>(positions, texCoords, count, colour, vertices) :
+		convertSimd<false>(positions, texCoords, count, colour, vertices);
+#endif
+
+	ConvertVerticesScalar(positions + done * 3, texCoords ? texCoords + done * 3 : nullptr,
+		count - done, colour, vertices + done);
+}
+
+void ConvertVerticesScalar(const float * positions, const float * texCoords, size_t count,
+	glm::vec3 colour, Vertex * vertices)
+{
+	if (texCoords)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			vertices[i].pos = { positions[i * 3], positions[i * 3 + 1], positions[i * 3 + 2] };
+			vertices[i].col = colour;
+			vertices[i].tex = { texCoords[i * 3], texCoords[i * 3 + 1] };
+		}
+	}
+	else
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			vertices[i].pos = { positions[i * 3], positions[i * 3 + 1], positions[i * 3 + 2] };
+			vertices[i].col = colour;
+			vertices[i].tex = { 0.0f, 0.0f };
+		}
+	}
+}
+
+void QuantizeVertices(const Vertex * vertices, size_t count, glm::vec4 bounds,
+	CompactVertex * compactVertices)
+{
+	glm::vec3 centre(bounds.x, bounds.y, bounds.z);
+	float scale = bounds.w > 0.0f ? 1.0f / bounds.w : 0.0f;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		// Out of range values are clamped by the packing
+		glm::vec3 position = (vertices[i].pos - centre) * scale;
+		compactVertices[i].pos[0] = glm::packSnorm1x16(position.x);
+		compactVertices[i].pos[1] = glm::packSnorm1x16(position.y);
+		compactVertices[i].pos[2] = glm::packSnorm1x16(position.z);
+		compactVertices[i].pos[3] = 0;
+		compactVertices[i].tex = glm::packHalf2x16(vertices[i].tex);
+	}
+}
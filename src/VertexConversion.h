@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+
+#include <glm/glm.hpp>
+
+#include "Utilities.h"
+
+// Interleaves separate position and texture coordinate arrays (3 floats per
+// element each, as Assimp stores them) into count Vertex, every one with the
+// same colour. texCoords may be null, tex is zero then. Uses AVX2 or SSE2
+// when the build targets them, plain C++ otherwise.
+void ConvertVertices(const float * positions, const float * texCoords, size_t count,
+	glm::vec3 colour, Vertex * vertices);
+
+// Same without SIMD, also used for the tails the SIMD loops leave
+void ConvertVerticesScalar(const float * positions, const float * texCoords, size_t count,
+	glm::vec3 colour, Vertex * vertices);
+
+// Packs count vertices into CompactVertex. Positions are stored relative to
+// bounds (centre in xyz, radius in w), which every vertex has to lie in.
+void QuantizeVertices(const Vertex * vertices, size_t count, glm::vec4 bounds,
+	CompactVertex * compactVertices);
@@ -1,18 +1,25 @@
 #include "VulkanRenderer.h"
 #include "VulkanValidation.h"
 #include <algorithm>
+#include <chrono>
 #include <stdexcept>
 #include <iostream>
+#include <map>
+#include <filesystem>
+#include <fstream>
 
 #include <vkx/tapi.hpp>
 #include <vkx/util.hpp>
 #include <vkx/raii.hpp>
+#include <vkx/memory.hpp>
 #include <vulkan/vulkan_core.h>
 
 VulkanRenderer::VulkanRenderer() {}
 
-int VulkanRenderer::init(vkx::Window const &window) {
+int VulkanRenderer::init(vkx::Window const &window,
+			 VertexFormat requestedVertexFormat) {
   this->window = window;
+  auto initStart = std::chrono::steady_clock::now();
 
   try {
     instance = vkx::CreateInstance("VulkanApp");
@@ -21,25 +28,60 @@ int VulkanRenderer::init(vkx::Window const &window) {
     surface = vkx::Surface::Create(instance, window, nullptr);
     getPhysicalDevice();
     createLogicalDevice();
+    vertexFormat = chooseVertexFormat(requestedVertexFormat);
+    allocator = vkx::CreateAllocator(mainDevice.physicalDevice,
+				     mainDevice.logicalDevice);
     createSwapChain();
     createSwapchainImages();
+    // Depth is kept after the pass, the depth pyramid is built from it
     renderPass =
-	vkx::CreateRenderPass(mainDevice.logicalDevice, swapchain.GetFormat());
+	vkx::CreateRenderPass(mainDevice.logicalDevice, swapchain.GetFormat(),
+			      VK_ATTACHMENT_STORE_OP_STORE);
     createDescriptorSetLayout();
     createPushConstantRange();
+
+    // Pipelines built by an earlier run come straight out of the cache.
+    // They compile on worker threads while the other resources are made.
+    auto pipelineStart = std::chrono::steady_clock::now();
+    pipelineCache = vkx::CreatePipelineCache(mainDevice.physicalDevice,
+					     mainDevice.logicalDevice,
+					     PIPELINE_CACHE_FILE);
+    pipelineCompiler = std::make_unique<PipelineCompiler>(
+	mainDevice.logicalDevice, pipelineCache,
+	std::max(1u, std::thread::hardware_concurrency()));
     createGraphicsPipeline();
+    createCullPipelines();
 
     createColourBufferImage();
     createDepthBufferImage();
     createFramebuffers();
     createCommandPool();
+    // Both queue families touch the pool buffers
+    geometryPool = GeometryPool(
+	allocator, mainDevice.logicalDevice,
+	{static_cast<uint32_t>(queueFamilies.graphicsFamily),
+	 static_cast<uint32_t>(queueFamilies.transferFamily)},
+	vertexFormat, MAX_POOL_VERTICES, MAX_POOL_INDICES);
     createCommandBuffers();
+    createRecordingThreads();
     createTextureSampler();
     // allocateDynamicBufferTransferSpace();
     createUniformBuffers();
+    createInstanceBuffers();
     createDescriptorPool();
     createDescriptorSets();
     createInputDescriptorSets();
+
+    // Which paths the first frame can take depends on what compiled
+    resolveFramePipelines();
+    startupTimings.pipelineMilliseconds =
+	std::chrono::duration<double, std::milli>(
+	    std::chrono::steady_clock::now() - pipelineStart)
+	    .count();
+    startupTimings.pipelineCacheBytes = pipelineCache.GetLoadedSize();
+
+    createIndirectBuffers();
+    createDepthPyramid();
     createSynchronisation();
 
     auto swapchainExtent = swapchain.GetExtent();
@@ -54,8 +96,20 @@ int VulkanRenderer::init(vkx::Window const &window) {
 
     uboViewProjection.projection[1][1] *= -1;
 
-    // Create our default "no texture" texture
-    createTexture("plain.png");
+    // Create our default "no texture" texture, any model may sample it so it
+    // has to be resident before the first one is drawn
+    auto uploads = vkx::CreateUploadBatch(mainDevice.logicalDevice, allocator,
+					  graphicsQueue, graphicsCommandPool);
+    uploads.UseStagingRing(stagingRing);
+    // The reference taken here is never released
+    acquireTexture("plain.png", uploads, *recordingThreads);
+    recordingThreads->wait();
+    uploads.Submit().Wait();
+
+    startupTimings.initMilliseconds =
+	std::chrono::duration<double, std::milli>(
+	    std::chrono::steady_clock::now() - initStart)
+	    .count();
   } catch (const std::runtime_error &e) {
     printf("ERROR: %s\n", e.what());
     return EXIT_FAILURE;
@@ -64,6 +118,31 @@ int VulkanRenderer::init(vkx::Window const &window) {
   return 0;
 }
 
+void VulkanRenderer::setIndirectDrawing(bool enabled) {
+  if (!enabled) {
+    resolveMeshPipelines();
+  }
+  indirectDrawing = enabled && indirectSupported;
+  drawGeneration++;
+}
+
+void VulkanRenderer::setCulling(bool enabled) {
+  culling = enabled && cullingSupported;
+  drawGeneration++;
+}
+
+bool VulkanRenderer::getCulling() { return culling; }
+
+VertexFormat VulkanRenderer::getVertexFormat() { return vertexFormat; }
+
+void VulkanRenderer::setMeshOptimization(uint32_t optimization) {
+  meshOptimization = optimization;
+}
+
+size_t VulkanRenderer::getCommandSlot(uint32_t imageIndex) {
+  return currentFrame * swapChainFramebuffers.size() + imageIndex;
+}
+
 void VulkanRenderer::updateModel(int modelId, glm::mat4 newModel) {
   if (modelId >= modelList.size())
     return;
@@ -71,7 +150,54 @@ void VulkanRenderer::updateModel(int modelId, glm::mat4 newModel) {
   modelList[modelId].setModel(newModel);
 }
 
+int VulkanRenderer::createModelInstance(int modelId, glm::mat4 newModel) {
+  if (modelId >= modelList.size()) {
+    throw std::runtime_error("Attempted to instance invalid Model index!");
+  }
+
+  // The indirect commands have to include the new instance
+  drawGeneration++;
+  return static_cast<int>(modelList[modelId].addInstance(newModel));
+}
+
+void VulkanRenderer::updateModelInstance(int modelId, int instance,
+					 glm::mat4 newModel) {
+  if (modelId >= modelList.size())
+    return;
+
+  modelList[modelId].setInstance(instance, newModel);
+}
+
+void VulkanRenderer::destroyMeshModel(int modelId) {
+  if (modelId >= modelList.size()) {
+    throw std::runtime_error("Attempted to destroy invalid Model index!");
+  }
+
+  // Its upload and the frames drawing it may still be running
+  modelUploads[modelId].Wait();
+  vkDeviceWaitIdle(mainDevice.logicalDevice);
+
+  // An empty model keeps the ids of later models valid and draws nothing
+  modelList[modelId].destroyMeshModel();
+  modelList[modelId] = MeshModel(std::vector<Mesh>());
+  for (int texId : modelTextures[modelId]) {
+    releaseTexture(texId);
+  }
+  modelTextures[modelId].clear();
+  drawGeneration++;
+}
+
+vkx::UploadTicket VulkanRenderer::getModelUpload(int modelId) {
+  if (modelId >= modelUploads.size())
+    return vkx::UploadTicket();
+
+  return modelUploads[modelId];
+}
+
 void VulkanRenderer::draw() {
+  // Release staging memory of uploads the GPU has finished with
+  retireUploads();
+
   // -- GET NEXT IMAGE --
   // Wait for given fence to signal (open) from last draw before continuing
   vkWaitForFences(mainDevice.logicalDevice, 1, &drawFences[currentFrame],
@@ -79,6 +205,10 @@ void VulkanRenderer::draw() {
   // Manually reset (close) fences
   vkResetFences(mainDevice.logicalDevice, 1, &drawFences[currentFrame]);
 
+  // The GPU is done with this frame's staging region, reuse it
+  stagingRing.BeginFrame(currentFrame);
+  readCullStats();
+
   // Get index of next image to be drawn to, and signal semaphore when ready to
   // be drawn to
   uint32_t imageIndex;
@@ -86,8 +216,36 @@ void VulkanRenderer::draw() {
       mainDevice.logicalDevice, swapchain, std::numeric_limits<uint64_t>::max(),
       imageAvailable[currentFrame], VK_NULL_HANDLE, &imageIndex);
 
-  recordCommands(imageIndex);
   updateUniformBuffers(imageIndex);
+  updateInstances();
+  selectLods();
+  if (indirectDrawing && !updateIndirectDraws()) {
+    // Too many batches or draws, the direct path has no limit
+    std::cout << "Indirect drawing disabled: the scene doesn't fit its buffers"
+	      << std::endl;
+    setIndirectDrawing(false);
+  }
+  if (indirectDrawing && culling) {
+    updateCullData();
+  }
+  if (cullingSupported) {
+    indirectFrames[currentFrame].culled = indirectDrawing && culling;
+  }
+
+  // Steady state frames only update buffers and submit the cached commands
+  auto commandSlot = getCommandSlot(imageIndex);
+  auto &recorded = recordedCommands[commandSlot];
+  RecordedCommands current = {drawGeneration, vpUniformOffset,
+			      cullUniformOffset, depthPyramidValid};
+  // Push constants bake the transforms into the commands
+  bool cacheable = indirectDrawing || instancingSupported;
+  if (!cacheable || recorded.generation != current.generation ||
+      recorded.vpUniformOffset != current.vpUniformOffset ||
+      recorded.cullUniformOffset != current.cullUniformOffset ||
+      recorded.depthPyramidValid != current.depthPyramidValid) {
+    recordCommands(imageIndex);
+    recorded = current;
+  }
 
   // -- SUBMIT COMMAND BUFFER TO RENDER --
   // Queue submission information
@@ -101,7 +259,7 @@ void VulkanRenderer::draw() {
   submitInfo.pWaitDstStageMask = waitStages; // Stages to check semaphores at
   submitInfo.commandBufferCount = 1; // Number of command buffers to submit
   submitInfo.pCommandBuffers =
-      &commandBuffers[imageIndex];     // Command buffer to submit
+      &commandBuffers[commandSlot];    // Command buffer to submit
   submitInfo.signalSemaphoreCount = 1; // Number of semaphores to signal
   submitInfo.pSignalSemaphores =
       &renderFinished[currentFrame]; // Semaphores to signal when command buffer
@@ -139,53 +297,118 @@ void VulkanRenderer::draw() {
 void VulkanRenderer::cleanup() {
   // Wait until no actions being run on device before destroying
   vkDeviceWaitIdle(mainDevice.logicalDevice);
+  pipelineCompiler.reset();
+
+  // Uploads own command buffers from both pools, release them first
+  pendingUploads.clear();
+  modelUploads.clear();
+  for (auto &entry : textureEntries) {
+    entry.upload = vkx::UploadTicket();
+  }
+  retiringTextures.clear();
+  stagingRing = vkx::StagingRing();
+
+  // A failed save only costs the next startup its warm cache
+  try {
+    pipelineCache.Save();
+  } catch (const std::runtime_error &e) {
+    printf("ERROR: %s\n", e.what());
+  }
 
   //_aligned_free(modelTransferSpace);
 
   for (size_t i = 0; i < modelList.size(); i++) {
     modelList[i].destroyMeshModel();
   }
+  geometryPool.destroy();
+
+  for (auto &frame : indirectFrames) {
+    vkDestroyBuffer(mainDevice.logicalDevice, frame.commandBuffer, nullptr);
+    allocator.Free(frame.commandMemory);
+    vkDestroyBuffer(mainDevice.logicalDevice, frame.drawBuffer, nullptr);
+    allocator.Free(frame.drawMemory);
+    if (cullingSupported) {
+      vkDestroyBuffer(mainDevice.logicalDevice, frame.culledCommandBuffer,
+		      nullptr);
+      allocator.Free(frame.culledCommandMemory);
+      vkDestroyBuffer(mainDevice.logicalDevice, frame.countBuffer, nullptr);
+      allocator.Free(frame.countMemory);
+      vkDestroyBuffer(mainDevice.logicalDevice, frame.countReadbackBuffer,
+		      nullptr);
+      allocator.Free(frame.countReadbackMemory);
+    }
+  }
+
+  for (size_t i = 0; i < instanceBuffers.size(); i++) {
+    vkDestroyBuffer(mainDevice.logicalDevice, instanceBuffers[i], nullptr);
+    allocator.Free(instanceMemory[i]);
+  }
+
+  if (cullingSupported) {
+    for (auto view : depthPyramidLevelViews) {
+      vkDestroyImageView(mainDevice.logicalDevice, view, nullptr);
+    }
+    vkDestroyImageView(mainDevice.logicalDevice, depthPyramidView, nullptr);
+    depthPyramid = vkx::Image();
+    allocator.Free(depthPyramidMemory);
+    vkDestroySampler(mainDevice.logicalDevice, depthSampler, nullptr);
+  }
 
   vkDestroySampler(mainDevice.logicalDevice, textureSampler, nullptr);
 
   for (size_t i = 0; i < textureImages.size(); i++) {
+    // Evicted already
+    if (textureImageViews[i] == VK_NULL_HANDLE) {
+      continue;
+    }
     vkDestroyImageView(mainDevice.logicalDevice, textureImageViews[i], nullptr);
     vkDestroyImage(mainDevice.logicalDevice, textureImages[i], nullptr);
-    vkFreeMemory(mainDevice.logicalDevice, textureImageMemory[i], nullptr);
+    allocator.Free(textureImageMemory[i]);
   }
 
   for (size_t i = 0; i < depthBufferImage.size(); i++) {
     vkDestroyImageView(mainDevice.logicalDevice, depthBufferImageView[i],
 		       nullptr);
     vkDestroyImage(mainDevice.logicalDevice, depthBufferImage[i], nullptr);
-    vkFreeMemory(mainDevice.logicalDevice, depthBufferImageMemory[i], nullptr);
+    allocator.Free(depthBufferImageMemory[i]);
   }
 
   for (size_t i = 0; i < colourBufferImage.size(); i++) {
     vkDestroyImageView(mainDevice.logicalDevice, colourBufferImageView[i],
 		       nullptr);
     vkDestroyImage(mainDevice.logicalDevice, colourBufferImage[i], nullptr);
-    vkFreeMemory(mainDevice.logicalDevice, colourBufferImageMemory[i], nullptr);
+    allocator.Free(colourBufferImageMemory[i]);
   }
 
-  for (size_t i = 0; i < swapchainImages.size(); i++) {
-    vkDestroyBuffer(mainDevice.logicalDevice, vpUniformBuffer[i], nullptr);
-    vkFreeMemory(mainDevice.logicalDevice, vpUniformBufferMemory[i], nullptr);
-    // vkDestroyBuffer(mainDevice.logicalDevice, modelDUniformBuffer[i],
-    // nullptr); vkFreeMemory(mainDevice.logicalDevice,
-    // modelDUniformBufferMemory[i], nullptr);
-  }
   for (size_t i = 0; i < MAX_FRAME_DRAWS; i++) {
     vkDestroySemaphore(mainDevice.logicalDevice, renderFinished[i], nullptr);
     vkDestroySemaphore(mainDevice.logicalDevice, imageAvailable[i], nullptr);
     vkDestroyFence(mainDevice.logicalDevice, drawFences[i], nullptr);
   }
+  recordingThreads.reset();
+  for (auto &contexts : recordingContexts) {
+    for (auto &context : contexts) {
+      vkDestroyCommandPool(mainDevice.logicalDevice, context.commandPool,
+			   nullptr);
+    }
+  }
   vkDestroyCommandPool(mainDevice.logicalDevice, graphicsCommandPool, nullptr);
+  vkDestroyCommandPool(mainDevice.logicalDevice, transferCommandPool, nullptr);
   for (auto framebuffer : swapChainFramebuffers) {
     vkDestroyFramebuffer(mainDevice.logicalDevice, framebuffer, nullptr);
   }
 }
 
+vkx::AllocatorStats VulkanRenderer::getMemoryStats() {
+  return allocator.GetStats();
+}
+
+VulkanRenderer::StartupTimings VulkanRenderer::getStartupTimings() {
+  return startupTimings;
+}
+
+VulkanRenderer::CullStats VulkanRenderer::getCullStats() { return cullStats; }
+
 VulkanRenderer::~VulkanRenderer() {}
 
 // void VulkanRenderer::createDebugCallback() {
@@ -221,18 +444,135 @@ void VulkanRenderer::createLogicalDevice() {
   auto presentQueueIndex =
       vkx::ChoosePresentQueueIndex(mainDevice.physicalDevice, surface);
 
-  std::cout << "g: " << graphicQueueIndex << ", p: " << presentQueueIndex
-	    << std::endl;
+  // 3. Choose Transfer Queue, uploads share the graphics queue if there is
+  // no separate family
+  auto transferQueueIndex =
+      vkx::ChooseTransferQueueIndex(mainDevice.physicalDevice);
+  if (transferQueueIndex < 0) {
+    transferQueueIndex = graphicQueueIndex;
+  }
+
+  queueFamilies.graphicsFamily = graphicQueueIndex;
+  queueFamilies.presentationFamily = presentQueueIndex;
+  queueFamilies.transferFamily = transferQueueIndex;
+
+  // 4. Enable the optional features the renderer can make use of
+  VkPhysicalDeviceFeatures supportedFeatures;
+  vkGetPhysicalDeviceFeatures(mainDevice.physicalDevice, &supportedFeatures);
+  deviceFeatures = {};
+  deviceFeatures.samplerAnisotropy = VK_TRUE;
+  deviceFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+  deviceFeatures.drawIndirectFirstInstance =
+      supportedFeatures.drawIndirectFirstInstance;
+  deviceFeatures.textureCompressionBC = supportedFeatures.textureCompressionBC;
+  deviceFeatures.textureCompressionASTC_LDR =
+      supportedFeatures.textureCompressionASTC_LDR;
+
+  // Lets culled draws be compacted, counts are read from a buffer
+  std::vector<std::string> extensions;
+  drawCountSupported = vkx::ValidateDeviceExtensions(
+      mainDevice.physicalDevice, {VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME});
+  if (drawCountSupported) {
+    extensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+  }
 
-  // 3. Create Device
+  // Puts every texture into one array, its features can only be queried
+  // if the instance has VK_KHR_get_physical_device_properties2
+  bindlessSupported = vkx::ValidateDeviceExtensions(
+      mainDevice.physicalDevice, {VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME,
+				  VK_KHR_MAINTENANCE3_EXTENSION_NAME});
+  auto getFeatures2 = reinterpret_cast<PFN_vkGetPhysicalDeviceFeatures2KHR>(
+      vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceFeatures2KHR"));
+  auto getProperties2 =
+      reinterpret_cast<PFN_vkGetPhysicalDeviceProperties2KHR>(
+	  vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceProperties2KHR"));
+  if (bindlessSupported && getFeatures2 && getProperties2) {
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures = {};
+    indexingFeatures.sType =
+	VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+    VkPhysicalDeviceFeatures2KHR features2 = {};
+    features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+    features2.pNext = &indexingFeatures;
+    getFeatures2(mainDevice.physicalDevice, &features2);
+
+    VkPhysicalDeviceDescriptorIndexingPropertiesEXT indexingProperties = {};
+    indexingProperties.sType =
+	VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT;
+    VkPhysicalDeviceProperties2KHR properties2 = {};
+    properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR;
+    properties2.pNext = &indexingProperties;
+    getProperties2(mainDevice.physicalDevice, &properties2);
+
+    textureArraySize = std::min(
+	{MAX_TEXTURES,
+	 indexingProperties.maxPerStageDescriptorUpdateAfterBindSamplers,
+	 indexingProperties.maxPerStageDescriptorUpdateAfterBindSampledImages,
+	 indexingProperties.maxDescriptorSetUpdateAfterBindSamplers,
+	 indexingProperties.maxDescriptorSetUpdateAfterBindSampledImages});
+    bindlessSupported =
+	indexingFeatures.runtimeDescriptorArray &&
+	indexingFeatures.descriptorBindingPartiallyBound &&
+	indexingFeatures.descriptorBindingSampledImageUpdateAfterBind &&
+	indexingFeatures.descriptorBindingUpdateUnusedWhilePending &&
+	indexingFeatures.shaderSampledImageArrayNonUniformIndexing &&
+	textureArraySize > 0;
+  } else {
+    bindlessSupported = false;
+  }
+
+  // Only what the texture array needs
+  VkPhysicalDeviceDescriptorIndexingFeaturesEXT enabledIndexingFeatures = {};
+  enabledIndexingFeatures.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+  if (bindlessSupported) {
+    enabledIndexingFeatures.runtimeDescriptorArray = VK_TRUE;
+    enabledIndexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+    enabledIndexingFeatures.descriptorBindingSampledImageUpdateAfterBind =
+	VK_TRUE;
+    enabledIndexingFeatures.descriptorBindingUpdateUnusedWhilePending =
+	VK_TRUE;
+    enabledIndexingFeatures.shaderSampledImageArrayNonUniformIndexing =
+	VK_TRUE;
+    extensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+    extensions.push_back(VK_KHR_MAINTENANCE3_EXTENSION_NAME);
+  }
+  // 5. Create Device
   mainDevice.logicalDevice = vkx::CreateDevice(
-      mainDevice.physicalDevice, graphicQueueIndex, presentQueueIndex);
+      mainDevice.physicalDevice, graphicQueueIndex, presentQueueIndex,
+      transferQueueIndex, deviceFeatures, extensions,
+      bindlessSupported ? &enabledIndexingFeatures : nullptr);
+
+  if (drawCountSupported) {
+    cmdDrawIndexedIndirectCount =
+	reinterpret_cast<PFN_vkCmdDrawIndexedIndirectCountKHR>(
+	    vkGetDeviceProcAddr(mainDevice.logicalDevice,
+				"vkCmdDrawIndexedIndirectCountKHR"));
+    drawCountSupported = cmdDrawIndexedIndirectCount != nullptr;
+  }
+
+  // The texture array needs its own fragment shader, without it the layouts
+  // and sets created next stay per texture. The enabled features go unused.
+  if (bindlessSupported) {
+    try {
+      vkx::CreateShaderModule(mainDevice.logicalDevice,
+			      "Shaders/frag_bindless.spv");
+    } catch (const std::runtime_error &e) {
+      std::cout << "Bindless textures disabled, Shaders/frag_bindless.spv: "
+		<< e.what() << std::endl;
+      bindlessSupported = false;
+    }
+  }
+  std::cout << "Bindless textures: "
+	    << (bindlessSupported ? std::to_string(textureArraySize) : "off")
+	    << std::endl;
 
-  // 4. Get DeviceQueues from a VkDevice
+  // 6. Get DeviceQueues from a VkDevice
   vkGetDeviceQueue(mainDevice.logicalDevice, graphicQueueIndex, 0,
 		   &graphicsQueue);
   vkGetDeviceQueue(mainDevice.logicalDevice, presentQueueIndex, 0,
 		   &presentationQueue);
+  vkGetDeviceQueue(mainDevice.logicalDevice, transferQueueIndex, 0,
+		   &transferQueue);
 }
 
 void VulkanRenderer::createSwapChain() {
@@ -262,12 +602,39 @@ void VulkanRenderer::createDescriptorSetLayout() {
   // view projection matrix
   this->descriptorSetLayout = vkx::CreateDescriptorSetLayout(
       device, {vkx::MakeVertexDescriptorSetLayoutBinding(
-		  0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER)});
-
-  // sampler
-  this->samplerSetLayout = vkx::CreateDescriptorSetLayout(
-      device, {vkx::MakeFragmentDescriptorSetLayoutBinding(
-		  0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER)});
+		  0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC)});
+
+  // sampler, a single array of every texture if descriptor indexing is
+  // there. Its elements are written while the set is bound and the ones
+  // no texture uses stay empty.
+  if (bindlessSupported) {
+    auto binding = vkx::MakeFragmentDescriptorSetLayoutBinding(
+	0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, textureArraySize);
+    VkDescriptorBindingFlagsEXT bindingFlags =
+	VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT |
+	VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT |
+	VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT;
+
+    VkDescriptorSetLayoutBindingFlagsCreateInfoEXT bindingFlagsCreateInfo = {};
+    bindingFlagsCreateInfo.sType =
+	VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+    bindingFlagsCreateInfo.bindingCount = 1;
+    bindingFlagsCreateInfo.pBindingFlags = &bindingFlags;
+
+    VkDescriptorSetLayoutCreateInfo createInfo = {};
+    createInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    createInfo.pNext = &bindingFlagsCreateInfo;
+    createInfo.flags =
+	VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
+    createInfo.bindingCount = 1;
+    createInfo.pBindings = &binding;
+    this->samplerSetLayout =
+	vkx::CreateDescriptorSetLayout(device, &createInfo, nullptr);
+  } else {
+    this->samplerSetLayout = vkx::CreateDescriptorSetLayout(
+	device, {vkx::MakeFragmentDescriptorSetLayoutBinding(
+		    0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER)});
+  }
 
   // input of color & dept
   this->inputSetLayout = vkx::CreateDescriptorSetLayout(
@@ -275,6 +642,38 @@ void VulkanRenderer::createDescriptorSetLayout() {
 		   0, VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT),
 	       vkx::MakeFragmentDescriptorSetLayoutBinding(
 		   1, VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT)});
+
+  // per draw data & model transforms of the indirect path
+  this->drawSetLayout = vkx::CreateDescriptorSetLayout(
+      device, {vkx::MakeVertexDescriptorSetLayoutBinding(
+		   0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+	       vkx::MakeVertexDescriptorSetLayoutBinding(
+		   1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER)});
+
+  // draws, transforms, input & output commands, counts, cull data and the
+  // depth pyramid of the culling pass
+  this->cullSetLayout = vkx::CreateDescriptorSetLayout(
+      device, {vkx::MakeComputeDescriptorSetLayoutBinding(
+		   0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+	       vkx::MakeComputeDescriptorSetLayoutBinding(
+		   1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+	       vkx::MakeComputeDescriptorSetLayoutBinding(
+		   2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+	       vkx::MakeComputeDescriptorSetLayoutBinding(
+		   3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+	       vkx::MakeComputeDescriptorSetLayoutBinding(
+		   4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+	       vkx::MakeComputeDescriptorSetLayoutBinding(
+		   5, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC),
+	       vkx::MakeComputeDescriptorSetLayoutBinding(
+		   6, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER)});
+
+  // source & destination level of a depth pyramid reduction
+  this->reduceSetLayout = vkx::CreateDescriptorSetLayout(
+      device, {vkx::MakeComputeDescriptorSetLayoutBinding(
+		   0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER),
+	       vkx::MakeComputeDescriptorSetLayoutBinding(
+		   1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE)});
 }
 
 void VulkanRenderer::createPushConstantRange() {
@@ -283,69 +682,80 @@ void VulkanRenderer::createPushConstantRange() {
       VK_SHADER_STAGE_VERTEX_BIT; // Shader stage push constant will go to
   pushConstantRange.offset =
       0; // Offset into given data to pass to push constant
-  pushConstantRange.size = sizeof(Model); // Size of data being passed
+  pushConstantRange.size = sizeof(PushModel); // Size of data being passed
 }
 
 void VulkanRenderer::createGraphicsPipeline() {
   auto device = mainDevice.logicalDevice;
 
+  // Every variant below is only queued here, see resolveFramePipelines()
+  // and resolveMeshPipelines() for where they are waited for
+  GraphicsPipelineDescription description;
+
+  // Vertex shaders come in a variant per vertex format
+  std::string vertexVariant =
+      vertexFormat == VertexFormat::Compact ? "_compact" : "";
+
   // -- SHADER STAGE CREATION INFORMATION --
   // Create Shader Modules
-  auto vertShader = vkx::CreateShaderModule(device, "Shaders/vert.spv");
-  auto fragShader = vkx::CreateShaderModule(device, "Shaders/frag.spv");
-
-  auto shaderStages =
-      std::vector{vkx::MakePipelineShaderStageCreateInfo(
-		      VK_SHADER_STAGE_VERTEX_BIT, vertShader),
-		  vkx::MakePipelineShaderStageCreateInfo(
-		      VK_SHADER_STAGE_FRAGMENT_BIT, fragShader)};
+  auto vertShader = vkx::CreateShaderModule(
+      device, "Shaders/vert" + vertexVariant + ".spv");
+  auto fragShader = vkx::CreateShaderModule(
+      device, bindlessSupported ? "Shaders/frag_bindless.spv"
+				: "Shaders/frag.spv");
+
+  description.shaderModules = {vertShader, fragShader};
+  description.shaderStages = {vkx::MakePipelineShaderStageCreateInfo(
+				  VK_SHADER_STAGE_VERTEX_BIT, vertShader),
+			      vkx::MakePipelineShaderStageCreateInfo(
+				  VK_SHADER_STAGE_FRAGMENT_BIT, fragShader)};
 
   // -- VERTEX INPUT --
-  auto bindingDecriptions =
-      std::vector{vkx::MakeVertexInputBindindingDescription(0, sizeof(Vertex))};
+  description.vertexBindings = {vkx::MakeVertexInputBindindingDescription(
+      0, getVertexStride(vertexFormat))};
   // How the data for an attribute is defined within a vertex
-  auto attributeDescriptions = std::vector{
-      vkx::MakeVertexInputAttributeDescription(0, 0, VK_FORMAT_R32G32B32_SFLOAT,
-					       offsetof(Vertex, pos)),
-      vkx::MakeVertexInputAttributeDescription(1, 0, VK_FORMAT_R32G32B32_SFLOAT,
-					       offsetof(Vertex, col)),
-      vkx::MakeVertexInputAttributeDescription(2, 0, VK_FORMAT_R32G32B32_SFLOAT,
-					       offsetof(Vertex, tex))};
-
-  auto vertexInputCreateInfo = vkx::MakePipelineVertexInputStateCreateInfo(
-      bindingDecriptions, attributeDescriptions);
+  if (vertexFormat == VertexFormat::Compact) {
+    // No colour, the shaders use white
+    description.vertexAttributes = {
+	vkx::MakeVertexInputAttributeDescription(
+	    0, 0, VK_FORMAT_R16G16B16A16_SNORM, offsetof(CompactVertex, pos)),
+	vkx::MakeVertexInputAttributeDescription(
+	    2, 0, VK_FORMAT_R16G16_SFLOAT, offsetof(CompactVertex, tex))};
+  } else {
+    description.vertexAttributes = {
+	vkx::MakeVertexInputAttributeDescription(
+	    0, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, pos)),
+	vkx::MakeVertexInputAttributeDescription(
+	    1, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, col)),
+	vkx::MakeVertexInputAttributeDescription(2, 0, VK_FORMAT_R32G32_SFLOAT,
+						 offsetof(Vertex, tex))};
+  }
 
   // -- INPUT ASSEMBLY --
-  auto inputAssembly = vkx::helper::MakePipelineInputAssemblyStateCreateInfo();
+  description.inputAssembly =
+      vkx::helper::MakePipelineInputAssemblyStateCreateInfo();
 
   // -- VIEWPORT & SCISSOR --
   // Create a viewport info struct
   auto swapchainExtent = swapchain.GetExtent();
 
-  auto viewports = std::vector{vkx::MakeViewport(
+  description.viewports = {vkx::MakeViewport(
       0.0f, 0.0f, swapchainExtent.width, swapchainExtent.height)};
-  auto scissors = std::vector{vkx::MakeScissor({0, 0}, swapchainExtent)};
-
-  auto viewportStateCreateInfo =
-      vkx::MakePipelineViewportStateCreateInfo(viewports, scissors);
+  description.scissors = {vkx::MakeScissor({0, 0}, swapchainExtent)};
 
   // -- RASTERIZER --
-  auto rasterizerCreateInfo =
+  description.rasterizer =
       vkx::helper::MakePipelineRasterizationStateCreateInfo();
 
   // -- MULTISAMPLING --
-  auto multisamplingCreateInfo =
+  description.multisampling =
       vkx::helper::MakePipelineMultisampleStateCreateInfo();
 
   // -- BLENDING --
   // Blending decides how to blend a new colour being written to a
   // fragment, with the old value
-
-  auto colorStates =
-      std::vector{vkx::helper::MakePipelineColorBlendAttachmentState()};
-
-  auto colourBlendingCreateInfo =
-      vkx::helper::MakePipelineColorBlendStateCreateInfo(colorStates);
+  description.colourBlendAttachments = {
+      vkx::helper::MakePipelineColorBlendAttachmentState()};
 
   // -- PIPELINE LAYOUT --
   std::vector<VkDescriptorSetLayout> descriptorSetLayouts = {
@@ -361,18 +771,62 @@ void VulkanRenderer::createGraphicsPipeline() {
       vkx::CreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr);
 
   // -- DEPTH STENCIL TESTING --
-  auto depthStencilCreateInfo =
+  description.depthStencil =
       vkx::helper::MakePipelineDepthStencilStateCreateInfo();
 
   // -- GRAPHICS PIPELINE CREATION
-  auto pipelineCreateInfo = vkx::MakeGraphicsPipelineCreateInfo(
-      shaderStages, &vertexInputCreateInfo, &inputAssembly, nullptr,
-      &viewportStateCreateInfo, &rasterizerCreateInfo, &multisamplingCreateInfo,
-      &depthStencilCreateInfo, &colourBlendingCreateInfo, nullptr,
-      pipelineLayout, renderPass, 0, VK_NULL_HANDLE, -1);
+  description.layout = pipelineLayout;
+  description.renderPass = renderPass;
+  description.subpass = 0;
+
+  pendingPipelines.graphics = pipelineCompiler->compile(description);
+
+  // CREATE INSTANCED PIPELINE
+  // Same state, but the transform is an instance rate attribute so every
+  // instance of a mesh is drawn with one call. A device that can't create
+  // the pipeline only loses it in resolveMeshPipelines().
+  auto instancedShader = vkx::CreateShaderModule(
+      device, "Shaders/instanced_vert" + vertexVariant + ".spv");
+  auto instanced = description;
+  instanced.shaderModules.push_back(instancedShader);
+  instanced.shaderStages[0] = vkx::MakePipelineShaderStageCreateInfo(
+      VK_SHADER_STAGE_VERTEX_BIT, instancedShader);
+
+  // A mat4 attribute takes one location per column
+  instanced.vertexBindings.push_back(vkx::MakeVertexInputBindindingDescription(
+      1, sizeof(glm::mat4), VK_VERTEX_INPUT_RATE_INSTANCE));
+  for (uint32_t column = 0; column < 4; column++) {
+    instanced.vertexAttributes.push_back(
+	vkx::MakeVertexInputAttributeDescription(3 + column, 1,
+						 VK_FORMAT_R32G32B32A32_SFLOAT,
+						 column * sizeof(glm::vec4)));
+  }
 
-  this->graphicsPipeline =
-      vkx::CreatePipeline(device, VK_NULL_HANDLE, &pipelineCreateInfo, nullptr);
+  pendingPipelines.instanced = pipelineCompiler->compile(instanced);
+
+  // CREATE INDIRECT PIPELINE
+  // Same state, but transforms come from storage buffers indexed by
+  // firstInstance instead of push constants
+  if (deviceFeatures.drawIndirectFirstInstance) {
+    // The shader is built with the others, a device that can't create the
+    // pipeline only loses the path in resolveFramePipelines()
+    auto indirectShader = vkx::CreateShaderModule(
+	device, "Shaders/indirect_vert" + vertexVariant + ".spv");
+    auto indirect = description;
+    indirect.shaderModules.push_back(indirectShader);
+    indirect.shaderStages[0] = vkx::MakePipelineShaderStageCreateInfo(
+	VK_SHADER_STAGE_VERTEX_BIT, indirectShader);
+
+    std::vector<VkDescriptorSetLayout> indirectSetLayouts = {
+	descriptorSetLayout, samplerSetLayout, drawSetLayout};
+    auto indirectLayoutCreateInfo =
+	vkx::MakePipelineLayoutCreateInfo(indirectSetLayouts, {});
+    indirectPipelineLayout =
+	vkx::CreatePipelineLayout(device, &indirectLayoutCreateInfo, nullptr);
+    indirect.layout = indirectPipelineLayout;
+
+    pendingPipelines.indirect = pipelineCompiler->compile(indirect);
+  }
 
   // CREATE SECOND PASS PIPELINE
   // Second pass shaders
@@ -381,18 +835,20 @@ void VulkanRenderer::createGraphicsPipeline() {
   fragShader = vkx::CreateShaderModule(device, "Shaders/"
 					       "second_frag.spv");
 
-  VkPipelineShaderStageCreateInfo secondShaderStages[] = {
-      vkx::MakePipelineShaderStageCreateInfo(VK_SHADER_STAGE_VERTEX_BIT,
-					     vertShader),
-      vkx::MakePipelineShaderStageCreateInfo(VK_SHADER_STAGE_FRAGMENT_BIT,
-					     fragShader)};
+  auto second = description;
+  second.shaderModules = {vertShader, fragShader};
+  second.shaderStages = {vkx::MakePipelineShaderStageCreateInfo(
+			     VK_SHADER_STAGE_VERTEX_BIT, vertShader),
+			 vkx::MakePipelineShaderStageCreateInfo(
+			     VK_SHADER_STAGE_FRAGMENT_BIT, fragShader)};
 
   // No vertex data for second pass
-  vertexInputCreateInfo = vkx::MakePipelineVertexInputStateCreateInfo({}, {});
+  second.vertexBindings.clear();
+  second.vertexAttributes.clear();
 
   // Don't want to write to depth
   // buffer
-  depthStencilCreateInfo.depthWriteEnable = VK_FALSE;
+  second.depthStencil.depthWriteEnable = VK_FALSE;
 
   // Create new pipeline layout
   descriptorSetLayouts = {inputSetLayout};
@@ -402,13 +858,66 @@ void VulkanRenderer::createGraphicsPipeline() {
   secondPipelineLayout = vkx::CreatePipelineLayout(
       device, &secondPipelineLayoutCreateInfo, nullptr);
 
-  pipelineCreateInfo.pStages = secondShaderStages;
-  pipelineCreateInfo.layout = secondPipelineLayout;
-  pipelineCreateInfo.subpass = 1;
+  second.layout = secondPipelineLayout;
+  second.subpass = 1;
 
   // Create second pipeline
-  this->secondPipeline =
-      vkx::CreatePipeline(device, VK_NULL_HANDLE, &pipelineCreateInfo, nullptr);
+  pendingPipelines.second = pipelineCompiler->compile(second);
+}
+
+void VulkanRenderer::resolveFramePipelines() {
+  // A failed indirect or culling pipeline only disables its path
+  if (pendingPipelines.indirect.valid()) {
+    try {
+      indirectPipeline = pendingPipelines.indirect.get();
+      indirectSupported = true;
+    } catch (const std::runtime_error &e) {
+      std::cout << "Indirect drawing disabled: " << e.what() << std::endl;
+    }
+  }
+  indirectDrawing = indirectSupported;
+
+  if (indirectSupported && pendingPipelines.cull.valid()) {
+    try {
+      cullPipeline = pendingPipelines.cull.get();
+      reducePipeline = pendingPipelines.reduce.get();
+      cullingSupported = true;
+    } catch (const std::runtime_error &e) {
+      std::cout << "Culling disabled: " << e.what() << std::endl;
+    }
+  }
+  culling = cullingSupported;
+
+  this->secondPipeline = pendingPipelines.second.get();
+
+  pendingPipelines.indirect = {};
+  pendingPipelines.cull = {};
+  pendingPipelines.reduce = {};
+  pendingPipelines.second = {};
+
+  // Without indirect drawing the first frame draws meshes directly
+  if (!indirectSupported) {
+    resolveMeshPipelines();
+  }
+}
+
+void VulkanRenderer::resolveMeshPipelines() {
+  if (!pendingPipelines.graphics.valid()) {
+    return;
+  }
+
+  this->graphicsPipeline = pendingPipelines.graphics.get();
+  pendingPipelines.graphics = {};
+
+  if (pendingPipelines.instanced.valid()) {
+    try {
+      instancedPipeline = pendingPipelines.instanced.get();
+      instancingSupported = true;
+    } catch (const std::runtime_error &e) {
+      std::cout << "Instanced drawing disabled: " << e.what() << std::endl;
+    }
+    pendingPipelines.instanced = {};
+  }
 }
 
 void VulkanRenderer::createColourBufferImage() {
@@ -443,19 +952,30 @@ void VulkanRenderer::createDepthBufferImage() {
   depthBufferImageView.resize(swapchainImages.size());
 
   // Get supported format for depth buffer
-  VkFormat depthFormat = chooseSupportedFormat(
+  depthFormat = chooseSupportedFormat(
       {VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D32_SFLOAT,
        VK_FORMAT_D24_UNORM_S8_UINT},
       VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT);
 
+  // Occlusion culling samples depth to build the depth pyramid
+  VkFormatProperties formatProperties;
+  vkGetPhysicalDeviceFormatProperties(mainDevice.physicalDevice, depthFormat,
+				      &formatProperties);
+  occlusionSupported = (formatProperties.optimalTilingFeatures &
+			VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) != 0;
+  VkImageUsageFlags depthUsage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
+				 VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+  if (occlusionSupported) {
+    depthUsage |= VK_IMAGE_USAGE_SAMPLED_BIT;
+  }
+
   for (size_t i = 0; i < swapchainImages.size(); i++) {
     // Create Depth Buffer Image
     auto extent = swapchain.GetExtent();
     depthBufferImage[i] = createImage(
 	extent.width, extent.height, depthFormat, VK_IMAGE_TILING_OPTIMAL,
-	VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
-	    VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT,
-	VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &depthBufferImageMemory[i]);
+	depthUsage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+	&depthBufferImageMemory[i]);
 
     // Create Depth Buffer Image View
     depthBufferImageView[i] = createImageView(depthBufferImage[i], depthFormat,
@@ -495,16 +1015,12 @@ void VulkanRenderer::createFramebuffers() {
 }
 
 void VulkanRenderer::createCommandPool() {
-  // Get indices of queue families from device
-  QueueFamilyIndices queueFamilyIndices =
-      getQueueFamilies(mainDevice.physicalDevice);
-
   VkCommandPoolCreateInfo poolInfo = {};
   poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
   poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
   poolInfo.queueFamilyIndex =
-      queueFamilyIndices.graphicsFamily; // Queue Family type that buffers
-					 // from this command pool will use
+      queueFamilies.graphicsFamily; // Queue Family type that buffers
+				    // from this command pool will use
 
   // Create a Graphics Queue Family Command Pool
   VkResult result = vkCreateCommandPool(mainDevice.logicalDevice, &poolInfo,
@@ -512,11 +1028,22 @@ void VulkanRenderer::createCommandPool() {
   if (result != VK_SUCCESS) {
     throw std::runtime_error("Failed to create a Command Pool!");
   }
+
+  // Upload command buffers are recorded once and freed after use
+  poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+  poolInfo.queueFamilyIndex = queueFamilies.transferFamily;
+  result = vkCreateCommandPool(mainDevice.logicalDevice, &poolInfo, nullptr,
+			       &transferCommandPool);
+  if (result != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create a Transfer Command Pool!");
+  }
 }
 
 void VulkanRenderer::createCommandBuffers() {
-  // Resize command buffer count to have one for each framebuffer
-  commandBuffers.resize(swapChainFramebuffers.size());
+  // One for each framebuffer in each frame in flight, so a buffer is only
+  // ever re-recorded after the fence of its last submission signalled
+  commandBuffers.resize(MAX_FRAME_DRAWS * swapChainFramebuffers.size());
+  recordedCommands.resize(commandBuffers.size());
 
   VkCommandBufferAllocateInfo cbAllocInfo = {};
   cbAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -541,6 +1068,31 @@ void VulkanRenderer::createCommandBuffers() {
   }
 }
 
+void VulkanRenderer::createRecordingThreads() {
+  // The main thread only waits while the workers record
+  auto threadCount = std::max(1u, std::thread::hardware_concurrency());
+  recordingThreads = std::make_unique<ThreadPool>(threadCount);
+
+  // Secondaries are recorded once per frame and reset as a whole
+  VkCommandPoolCreateInfo poolInfo = {};
+  poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+  poolInfo.queueFamilyIndex = queueFamilies.graphicsFamily;
+
+  recordingContexts.resize(commandBuffers.size());
+  for (auto &contexts : recordingContexts) {
+    contexts.resize(threadCount);
+    for (auto &context : contexts) {
+      VkResult result = vkCreateCommandPool(mainDevice.logicalDevice,
+					    &poolInfo, nullptr,
+					    &context.commandPool);
+      if (result != VK_SUCCESS) {
+	throw std::runtime_error("Failed to create a Recording Command Pool!");
+      }
+    }
+  }
+}
+
 void VulkanRenderer::createSynchronisation() {
   imageAvailable.resize(MAX_FRAME_DRAWS);
   renderFinished.resize(MAX_FRAME_DRAWS);
@@ -593,7 +1145,9 @@ void VulkanRenderer::createTextureSampler() {
       VK_SAMPLER_MIPMAP_MODE_LINEAR;   // Mipmap interpolation mode
   samplerCreateInfo.mipLodBias = 0.0f; // Level of Details bias for mip level
   samplerCreateInfo.minLod = 0.0f; // Minimum Level of Detail to pick mip level
-  samplerCreateInfo.maxLod = 0.0f; // Maximum Level of Detail to pick mip level
+  samplerCreateInfo.maxLod =
+      VK_LOD_CLAMP_NONE; // Maximum Level of Detail to pick mip level, every
+			 // texture has its full chain
   samplerCreateInfo.anisotropyEnable = VK_TRUE; // Enable Anisotropy
   samplerCreateInfo.maxAnisotropy = 16;		// Anisotropy sample level
 
@@ -605,31 +1159,30 @@ void VulkanRenderer::createTextureSampler() {
 }
 
 void VulkanRenderer::createUniformBuffers() {
-  // ViewProjection buffer size
-  VkDeviceSize vpBufferSize = sizeof(UboViewProjection);
-
-  // Model buffer size
-  // VkDeviceSize modelBufferSize = modelUniformAlignment * MAX_OBJECTS;
+  // Dynamic offsets into the ring have to respect the uniform alignment
+  VkPhysicalDeviceProperties deviceProperties;
+  vkGetPhysicalDeviceProperties(mainDevice.physicalDevice, &deviceProperties);
+  uniformAlignment = deviceProperties.limits.minUniformBufferOffsetAlignment;
+
+  // One region for each frame in flight, VP data is written into it every
+  // frame and uploads stage through it
+  stagingRing = vkx::CreateStagingRing(mainDevice.logicalDevice, allocator,
+				       MAX_FRAME_DRAWS);
+}
 
-  // One uniform buffer for each image (and by extension, command buffer)
-  vpUniformBuffer.resize(swapchainImages.size());
-  vpUniformBufferMemory.resize(swapchainImages.size());
-  // modelDUniformBuffer.resize(swapchainImages.size());
-  // modelDUniformBufferMemory.resize(swapchainImages.size());
+void VulkanRenderer::createInstanceBuffers() {
+  instanceBuffers.resize(MAX_FRAME_DRAWS);
+  instanceMemory.resize(MAX_FRAME_DRAWS);
 
-  // Create Uniform buffers
-  for (size_t i = 0; i < swapchainImages.size(); i++) {
-    createBuffer(mainDevice.physicalDevice, mainDevice.logicalDevice,
-		 vpBufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+  // Written by the CPU whenever the frame's fence has signalled
+  for (size_t i = 0; i < MAX_FRAME_DRAWS; i++) {
+    createBuffer(allocator, mainDevice.logicalDevice,
+		 sizeof(glm::mat4) * MAX_INSTANCES,
+		 VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+		     VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
 		 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
 		     VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		 &vpUniformBuffer[i], &vpUniformBufferMemory[i]);
-
-    /*createBuffer(mainDevice.physicalDevice, mainDevice.logicalDevice,
-       modelBufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-	    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-       VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &modelDUniformBuffer[i],
-       &modelDUniformBufferMemory[i]);*/
+		 &instanceBuffers[i], &instanceMemory[i]);
   }
 }
 
@@ -640,13 +1193,27 @@ void VulkanRenderer::createDescriptorPool() {
 
   this->descriptorPool = vkx::CreateDescriptorPool(
       device, maxSets,
-      {vkx::MakeDescriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-				   vpUniformBuffer.size())});
-
-  this->samplerDescriptorPool = vkx::CreateDescriptorPool(
-      device, maxSets,
-      {vkx::MakeDescriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-				   MAX_OBJECTS)});
+      {vkx::MakeDescriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+				   swapchainImages.size())});
+
+  if (bindlessSupported) {
+    // Just the texture array set
+    auto poolSize = vkx::MakeDescriptorPoolSize(
+	VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, textureArraySize);
+    VkDescriptorPoolCreateInfo poolCreateInfo = {};
+    poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolCreateInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT;
+    poolCreateInfo.maxSets = 1;
+    poolCreateInfo.poolSizeCount = 1;
+    poolCreateInfo.pPoolSizes = &poolSize;
+    this->samplerDescriptorPool =
+	vkx::CreateDescriptorPool(device, &poolCreateInfo, nullptr);
+  } else {
+    this->samplerDescriptorPool = vkx::CreateDescriptorPool(
+	device, maxSets,
+	{vkx::MakeDescriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+				     MAX_OBJECTS)});
+  }
 
   this->inputDescriptorPool = vkx::CreateDescriptorPool(
       device, maxSets,
@@ -656,6 +1223,30 @@ void VulkanRenderer::createDescriptorPool() {
 	  vkx::MakeDescriptorPoolSize(VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT,
 				      colourBufferImageView.size()),
       });
+
+  this->drawDescriptorPool = vkx::CreateDescriptorPool(
+      device, MAX_FRAME_DRAWS,
+      {vkx::MakeDescriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+				   2 * MAX_FRAME_DRAWS)});
+
+  this->cullDescriptorPool = vkx::CreateDescriptorPool(
+      device, MAX_FRAME_DRAWS,
+      {vkx::MakeDescriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+				   5 * MAX_FRAME_DRAWS),
+       vkx::MakeDescriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+				   MAX_FRAME_DRAWS),
+       vkx::MakeDescriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+				   MAX_FRAME_DRAWS)});
+
+  // One set per depth buffer for the first level, one per further level
+  auto reduceSets =
+      static_cast<uint32_t>(depthBufferImageView.size()) + MAX_PYRAMID_LEVELS;
+  this->reduceDescriptorPool = vkx::CreateDescriptorPool(
+      device, reduceSets,
+      {vkx::MakeDescriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+				   reduceSets),
+       vkx::MakeDescriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+				   reduceSets)});
 }
 
 void VulkanRenderer::createDescriptorSets() {
@@ -687,8 +1278,9 @@ void VulkanRenderer::createDescriptorSets() {
     // VIEW PROJECTION DESCRIPTOR
     // Buffer info and data offset info
     VkDescriptorBufferInfo vpBufferInfo = {};
-    vpBufferInfo.buffer = vpUniformBuffer[i];	    // Buffer to get data from
-    vpBufferInfo.offset = 0;			    // Position of start of data
+    vpBufferInfo.buffer = stagingRing.GetBuffer(); // Buffer to get data from
+    vpBufferInfo.offset = 0; // Position of start of data, the dynamic offset
+			     // is added when binding
     vpBufferInfo.range = sizeof(UboViewProjection); // Size of data
 
     // Data about connection between binding and buffer
@@ -699,7 +1291,7 @@ void VulkanRenderer::createDescriptorSets() {
 	0; // Binding to update (matches with binding on layout/shader)
     vpSetWrite.dstArrayElement = 0; // Index in array to update
     vpSetWrite.descriptorType =
-	VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER; // Type of descriptor
+	VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC; // Type of descriptor
     vpSetWrite.descriptorCount = 1;	   // Amount to update
     vpSetWrite.pBufferInfo =
 	&vpBufferInfo; // Information about buffer data to bind
@@ -728,6 +1320,18 @@ void VulkanRenderer::createDescriptorSets() {
 			   static_cast<uint32_t>(setWrites.size()),
 			   setWrites.data(), 0, nullptr);
   }
+
+  // The texture array, filled in by createTextureDescriptor()
+  if (bindlessSupported) {
+    setAllocInfo.descriptorPool = samplerDescriptorPool;
+    setAllocInfo.descriptorSetCount = 1;
+    setAllocInfo.pSetLayouts = samplerSetLayout;
+    result = vkAllocateDescriptorSets(mainDevice.logicalDevice, &setAllocInfo,
+				      &textureArraySet);
+    if (result != VK_SUCCESS) {
+      throw std::runtime_error("Failed to allocate Texture Array Set!");
+    }
+  }
 }
 
 void VulkanRenderer::createInputDescriptorSets() {
@@ -800,13 +1404,325 @@ void VulkanRenderer::createInputDescriptorSets() {
   }
 }
 
+void VulkanRenderer::createIndirectBuffers() {
+  if (!indirectSupported) {
+    return;
+  }
+
+  indirectFrames.resize(MAX_FRAME_DRAWS);
+  drawDescriptorSets.resize(MAX_FRAME_DRAWS);
+
+  std::vector<VkDescriptorSetLayout> setLayouts(MAX_FRAME_DRAWS,
+						drawSetLayout);
+
+  VkDescriptorSetAllocateInfo setAllocInfo = {};
+  setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  setAllocInfo.descriptorPool = drawDescriptorPool;
+  setAllocInfo.descriptorSetCount = MAX_FRAME_DRAWS;
+  setAllocInfo.pSetLayouts = setLayouts.data();
+
+  VkResult result = vkAllocateDescriptorSets(
+      mainDevice.logicalDevice, &setAllocInfo, drawDescriptorSets.data());
+  if (result != VK_SUCCESS) {
+    throw std::runtime_error("Failed to allocate Draw Descriptor Sets!");
+  }
+
+  if (cullingSupported) {
+    cullDescriptorSets.resize(MAX_FRAME_DRAWS);
+    std::vector<VkDescriptorSetLayout> cullLayouts(MAX_FRAME_DRAWS,
+						   cullSetLayout);
+    setAllocInfo.descriptorPool = cullDescriptorPool;
+    setAllocInfo.pSetLayouts = cullLayouts.data();
+
+    result = vkAllocateDescriptorSets(mainDevice.logicalDevice, &setAllocInfo,
+				      cullDescriptorSets.data());
+    if (result != VK_SUCCESS) {
+      throw std::runtime_error("Failed to allocate Cull Descriptor Sets!");
+    }
+  }
+
+  // Written by the CPU whenever the frame's fence has signalled
+  auto hostVisible =
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+  for (size_t i = 0; i < MAX_FRAME_DRAWS; i++) {
+    auto &frame = indirectFrames[i];
+    createBuffer(allocator, mainDevice.logicalDevice,
+		 sizeof(VkDrawIndexedIndirectCommand) * MAX_INDIRECT_DRAWS,
+		 VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+		     VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		 hostVisible, &frame.commandBuffer, &frame.commandMemory);
+    createBuffer(allocator, mainDevice.logicalDevice,
+		 sizeof(DrawData) * MAX_INDIRECT_DRAWS,
+		 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, hostVisible,
+		 &frame.drawBuffer, &frame.drawMemory);
+
+    std::array<VkDescriptorBufferInfo, 2> bufferInfos = {
+	VkDescriptorBufferInfo{frame.drawBuffer, 0, VK_WHOLE_SIZE},
+	VkDescriptorBufferInfo{instanceBuffers[i], 0, VK_WHOLE_SIZE}};
+
+    std::array<VkWriteDescriptorSet, 2> setWrites = {};
+    for (size_t b = 0; b < setWrites.size(); b++) {
+      setWrites[b].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      setWrites[b].dstSet = drawDescriptorSets[i];
+      setWrites[b].dstBinding = static_cast<uint32_t>(b);
+      setWrites[b].dstArrayElement = 0;
+      setWrites[b].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+      setWrites[b].descriptorCount = 1;
+      setWrites[b].pBufferInfo = &bufferInfos[b];
+    }
+
+    vkUpdateDescriptorSets(mainDevice.logicalDevice,
+			   static_cast<uint32_t>(setWrites.size()),
+			   setWrites.data(), 0, nullptr);
+
+    if (!cullingSupported) {
+      continue;
+    }
+
+    // Only ever touched by the GPU
+    createBuffer(allocator, mainDevice.logicalDevice,
+		 sizeof(VkDrawIndexedIndirectCommand) * MAX_INDIRECT_DRAWS,
+		 VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+		     VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &frame.culledCommandBuffer,
+		 &frame.culledCommandMemory);
+    createBuffer(allocator, mainDevice.logicalDevice,
+		 sizeof(uint32_t) * MAX_INDIRECT_BATCHES,
+		 VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+		     VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+		     VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+		     VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &frame.countBuffer,
+		 &frame.countMemory);
+    createBuffer(allocator, mainDevice.logicalDevice,
+		 sizeof(uint32_t) * MAX_INDIRECT_BATCHES,
+		 VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+		     VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		 &frame.countReadbackBuffer, &frame.countReadbackMemory);
+
+    // The depth pyramid (binding 6) is written once it exists
+    std::array<VkDescriptorBufferInfo, 6> cullInfos = {
+	VkDescriptorBufferInfo{frame.drawBuffer, 0, VK_WHOLE_SIZE},
+	VkDescriptorBufferInfo{instanceBuffers[i], 0, VK_WHOLE_SIZE},
+	VkDescriptorBufferInfo{frame.commandBuffer, 0, VK_WHOLE_SIZE},
+	VkDescriptorBufferInfo{frame.culledCommandBuffer, 0, VK_WHOLE_SIZE},
+	VkDescriptorBufferInfo{frame.countBuffer, 0, VK_WHOLE_SIZE},
+	VkDescriptorBufferInfo{stagingRing.GetBuffer(), 0, sizeof(CullData)}};
+
+    std::array<VkWriteDescriptorSet, 6> cullWrites = {};
+    for (size_t b = 0; b < cullWrites.size(); b++) {
+      cullWrites[b].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      cullWrites[b].dstSet = cullDescriptorSets[i];
+      cullWrites[b].dstBinding = static_cast<uint32_t>(b);
+      cullWrites[b].dstArrayElement = 0;
+      cullWrites[b].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+      cullWrites[b].descriptorCount = 1;
+      cullWrites[b].pBufferInfo = &cullInfos[b];
+    }
+    cullWrites[5].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+
+    vkUpdateDescriptorSets(mainDevice.logicalDevice,
+			   static_cast<uint32_t>(cullWrites.size()),
+			   cullWrites.data(), 0, nullptr);
+  }
+}
+
+void VulkanRenderer::createCullPipelines() {
+  // Only useful with the indirect pipeline, whether that compiled is not
+  // known before resolveFramePipelines()
+  if (!deviceFeatures.drawIndirectFirstInstance) {
+    return;
+  }
+
+  auto device = mainDevice.logicalDevice;
+
+  // Both passes are needed, without them the indirect path draws everything.
+  // A device that can't create them only loses culling in
+  // resolveFramePipelines().
+  auto cullShader = vkx::CreateShaderModule(device, "Shaders/cull_comp.spv");
+  auto reduceShader =
+      vkx::CreateShaderModule(device, "Shaders/depth_reduce_comp.spv");
+
+  std::vector<VkDescriptorSetLayout> cullSetLayouts = {cullSetLayout};
+  auto cullLayoutCreateInfo =
+      vkx::MakePipelineLayoutCreateInfo(cullSetLayouts, {});
+  cullPipelineLayout =
+      vkx::CreatePipelineLayout(device, &cullLayoutCreateInfo, nullptr);
+
+  std::vector<VkDescriptorSetLayout> reduceSetLayouts = {reduceSetLayout};
+  auto reduceLayoutCreateInfo =
+      vkx::MakePipelineLayoutCreateInfo(reduceSetLayouts, {});
+  reducePipelineLayout =
+      vkx::CreatePipelineLayout(device, &reduceLayoutCreateInfo, nullptr);
+
+  pendingPipelines.cull = pipelineCompiler->compile(
+      ComputePipelineDescription{cullShader, cullPipelineLayout});
+  pendingPipelines.reduce = pipelineCompiler->compile(
+      ComputePipelineDescription{reduceShader, reducePipelineLayout});
+}
+
+void VulkanRenderer::createDepthPyramid() {
+  if (!cullingSupported) {
+    return;
+  }
+
+  // Largest power of two not above the swapchain size, so every level is
+  // an exact 2:1 reduction of the one before
+  auto extent = swapchain.GetExtent();
+  auto previousPow2 = [](uint32_t v) {
+    uint32_t r = 1;
+    while (r * 2 <= v) {
+      r *= 2;
+    }
+    return r;
+  };
+  depthPyramidExtent = {previousPow2(extent.width),
+			previousPow2(extent.height)};
+  depthPyramidLevels = 1;
+  while ((std::max(depthPyramidExtent.width, depthPyramidExtent.height) >>
+	  depthPyramidLevels) > 0) {
+    depthPyramidLevels++;
+  }
+  depthPyramidLevels = std::min(depthPyramidLevels, MAX_PYRAMID_LEVELS);
+
+  auto imageCreateInfo = vkx::helper::MakeImageCreateInfo(
+      {depthPyramidExtent.width, depthPyramidExtent.height, 1},
+      VK_FORMAT_R32_SFLOAT, VK_IMAGE_TILING_OPTIMAL,
+      VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
+  imageCreateInfo.mipLevels = depthPyramidLevels;
+  depthPyramid =
+      vkx::CreateImage(mainDevice.logicalDevice, &imageCreateInfo, nullptr);
+  depthPyramidMemory = vkx::BindImageMemory(
+      allocator, mainDevice.logicalDevice, depthPyramid,
+      VK_IMAGE_TILING_OPTIMAL, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+  VkImageViewCreateInfo viewCreateInfo = {};
+  viewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+  viewCreateInfo.image = depthPyramid;
+  viewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+  viewCreateInfo.format = VK_FORMAT_R32_SFLOAT;
+  viewCreateInfo.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0,
+				     depthPyramidLevels, 0, 1};
+  if (vkCreateImageView(mainDevice.logicalDevice, &viewCreateInfo, nullptr,
+			&depthPyramidView) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create an Image View!");
+  }
+
+  // Every level is written on its own
+  depthPyramidLevelViews.resize(depthPyramidLevels);
+  for (uint32_t level = 0; level < depthPyramidLevels; level++) {
+    viewCreateInfo.subresourceRange.baseMipLevel = level;
+    viewCreateInfo.subresourceRange.levelCount = 1;
+    if (vkCreateImageView(mainDevice.logicalDevice, &viewCreateInfo, nullptr,
+			  &depthPyramidLevelViews[level]) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to create an Image View!");
+    }
+  }
+
+  // Only texelFetch is used, but combined image samplers need a sampler
+  VkSamplerCreateInfo samplerCreateInfo = {};
+  samplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  samplerCreateInfo.magFilter = VK_FILTER_NEAREST;
+  samplerCreateInfo.minFilter = VK_FILTER_NEAREST;
+  samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  samplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerCreateInfo.maxLod = static_cast<float>(depthPyramidLevels);
+  if (vkCreateSampler(mainDevice.logicalDevice, &samplerCreateInfo, nullptr,
+		      &depthSampler) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create a Depth Sampler!");
+  }
+
+  // The culling pass reads the whole pyramid
+  VkDescriptorImageInfo pyramidInfo = {depthSampler, depthPyramidView,
+				       VK_IMAGE_LAYOUT_GENERAL};
+  for (auto set : cullDescriptorSets) {
+    VkWriteDescriptorSet pyramidWrite = {};
+    pyramidWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    pyramidWrite.dstSet = set;
+    pyramidWrite.dstBinding = 6;
+    pyramidWrite.dstArrayElement = 0;
+    pyramidWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    pyramidWrite.descriptorCount = 1;
+    pyramidWrite.pImageInfo = &pyramidInfo;
+    vkUpdateDescriptorSets(mainDevice.logicalDevice, 1, &pyramidWrite, 0,
+			   nullptr);
+  }
+
+  if (!occlusionSupported) {
+    return;
+  }
+
+  // Reduction sets, the first level reads the depth buffer of the image
+  // being drawn, every other level the level below it
+  reduceDepthSets.resize(depthBufferImageView.size());
+  reduceLevelSets.resize(depthPyramidLevels - 1);
+
+  std::vector<VkDescriptorSetLayout> setLayouts(
+      reduceDepthSets.size() + reduceLevelSets.size(), reduceSetLayout);
+  std::vector<VkDescriptorSet> sets(setLayouts.size());
+
+  VkDescriptorSetAllocateInfo setAllocInfo = {};
+  setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  setAllocInfo.descriptorPool = reduceDescriptorPool;
+  setAllocInfo.descriptorSetCount = static_cast<uint32_t>(sets.size());
+  setAllocInfo.pSetLayouts = setLayouts.data();
+
+  VkResult result = vkAllocateDescriptorSets(mainDevice.logicalDevice,
+					     &setAllocInfo, sets.data());
+  if (result != VK_SUCCESS) {
+    throw std::runtime_error("Failed to allocate Reduce Descriptor Sets!");
+  }
+
+  for (size_t i = 0; i < sets.size(); i++) {
+    VkDescriptorImageInfo inputInfo = {};
+    VkDescriptorImageInfo outputInfo = {};
+    inputInfo.sampler = depthSampler;
+    outputInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    if (i < reduceDepthSets.size()) {
+      reduceDepthSets[i] = sets[i];
+      inputInfo.imageView = depthBufferImageView[i];
+      inputInfo.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+      outputInfo.imageView = depthPyramidLevelViews[0];
+    } else {
+      auto level = i - reduceDepthSets.size() + 1;
+      reduceLevelSets[level - 1] = sets[i];
+      inputInfo.imageView = depthPyramidLevelViews[level - 1];
+      inputInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+      outputInfo.imageView = depthPyramidLevelViews[level];
+    }
+
+    std::array<VkWriteDescriptorSet, 2> setWrites = {};
+    for (size_t b = 0; b < setWrites.size(); b++) {
+      setWrites[b].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      setWrites[b].dstSet = sets[i];
+      setWrites[b].dstBinding = static_cast<uint32_t>(b);
+      setWrites[b].dstArrayElement = 0;
+      setWrites[b].descriptorCount = 1;
+    }
+    setWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    setWrites[0].pImageInfo = &inputInfo;
+    setWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    setWrites[1].pImageInfo = &outputInfo;
+
+    vkUpdateDescriptorSets(mainDevice.logicalDevice,
+			   static_cast<uint32_t>(setWrites.size()),
+			   setWrites.data(), 0, nullptr);
+  }
+}
+
 void VulkanRenderer::updateUniformBuffers(uint32_t imageIndex) {
-  // Copy VP data
-  void *data;
-  vkMapMemory(mainDevice.logicalDevice, vpUniformBufferMemory[imageIndex], 0,
-	      sizeof(UboViewProjection), 0, &data);
-  memcpy(data, &uboViewProjection, sizeof(UboViewProjection));
-  vkUnmapMemory(mainDevice.logicalDevice, vpUniformBufferMemory[imageIndex]);
+  // Copy VP data into this frame's staging region
+  auto range = stagingRing.Allocate(sizeof(UboViewProjection),
+				    uniformAlignment);
+  if (range.buffer == VK_NULL_HANDLE) {
+    throw std::runtime_error("Staging ring is full!");
+  }
+  memcpy(range.mapped, &uboViewProjection, sizeof(UboViewProjection));
+  vpUniformOffset = static_cast<uint32_t>(range.offset);
 
   // Copy Model data
   /*for (size_t i = 0; i < meshList.size(); i++)
@@ -824,6 +1740,646 @@ void VulkanRenderer::updateUniformBuffers(uint32_t imageIndex) {
   modelDUniformBufferMemory[imageIndex]);*/
 }
 
+void VulkanRenderer::updateInstances() {
+  // Instances of a model are contiguous, so they can be drawn as one range
+  auto transforms =
+      static_cast<glm::mat4 *>(instanceMemory[currentFrame].mapped);
+  modelInstanceBase.resize(modelList.size());
+
+  uint32_t instanceCount = 0;
+  for (size_t j = 0; j < modelList.size(); j++) {
+    auto count = modelList[j].getInstanceCount();
+    if (instanceCount + count > MAX_INSTANCES) {
+      throw std::runtime_error("Too many model instances!");
+    }
+
+    modelInstanceBase[j] = instanceCount;
+    for (size_t i = 0; i < count; i++) {
+      transforms[instanceCount++] = modelList[j].getInstance(i);
+    }
+  }
+}
+
+void VulkanRenderer::selectLods() {
+  // Pixels covered by one unit at distance one, scaled by each instance below
+  auto extent = swapchain.GetExtent();
+  float pixelScale = std::abs(uboViewProjection.projection[1][1]) * 0.5f *
+		     static_cast<float>(extent.height);
+
+  modelLods.resize(modelList.size());
+  for (size_t j = 0; j < modelList.size(); j++) {
+    auto &model = modelList[j];
+    modelLods[j].resize(model.getMeshCount(), 0);
+
+    for (size_t k = 0; k < model.getMeshCount(); k++) {
+      auto mesh = model.getMesh(k);
+      if (mesh->getLodCount() < 2) {
+	continue;
+      }
+
+      // All instances share the model's draws, the closest one decides
+      auto bounds = mesh->getBounds();
+      float pixelsPerUnit = 0.0f;
+      for (size_t i = 0; i < model.getInstanceCount(); i++) {
+	auto transform = uboViewProjection.view * model.getInstance(i);
+	float scale = 0.0f;
+	for (int axis = 0; axis < 3; axis++) {
+	  scale = std::max(scale, glm::length(glm::vec3(transform[axis])));
+	}
+	auto centre = glm::vec3(transform * glm::vec4(glm::vec3(bounds), 1.0f));
+	float distance = glm::length(centre) - bounds.w * scale;
+
+	// Inside the bounding sphere every error is visible
+	if (distance <= 0.0f) {
+	  pixelsPerUnit = std::numeric_limits<float>::max();
+	  break;
+	}
+	pixelsPerUnit = std::max(pixelsPerUnit, pixelScale * scale / distance);
+      }
+
+      // A new level changes the recorded draws
+      auto lod = static_cast<uint32_t>(
+	  mesh->selectLod(pixelsPerUnit, modelLods[j][k]));
+      if (lod != modelLods[j][k]) {
+	modelLods[j][k] = lod;
+	drawGeneration++;
+      }
+    }
+  }
+}
+
+bool VulkanRenderer::updateIndirectDraws() {
+  auto &frame = indirectFrames[currentFrame];
+
+  // Commands of this frame are still valid
+  if (frame.generation == drawGeneration) {
+    return true;
+  }
+
+  // Group meshes by texture and index type, every group becomes one indirect
+  // draw. Each instance gets its own command so it is culled on its own.
+  // With culling, full detail meshes get a command per meshlet instead.
+  // Bindless textures come from the draw data, only the index type splits.
+  struct GroupedDraw {
+    uint32_t transform;
+    Mesh *mesh;
+    size_t lod;
+  };
+  std::map<std::pair<int, VkIndexType>, std::vector<GroupedDraw>> groups;
+  size_t pendingDraws = 0; // draws without a command yet
+  for (size_t j = 0; j < modelList.size(); j++) {
+    if (!modelReady[j]) {
+      continue;
+    }
+    for (size_t k = 0; k < modelList[j].getMeshCount(); k++) {
+      auto mesh = modelList[j].getMesh(k);
+      for (size_t i = 0; i < modelList[j].getInstanceCount(); i++) {
+	auto transform = modelInstanceBase[j] + static_cast<uint32_t>(i);
+	int texId = bindlessSupported ? 0 : mesh->getTexId();
+	groups[{texId, mesh->getIndexType()}].push_back(
+	    {transform, mesh, modelLods[j][k]});
+	pendingDraws++;
+      }
+    }
+  }
+
+  auto commands = static_cast<VkDrawIndexedIndirectCommand *>(
+      frame.commandMemory.mapped);
+  auto draws = static_cast<DrawData *>(frame.drawMemory.mapped);
+  uint32_t drawCount = 0;
+
+  if (groups.size() > MAX_INDIRECT_BATCHES) {
+    return false;
+  }
+
+  frame.batches.clear();
+  for (auto const &group : groups) {
+    auto batchIndex = static_cast<uint32_t>(frame.batches.size());
+    auto batchFirst = drawCount;
+    // The command count is known once the meshlets are expanded
+    frame.batches.push_back(
+	{group.first.first, group.first.second, batchFirst, 0});
+
+    for (auto const &entry : group.second) {
+      auto mesh = entry.mesh;
+      auto const &meshlets = mesh->getMeshlets();
+      // Meshlets only if every draw after this one still gets a command,
+      // otherwise the whole mesh is culled as one
+      pendingDraws--;
+      bool clustered = culling && entry.lod == 0 && meshlets.size() > 1 &&
+		       drawCount + meshlets.size() + pendingDraws <=
+			   MAX_INDIRECT_DRAWS;
+      auto commandCount = clustered ? meshlets.size() : 1;
+      if (drawCount + commandCount > MAX_INDIRECT_DRAWS) {
+	return false;
+      }
+
+      for (size_t m = 0; m < commandCount; m++) {
+	// firstInstance doubles as index into the draw data
+	auto &command = commands[drawCount];
+	auto &draw = draws[drawCount];
+	draw = {mesh->getBounds(),
+		mesh->getBounds(),
+		glm::vec4(0.0f, 0.0f, 1.0f, 1.0f),
+		entry.transform,
+		static_cast<uint32_t>(mesh->getTexId()),
+		batchIndex,
+		batchFirst};
+	if (clustered) {
+	  command = {meshlets[m].indexCount, 1,
+		     mesh->getFirstIndex() + meshlets[m].firstIndex,
+		     mesh->getVertexOffset(), drawCount};
+	  draw.cullBounds = meshlets[m].bounds;
+	  draw.cone = meshlets[m].cone;
+	} else {
+	  command = {static_cast<uint32_t>(mesh->getIndexCount(entry.lod)), 1,
+		     mesh->getFirstIndex(entry.lod), mesh->getVertexOffset(),
+		     drawCount};
+	}
+	drawCount++;
+      }
+    }
+    frame.batches.back().commandCount = drawCount - batchFirst;
+  }
+
+  frame.drawCount = drawCount;
+  frame.generation = drawGeneration;
+  return true;
+}
+
+void VulkanRenderer::updateCullData() {
+  auto &frame = indirectFrames[currentFrame];
+
+  CullData data = {};
+  auto viewProjection = uboViewProjection.projection * uboViewProjection.view;
+
+  // Frustum planes from the rows of the view projection matrix (Gribb &
+  // Hartmann), depth ranges from 0 to 1
+  auto row = [&](int i) {
+    return glm::vec4(viewProjection[0][i], viewProjection[1][i],
+		     viewProjection[2][i], viewProjection[3][i]);
+  };
+  data.frustum[0] = row(3) + row(0); // left
+  data.frustum[1] = row(3) - row(0); // right
+  data.frustum[2] = row(3) + row(1); // bottom
+  data.frustum[3] = row(3) - row(1); // top
+  data.frustum[4] = row(2);	     // near
+  data.frustum[5] = row(3) - row(2); // far
+  for (auto &plane : data.frustum) {
+    plane /= glm::length(glm::vec3(plane));
+  }
+
+  data.pyramidViewProjection = depthPyramidViewProjection;
+  data.pyramidSize = glm::vec2(depthPyramidExtent.width,
+			       depthPyramidExtent.height);
+  data.drawCount = frame.drawCount;
+  data.flags = 0;
+  if (drawCountSupported && deviceFeatures.multiDrawIndirect) {
+    data.flags |= CULL_COMPACT;
+  }
+  if (occlusionSupported && depthPyramidValid) {
+    data.flags |= CULL_OCCLUSION;
+  }
+  // Only meshlet draws carry a normal cone
+  data.flags |= CULL_BACKFACE;
+  data.cameraPosition = glm::inverse(uboViewProjection.view)[3];
+
+  auto range = stagingRing.Allocate(sizeof(CullData), uniformAlignment);
+  if (range.buffer == VK_NULL_HANDLE) {
+    throw std::runtime_error("Staging ring is full!");
+  }
+  memcpy(range.mapped, &data, sizeof(CullData));
+  cullUniformOffset = static_cast<uint32_t>(range.offset);
+
+  // This frame rebuilds the pyramid, the next one tests against it
+  depthPyramidViewProjection = viewProjection;
+}
+
+void VulkanRenderer::readCullStats() {
+  if (!cullingSupported || !indirectFrames[currentFrame].culled) {
+    return;
+  }
+
+  // Batches and draw count are still the ones the pass was recorded with
+  auto &frame = indirectFrames[currentFrame];
+  auto counts = static_cast<const uint32_t *>(frame.countReadbackMemory.mapped);
+  cullStats.testedDraws = frame.drawCount;
+  cullStats.visibleDraws = 0;
+  for (size_t b = 0; b < frame.batches.size(); b++) {
+    cullStats.visibleDraws += counts[b];
+  }
+}
+
+void VulkanRenderer::retireUploads() {
+  // A finished model changes the set of meshes to draw
+  for (size_t j = 0; j < modelList.size(); j++) {
+    // Shared textures may still be on their way with another model
+    bool texturesReady = true;
+    for (int texId : modelTextures[j]) {
+      texturesReady = texturesReady && textureEntries[texId].upload.IsComplete();
+    }
+    if (!modelReady[j] && modelUploads[j].IsComplete() && texturesReady) {
+      modelReady[j] = true;
+      drawGeneration++;
+    }
+  }
+
+  // Duplicates found after decoding go once their copies are done
+  for (auto it = retiringTextures.begin(); it != retiringTextures.end();) {
+    if (it->first.IsComplete()) {
+      releaseTexture(it->second);
+      it = retiringTextures.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  pendingUploads.erase(std::remove_if(pendingUploads.begin(),
+				      pendingUploads.end(),
+				      [](vkx::UploadTicket const &ticket) {
+					return ticket.IsComplete();
+				      }),
+		       pendingUploads.end());
+}
+
+void VulkanRenderer::recordIndirectDraws(uint32_t currentImage) {
+  auto commandBuffer = commandBuffers[getCommandSlot(currentImage)];
+  auto &frame = indirectFrames[currentFrame];
+
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+		    indirectPipeline);
+
+  // View projection and draw data stay bound for every batch
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+			  indirectPipelineLayout, 0, 1,
+			  &descriptorSets[currentImage], 1, &vpUniformOffset);
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+			  indirectPipelineLayout, 2, 1,
+			  &drawDescriptorSets[currentFrame], 0, nullptr);
+  if (bindlessSupported) {
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+			    indirectPipelineLayout, 1, 1, &textureArraySet, 0,
+			    nullptr);
+  }
+
+  // Culled commands have the same layout, batches keep their ranges
+  auto commands = culling ? frame.culledCommandBuffer : frame.commandBuffer;
+  bool compacted =
+      culling && drawCountSupported && deviceFeatures.multiDrawIndirect;
+
+  // The pool buffers are bound with 32 bit indices, batches of the other
+  // type switch the index buffer
+  auto boundIndexType = VK_INDEX_TYPE_UINT32;
+  uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+  for (size_t b = 0; b < frame.batches.size(); b++) {
+    auto const &batch = frame.batches[b];
+    if (batch.indexType != boundIndexType) {
+      geometryPool.bindIndices(commandBuffer, batch.indexType);
+      boundIndexType = batch.indexType;
+    }
+    if (!bindlessSupported) {
+      vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+			      indirectPipelineLayout, 1, 1,
+			      &samplerDescriptorSets[batch.texId], 0, nullptr);
+    }
+
+    if (compacted) {
+      // Only the surviving commands at the front of the range are drawn
+      cmdDrawIndexedIndirectCount(commandBuffer, commands,
+				  batch.firstCommand * stride,
+				  frame.countBuffer, b * sizeof(uint32_t),
+				  batch.commandCount, stride);
+    } else if (deviceFeatures.multiDrawIndirect) {
+      vkCmdDrawIndexedIndirect(commandBuffer, commands,
+			       batch.firstCommand * stride, batch.commandCount,
+			       stride);
+    } else {
+      // Without multiDrawIndirect drawCount has to be 0 or 1
+      for (uint32_t i = 0; i < batch.commandCount; i++) {
+	vkCmdDrawIndexedIndirect(commandBuffer, commands,
+				 (batch.firstCommand + i) * stride, 1, stride);
+      }
+    }
+  }
+}
+
+void VulkanRenderer::recordCulling(uint32_t currentImage) {
+  auto commandBuffer = commandBuffers[getCommandSlot(currentImage)];
+  auto &frame = indirectFrames[currentFrame];
+
+  // Survivors are appended to zeroed counts
+  vkCmdFillBuffer(commandBuffer, frame.countBuffer, 0, VK_WHOLE_SIZE, 0);
+
+  VkBufferMemoryBarrier countBarrier = {};
+  countBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  countBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  countBarrier.dstAccessMask =
+      VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+  countBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  countBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  countBarrier.buffer = frame.countBuffer;
+  countBarrier.offset = 0;
+  countBarrier.size = VK_WHOLE_SIZE;
+
+  // Last frame's reduction has to be done before the pyramid is read, the
+  // first time it only gets a layout the descriptor can be used with
+  VkImageMemoryBarrier pyramidBarrier = {};
+  pyramidBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  pyramidBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  pyramidBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  pyramidBarrier.oldLayout =
+      depthPyramidValid ? VK_IMAGE_LAYOUT_GENERAL : VK_IMAGE_LAYOUT_UNDEFINED;
+  pyramidBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+  pyramidBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  pyramidBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  pyramidBarrier.image = depthPyramid;
+  pyramidBarrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0,
+				     depthPyramidLevels, 0, 1};
+
+  vkCmdPipelineBarrier(
+      commandBuffer,
+      VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 1, &countBarrier, 1,
+      &pyramidBarrier);
+
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+		    cullPipeline);
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+			  cullPipelineLayout, 0, 1,
+			  &cullDescriptorSets[currentFrame], 1,
+			  &cullUniformOffset);
+  vkCmdDispatch(commandBuffer, (frame.drawCount + 63) / 64, 1, 1);
+
+  // Draws read the culled commands and counts
+  std::array<VkBufferMemoryBarrier, 2> drawBarriers = {};
+  for (auto &barrier : drawBarriers) {
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.offset = 0;
+    barrier.size = VK_WHOLE_SIZE;
+  }
+  drawBarriers[0].buffer = frame.culledCommandBuffer;
+  drawBarriers[1].buffer = frame.countBuffer;
+  drawBarriers[1].dstAccessMask |= VK_ACCESS_TRANSFER_READ_BIT;
+
+  vkCmdPipelineBarrier(
+      commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+      0, nullptr, static_cast<uint32_t>(drawBarriers.size()),
+      drawBarriers.data(), 0, nullptr);
+
+  // Counts for getCullStats, read once the frame's fence signalled
+  VkBufferCopy countCopy = {0, 0, sizeof(uint32_t) * MAX_INDIRECT_BATCHES};
+  vkCmdCopyBuffer(commandBuffer, frame.countBuffer, frame.countReadbackBuffer,
+		  1, &countCopy);
+
+  VkBufferMemoryBarrier readbackBarrier = {};
+  readbackBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  readbackBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  readbackBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+  readbackBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  readbackBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  readbackBarrier.buffer = frame.countReadbackBuffer;
+  readbackBarrier.offset = 0;
+  readbackBarrier.size = VK_WHOLE_SIZE;
+
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+		       VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1,
+		       &readbackBarrier, 0, nullptr);
+}
+
+void VulkanRenderer::recordDepthReduce(uint32_t currentImage) {
+  auto commandBuffer = commandBuffers[getCommandSlot(currentImage)];
+
+  // Depth of this frame becomes readable, the pyramid is rewritten as a
+  // whole once the culling pass is done with it
+  std::array<VkImageMemoryBarrier, 2> barriers = {};
+  for (auto &barrier : barriers) {
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  }
+  barriers[0].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  barriers[0].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  barriers[0].oldLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+  barriers[0].newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+  barriers[0].image = depthBufferImage[currentImage];
+  barriers[0].subresourceRange = {VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1};
+  if (depthFormat != VK_FORMAT_D32_SFLOAT) {
+    barriers[0].subresourceRange.aspectMask |= VK_IMAGE_ASPECT_STENCIL_BIT;
+  }
+
+  barriers[1].srcAccessMask = 0;
+  barriers[1].dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barriers[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  barriers[1].newLayout = VK_IMAGE_LAYOUT_GENERAL;
+  barriers[1].image = depthPyramid;
+  barriers[1].subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0,
+				  depthPyramidLevels, 0, 1};
+
+  vkCmdPipelineBarrier(commandBuffer,
+		       VK_PIPELINE_STAGE_ALL_GRAPHICS_BIT |
+			   VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0,
+		       nullptr, static_cast<uint32_t>(barriers.size()),
+		       barriers.data());
+
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+		    reducePipeline);
+
+  // Each level is built from the one below
+  VkMemoryBarrier levelBarrier = {};
+  levelBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  levelBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  levelBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+  for (uint32_t level = 0; level < depthPyramidLevels; level++) {
+    auto set = level == 0 ? reduceDepthSets[currentImage]
+			  : reduceLevelSets[level - 1];
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+			    reducePipelineLayout, 0, 1, &set, 0, nullptr);
+
+    auto width = std::max(depthPyramidExtent.width >> level, 1u);
+    auto height = std::max(depthPyramidExtent.height >> level, 1u);
+    vkCmdDispatch(commandBuffer, (width + 7) / 8, (height + 7) / 8, 1);
+
+    if (level + 1 < depthPyramidLevels) {
+      vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			   VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+			   &levelBarrier, 0, nullptr, 0, nullptr);
+    }
+  }
+
+  depthPyramidValid = true;
+}
+
+void VulkanRenderer::recordMeshDraws(VkCommandBuffer commandBuffer,
+				     uint32_t currentImage, size_t first,
+				     size_t last) {
+  if (instancingSupported) {
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+		      instancedPipeline);
+
+    VkDeviceSize instanceOffset = 0;
+    vkCmdBindVertexBuffers(commandBuffer, 1, 1, &instanceBuffers[currentFrame],
+			   &instanceOffset);
+  } else {
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+		      graphicsPipeline);
+  }
+
+  // Every mesh lives in the pool buffers, only the index buffer changes with
+  // the mesh's index type
+  auto boundIndexType = VK_INDEX_TYPE_UINT32;
+  geometryPool.bind(commandBuffer, boundIndexType);
+
+  // The texture array is bound once, draws push their element instead
+  if (bindlessSupported) {
+    std::array<VkDescriptorSet, 2> descriptorSetGroup = {
+	descriptorSets[currentImage], textureArraySet};
+    vkCmdBindDescriptorSets(
+	commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0,
+	static_cast<uint32_t>(descriptorSetGroup.size()),
+	descriptorSetGroup.data(), 1, &vpUniformOffset);
+  }
+
+  for (size_t d = first; d < last; d++) {
+    auto &thisModel = modelList[meshDraws[d].model];
+    auto mesh = thisModel.getMesh(meshDraws[d].mesh);
+    auto lod = modelLods[meshDraws[d].model][meshDraws[d].mesh];
+
+    if (mesh->getIndexType() != boundIndexType) {
+      boundIndexType = mesh->getIndexType();
+      geometryPool.bindIndices(commandBuffer, boundIndexType);
+    }
+
+    auto texId = static_cast<uint32_t>(mesh->getTexId());
+    if (!bindlessSupported) {
+      std::array<VkDescriptorSet, 2> descriptorSetGroup = {
+	  descriptorSets[currentImage], samplerDescriptorSets[texId]};
+
+      // Bind Descriptor Sets
+      vkCmdBindDescriptorSets(
+	  commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0,
+	  static_cast<uint32_t>(descriptorSetGroup.size()),
+	  descriptorSetGroup.data(), 1, &vpUniformOffset);
+    }
+
+    if (instancingSupported) {
+      // Only the bounds and texture of the push constants are read
+      if (vertexFormat == VertexFormat::Compact) {
+	auto bounds = mesh->getBounds();
+	vkCmdPushConstants(commandBuffer, pipelineLayout,
+			   VK_SHADER_STAGE_VERTEX_BIT,
+			   offsetof(PushModel, bounds), sizeof(glm::vec4),
+			   &bounds);
+      }
+      vkCmdPushConstants(commandBuffer, pipelineLayout,
+			 VK_SHADER_STAGE_VERTEX_BIT, offsetof(PushModel, texId),
+			 sizeof(uint32_t), &texId);
+
+      // firstInstance selects the model's range of the instance buffer, the
+      // mesh is addressed by its range in the pool
+      vkCmdDrawIndexed(
+	  commandBuffer, mesh->getIndexCount(lod),
+	  static_cast<uint32_t>(thisModel.getInstanceCount()),
+	  mesh->getFirstIndex(lod), mesh->getVertexOffset(),
+	  modelInstanceBase[meshDraws[d].model]);
+      continue;
+    }
+
+    // Without the instanced pipeline every instance is drawn on its own
+    for (size_t i = 0; i < thisModel.getInstanceCount(); i++) {
+      PushModel pushModel = {thisModel.getInstance(i), mesh->getBounds(),
+			     texId};
+      vkCmdPushConstants(commandBuffer, pipelineLayout,
+			 VK_SHADER_STAGE_VERTEX_BIT, // Stage to push constants to
+			 0,		    // Offset of push constants to update
+			 sizeof(PushModel), // Size of data being pushed
+			 &pushModel); // Actual data being pushed (can be array)
+
+      vkCmdDrawIndexed(commandBuffer, mesh->getIndexCount(lod), 1,
+		       mesh->getFirstIndex(lod), mesh->getVertexOffset(), 0);
+    }
+  }
+}
+
+void VulkanRenderer::recordMeshDrawsParallel(uint32_t currentImage) {
+  auto &contexts = recordingContexts[getCommandSlot(currentImage)];
+
+  // The slot's primary is being re-recorded after its frame's fence has
+  // signalled, nothing recorded from these pools is in use any more
+  for (auto &context : contexts) {
+    vkResetCommandPool(mainDevice.logicalDevice, context.commandPool, 0);
+    context.used = 0;
+  }
+
+  auto threadCount = recordingThreads->getThreadCount();
+  auto jobSize = std::max(MIN_DRAWS_PER_RECORDING_JOB,
+			  (meshDraws.size() + threadCount - 1) / threadCount);
+  auto jobCount = (meshDraws.size() + jobSize - 1) / jobSize;
+  std::vector<VkCommandBuffer> secondaries(jobCount);
+
+  // Secondaries continue the first subpass of this image's framebuffer
+  VkCommandBufferInheritanceInfo inheritanceInfo = {};
+  inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+  inheritanceInfo.renderPass = renderPass;
+  inheritanceInfo.subpass = 0;
+  inheritanceInfo.framebuffer = swapChainFramebuffers[currentImage];
+
+  for (size_t job = 0; job < jobCount; job++) {
+    recordingThreads->submit([&, job](size_t worker) {
+      // Only this worker records from its pool
+      auto &context = contexts[worker];
+      if (context.used == context.commandBuffers.size()) {
+	VkCommandBufferAllocateInfo cbAllocInfo = {};
+	cbAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	cbAllocInfo.commandPool = context.commandPool;
+	cbAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+	cbAllocInfo.commandBufferCount = 1;
+
+	VkCommandBuffer commandBuffer;
+	if (vkAllocateCommandBuffers(mainDevice.logicalDevice, &cbAllocInfo,
+				     &commandBuffer) != VK_SUCCESS) {
+	  throw std::runtime_error(
+	      "Failed to allocate a Secondary Command Buffer!");
+	}
+	context.commandBuffers.push_back(commandBuffer);
+      }
+      auto commandBuffer = context.commandBuffers[context.used++];
+
+      VkCommandBufferBeginInfo beginInfo = {};
+      beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+      beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT |
+			VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+      beginInfo.pInheritanceInfo = &inheritanceInfo;
+      if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+	throw std::runtime_error(
+	    "Failed to start recording a Secondary Command Buffer!");
+      }
+
+      auto first = job * jobSize;
+      recordMeshDraws(commandBuffer, currentImage, first,
+		      std::min(first + jobSize, meshDraws.size()));
+
+      if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+	throw std::runtime_error(
+	    "Failed to stop recording a Secondary Command Buffer!");
+      }
+      secondaries[job] = commandBuffer;
+    });
+  }
+  recordingThreads->wait();
+
+  // Executed in job order, so draws keep the order of the serial path
+  vkCmdExecuteCommands(commandBuffers[getCommandSlot(currentImage)],
+		       static_cast<uint32_t>(secondaries.size()),
+		       secondaries.data());
+}
+
 void VulkanRenderer::recordCommands(uint32_t currentImage) {
   // Information about how to begin each command buffer
   VkCommandBufferBeginInfo bufferBeginInfo = {};
@@ -851,82 +2407,78 @@ void VulkanRenderer::recordCommands(uint32_t currentImage) {
 
   renderPassBeginInfo.framebuffer = swapChainFramebuffers[currentImage];
 
+  auto commandBuffer = commandBuffers[getCommandSlot(currentImage)];
+
   // Start recording commands to command buffer!
   VkResult result =
-      vkBeginCommandBuffer(commandBuffers[currentImage], &bufferBeginInfo);
+      vkBeginCommandBuffer(commandBuffer, &bufferBeginInfo);
   if (result != VK_SUCCESS) {
     throw std::runtime_error("Failed to start recording a Command Buffer!");
   }
 
-  // Begin Render Pass
-  vkCmdBeginRenderPass(commandBuffers[currentImage], &renderPassBeginInfo,
-		       VK_SUBPASS_CONTENTS_INLINE);
-
-  // Bind Pipeline to be used in render pass
-  vkCmdBindPipeline(commandBuffers[currentImage],
-		    VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
-
-  for (size_t j = 0; j < modelList.size(); j++) {
-    MeshModel thisModel = modelList[j];
-
-    auto model = thisModel.getModel();
-    vkCmdPushConstants(commandBuffers[currentImage], pipelineLayout,
-		       VK_SHADER_STAGE_VERTEX_BIT, // Stage to push constants to
-		       0,	      // Offset of push constants to update
-		       sizeof(Model), // Size of data being pushed
-		       &model);	      // Actual data being pushed (can be array)
-
-    for (size_t k = 0; k < thisModel.getMeshCount(); k++) {
-
-      VkBuffer vertexBuffers[] = {
-	  thisModel.getMesh(k)->getVertexBuffer()}; // Buffers to bind
-      VkDeviceSize offsets[] = {0}; // Offsets into buffers being bound
-      vkCmdBindVertexBuffers(
-	  commandBuffers[currentImage], 0, 1, vertexBuffers,
-	  offsets); // Command to bind vertex buffer before drawing with them
-
-      // Bind mesh index buffer, with 0 offset and using the uint32 type
-      vkCmdBindIndexBuffer(commandBuffers[currentImage],
-			   thisModel.getMesh(k)->getIndexBuffer(), 0,
-			   VK_INDEX_TYPE_UINT32);
-
-      // Dynamic Offset Amount
-      // uint32_t dynamicOffset = static_cast<uint32_t>(modelUniformAlignment)
-      // * j;
-
-      // "Push" constants to given shader stage directly (no buffer)
+  // Cull before the first subpass reads the indirect commands
+  if (indirectDrawing && culling) {
+    recordCulling(currentImage);
+  }
 
-      std::array<VkDescriptorSet, 2> descriptorSetGroup = {
-	  descriptorSets[currentImage],
-	  samplerDescriptorSets[thisModel.getMesh(k)->getTexId()]};
+  // Without indirect drawing every mesh of every ready model is one draw
+  bool parallel = false;
+  if (!indirectDrawing) {
+    meshDraws.clear();
+    for (size_t j = 0; j < modelList.size(); j++) {
+      // Skip models still being streamed in
+      if (!modelReady[j]) {
+	continue;
+      }
+      for (size_t k = 0; k < modelList[j].getMeshCount(); k++) {
+	meshDraws.push_back(
+	    {static_cast<uint32_t>(j), static_cast<uint32_t>(k)});
+      }
+    }
 
-      // Bind Descriptor Sets
-      vkCmdBindDescriptorSets(
-	  commandBuffers[currentImage], VK_PIPELINE_BIND_POINT_GRAPHICS,
-	  pipelineLayout, 0, static_cast<uint32_t>(descriptorSetGroup.size()),
-	  descriptorSetGroup.data(), 0, nullptr);
+    // Small scenes aren't worth the hand over to the workers
+    parallel = recordingThreads && recordingThreads->getThreadCount() > 1 &&
+	       meshDraws.size() >= 2 * MIN_DRAWS_PER_RECORDING_JOB;
+  }
 
-      // Execute pipeline
-      vkCmdDrawIndexed(commandBuffers[currentImage],
-		       thisModel.getMesh(k)->getIndexCount(), 1, 0, 0, 0);
-    }
+  // Begin Render Pass, the first subpass is recorded into secondary command
+  // buffers if the draws are split across threads
+  vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo,
+		       parallel ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS
+				: VK_SUBPASS_CONTENTS_INLINE);
+
+  if (indirectDrawing) {
+    // Every mesh lives in the pool buffers, batches rebind the index buffer
+    // if their index type differs
+    geometryPool.bind(commandBuffer, VK_INDEX_TYPE_UINT32);
+    recordIndirectDraws(currentImage);
+  } else if (parallel) {
+    recordMeshDrawsParallel(currentImage);
+  } else {
+    recordMeshDraws(commandBuffer, currentImage, 0,
+		    meshDraws.size());
   }
 
   // Start second subpass
-  vkCmdNextSubpass(commandBuffers[currentImage], VK_SUBPASS_CONTENTS_INLINE);
+  vkCmdNextSubpass(commandBuffer, VK_SUBPASS_CONTENTS_INLINE);
 
-  vkCmdBindPipeline(commandBuffers[currentImage],
+  vkCmdBindPipeline(commandBuffer,
 		    VK_PIPELINE_BIND_POINT_GRAPHICS, secondPipeline);
-  vkCmdBindDescriptorSets(commandBuffers[currentImage],
+  vkCmdBindDescriptorSets(commandBuffer,
 			  VK_PIPELINE_BIND_POINT_GRAPHICS, secondPipelineLayout,
 			  0, 1, &inputDescriptorSets[currentImage], 0, nullptr);
-  vkCmdDraw(commandBuffers[currentImage], 3, 1, 0, 0);
+  vkCmdDraw(commandBuffer, 3, 1, 0, 0);
 
   // End Render Pass
-  vkCmdEndRenderPass(commandBuffers[currentImage]);
+  vkCmdEndRenderPass(commandBuffer);
+
+  // Depth pyramid for the next frame's occlusion test
+  if (indirectDrawing && culling && occlusionSupported) {
+    recordDepthReduce(currentImage);
+  }
 
   // Stop recording to command buffer
-  result = vkEndCommandBuffer(commandBuffers[currentImage]);
+  result = vkEndCommandBuffer(commandBuffer);
   if (result != VK_SUCCESS) {
     throw std::runtime_error("Failed to stop recording a Command Buffer!");
   }
@@ -949,51 +2501,6 @@ void VulkanRenderer::allocateDynamicBufferTransferSpace() {
   modelUniformAlignment);*/
 }
 
-QueueFamilyIndices VulkanRenderer::getQueueFamilies(VkPhysicalDevice device) {
-  QueueFamilyIndices indices;
-
-  // Get all Queue Family Property info for the given device
-  uint32_t queueFamilyCount = 0;
-  vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
-
-  std::vector<VkQueueFamilyProperties> queueFamilyList(queueFamilyCount);
-  vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount,
-					   queueFamilyList.data());
-
-  // Go through each queue family and check if it has at least 1 of the
-  // required types of queue
-  int i = 0;
-  for (const auto &queueFamily : queueFamilyList) {
-    // First check if queue family has at least 1 queue in that family (could
-    // have no queues) Queue can be multiple types defined through bitfield.
-    // Need to bitwise AND with VK_QUEUE_*_BIT to check if has required type
-    if (queueFamily.queueCount > 0 &&
-	queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
-      indices.graphicsFamily = i; // If queue family is valid, then get index
-    }
-
-    // Check if Queue Family supports presentation
-    VkBool32 presentationSupport = false;
-    vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface,
-					 &presentationSupport);
-    // Check if queue is presentation type (can be both graphics and
-    // presentation)
-    if (queueFamily.queueCount > 0 && presentationSupport) {
-      indices.presentationFamily = i;
-    }
-
-    // Check if queue family indices are in a valid state, stop searching if
-    // so
-    if (indices.isValid()) {
-      break;
-    }
-
-    i++;
-  }
-
-  return indices;
-}
-
 SwapChainDetails VulkanRenderer::getSwapChainDetails(VkPhysicalDevice device) {
   SwapChainDetails swapChainDetails;
 
@@ -1087,11 +2594,76 @@ VulkanRenderer::chooseSupportedFormat(const std::vector<VkFormat> &formats,
   throw std::runtime_error("Failed to find a matching format!");
 }
 
+VertexFormat VulkanRenderer::chooseVertexFormat(VertexFormat requested) {
+  if (requested == VertexFormat::Full) {
+    return requested;
+  }
+
+  // Both compact attribute formats have to be readable from vertex buffers
+  for (VkFormat format :
+       {VK_FORMAT_R16G16B16A16_SNORM, VK_FORMAT_R16G16_SFLOAT}) {
+    VkFormatProperties properties;
+    vkGetPhysicalDeviceFormatProperties(mainDevice.physicalDevice, format,
+					&properties);
+    if (!(properties.bufferFeatures & VK_FORMAT_FEATURE_VERTEX_BUFFER_BIT)) {
+      std::cout << "Compact vertices not supported, using full ones"
+		<< std::endl;
+      return VertexFormat::Full;
+    }
+  }
+
+  return requested;
+}
+
+bool VulkanRenderer::chooseCompressedTexture(const std::string &fileName,
+					     std::string *path,
+					     Ktx2Info *info) {
+  // Best quality per byte first, BC1 halves the size again but drops alpha
+  const char *suffixes[] = {".bc7.ktx2", ".astc.ktx2", ".bc1.ktx2"};
+  std::string stem = fileName.substr(0, fileName.rfind('.'));
+
+  for (auto suffix : suffixes) {
+    std::string candidate = "Textures/" + stem + suffix;
+    if (!std::filesystem::exists(candidate)) {
+      continue;
+    }
+    // A damaged file just loses its turn, the source image still loads
+    Ktx2Info candidateInfo;
+    try {
+      candidateInfo = ReadKtx2Info(candidate);
+    } catch (const std::runtime_error &e) {
+      std::cout << "Skipping " << candidate << ": " << e.what() << std::endl;
+      continue;
+    }
+
+    // Block formats need their device feature on top of the format support
+    VkFormat format = candidateInfo.format;
+    bool isBc = format >= VK_FORMAT_BC1_RGB_UNORM_BLOCK &&
+		format <= VK_FORMAT_BC7_SRGB_BLOCK;
+    bool isAstc = format >= VK_FORMAT_ASTC_4x4_UNORM_BLOCK &&
+		  format <= VK_FORMAT_ASTC_12x12_SRGB_BLOCK;
+    if ((isBc && !deviceFeatures.textureCompressionBC) ||
+	(isAstc && !deviceFeatures.textureCompressionASTC_LDR) ||
+	!vkx::IsFormatSupported(
+	    mainDevice.physicalDevice, format, VK_IMAGE_TILING_OPTIMAL,
+	    VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT |
+		VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT)) {
+      continue;
+    }
+
+    *path = candidate;
+    *info = std::move(candidateInfo);
+    return true;
+  }
+  return false;
+}
+
 vkx::Image VulkanRenderer::createImage(uint32_t width, uint32_t height,
 				       VkFormat format, VkImageTiling tiling,
 				       VkImageUsageFlags useFlags,
 				       VkMemoryPropertyFlags propFlags,
-				       VkDeviceMemory *imageMemory) {
+				       vkx::Allocation *imageMemory,
+				       uint32_t mipLevels) {
   // CREATE IMAGE
   // Image Creation Info
   // VkImageCreateInfo imageCreateInfo = {};
@@ -1123,39 +2695,22 @@ vkx::Image VulkanRenderer::createImage(uint32_t width, uint32_t height,
   //}
 
   auto extent = VkExtent3D{.width = width, .height = height, .depth = 1};
-  auto imageCreateInfo =
-      vkx::helper::MakeImageCreateInfo(extent, format, tiling, useFlags);
+  auto imageCreateInfo = vkx::helper::MakeImageCreateInfo(
+      extent, format, tiling, useFlags, mipLevels);
 
   auto image =
       vkx::CreateImage(mainDevice.logicalDevice, &imageCreateInfo, nullptr);
   // CREATE MEMORY FOR IMAGE
-
-  // Get memory requirements for a type of image
-  VkMemoryRequirements memoryRequirements;
-  vkGetImageMemoryRequirements(mainDevice.logicalDevice, image,
-			       &memoryRequirements);
-
-  // Allocate memory using image requirements and user defined properties
-  VkMemoryAllocateInfo memoryAllocInfo = {};
-  memoryAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-  memoryAllocInfo.allocationSize = memoryRequirements.size;
-  memoryAllocInfo.memoryTypeIndex = findMemoryTypeIndex(
-      mainDevice.physicalDevice, memoryRequirements.memoryTypeBits, propFlags);
-
-  auto result = vkAllocateMemory(mainDevice.logicalDevice, &memoryAllocInfo,
-				 nullptr, imageMemory);
-  if (result != VK_SUCCESS) {
-    throw std::runtime_error("Failed to allocate memory for image!");
-  }
-
-  // Connect memory to image
-  vkBindImageMemory(mainDevice.logicalDevice, image, *imageMemory, 0);
+  // Sub-allocate from a shared block and connect it to the image
+  *imageMemory = vkx::BindImageMemory(allocator, mainDevice.logicalDevice, image,
+				      tiling, propFlags);
 
   return image;
 }
 
 VkImageView VulkanRenderer::createImageView(VkImage image, VkFormat format,
-					    VkImageAspectFlags aspectFlags) {
+					    VkImageAspectFlags aspectFlags,
+					    uint32_t mipLevels) {
   VkImageViewCreateInfo viewCreateInfo = {};
   viewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
   viewCreateInfo.image = image; // Image to create view for
@@ -1176,7 +2731,7 @@ VkImageView VulkanRenderer::createImageView(VkImage image, VkFormat format,
   viewCreateInfo.subresourceRange.baseMipLevel =
       0; // Start mipmap level to view from
   viewCreateInfo.subresourceRange.levelCount =
-      1; // Number of mipmap levels to view
+      mipLevels; // Number of mipmap levels to view
   viewCreateInfo.subresourceRange.baseArrayLayer =
       0; // Start array level to view from
   viewCreateInfo.subresourceRange.layerCount =
@@ -1213,99 +2768,226 @@ VulkanRenderer::createShaderModule(const std::vector<char> &code) {
   return shaderModule;
 }
 
-int VulkanRenderer::createTextureImage(std::string fileName) {
-  // Load image file
+int VulkanRenderer::createTextureImage(std::string fileName,
+				       vkx::UploadBatch &uploads,
+				       ThreadPool &decoders,
+				       uint64_t *contentHash) {
+  // A block compressed copy takes a quarter to an eighth of the memory and
+  // brings its own mip chain
+  std::string compressedFile;
+  Ktx2Info compressed;
+  bool useCompressed =
+      chooseCompressedTexture(fileName, &compressedFile, &compressed);
+
+  // Only the size is needed to create the image
   int width, height;
   VkDeviceSize imageSize;
-  stbi_uc *imageData = loadTextureFile(fileName, &width, &height, &imageSize);
-
-  // Create staging buffer to hold loaded data, ready to copy to device
-  VkBuffer imageStagingBuffer;
-  VkDeviceMemory imageStagingBufferMemory;
-  createBuffer(mainDevice.physicalDevice, mainDevice.logicalDevice, imageSize,
-	       VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-	       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-		   VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-	       &imageStagingBuffer, &imageStagingBufferMemory);
-
-  // Copy image data to staging buffer
-  void *data;
-  vkMapMemory(mainDevice.logicalDevice, imageStagingBufferMemory, 0, imageSize,
-	      0, &data);
-  memcpy(data, imageData, static_cast<size_t>(imageSize));
-  vkUnmapMemory(mainDevice.logicalDevice, imageStagingBufferMemory);
-
-  // Free original image data
-  stbi_image_free(imageData);
+  VkFormat format;
+  std::vector<vkx::UploadBatch::ImageLevel> levels;
+  if (useCompressed) {
+    width = compressed.width;
+    height = compressed.height;
+    format = compressed.format;
+    VkDeviceSize offset = 0;
+    for (auto &level : compressed.levels) {
+      levels.push_back({offset, level.width, level.height});
+      offset += level.size;
+    }
+    imageSize = offset;
+  } else {
+    loadTextureInfo(fileName, &width, &height, &imageSize);
+    format = VK_FORMAT_R8G8B8A8_UNORM;
+
+    // The whole chain is built on the CPU. Uploads run on the transfer
+    // queue, which can't blit, and the decoding thread has the pixels at
+    // hand anyway.
+    uint32_t mipLevels = GetMipLevelCount(width, height);
+    VkDeviceSize offset = 0;
+    for (uint32_t level = 0; level < mipLevels; level++) {
+      levels.push_back(
+	  {offset, GetMipWidth(width, level), GetMipHeight(height, level)});
+      offset += static_cast<VkDeviceSize>(levels.back().width) *
+		levels.back().height * 4;
+    }
+    imageSize = offset;
+  }
+  uint32_t mipLevels = static_cast<uint32_t>(levels.size());
 
   // Create image to hold final texture
   vkx::Image texImage;
-  VkDeviceMemory texImageMemory;
+  vkx::Allocation texImageMemory;
   texImage = createImage(
-      width, height, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL,
+      width, height, format, VK_IMAGE_TILING_OPTIMAL,
       VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &texImageMemory);
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &texImageMemory, mipLevels);
 
   // COPY DATA TO IMAGE
-  // Transition image to be DST for copy operation
-  transitionImageLayout(
-      mainDevice.logicalDevice, graphicsQueue, graphicsCommandPool, texImage,
-      VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-
-  // Copy image data
-  copyImageBuffer(mainDevice.logicalDevice, graphicsQueue, graphicsCommandPool,
-		  imageStagingBuffer, texImage, width, height);
-
-  // Transition image to be shader readable for shader usage
-  transitionImageLayout(mainDevice.logicalDevice, graphicsQueue,
-			graphicsCommandPool, texImage,
-			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-			VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+  // The pixels are read, or decoded and downsampled, straight into the
+  // staging memory while the caller goes on, the layout transitions and
+  // copies are recorded when the batch is submitted
+  auto pixels = uploads.StageImage(imageSize, texImage, levels);
+  // Hashed where the data is at hand, of what is uploaded: a KTX2 copy and
+  // its source image differ
+  std::array<uint32_t, 3> key = {static_cast<uint32_t>(format),
+				 static_cast<uint32_t>(width),
+				 static_cast<uint32_t>(height)};
+  auto hashStaged = [key, pixels, imageSize, contentHash]() {
+    if (contentHash) {
+      *contentHash = hashTextureData(
+	  pixels, static_cast<size_t>(imageSize),
+	  hashTextureData(key.data(), sizeof(key)));
+    }
+  };
+  if (useCompressed) {
+    decoders.submit([compressedFile, compressed, pixels, hashStaged](size_t) {
+      ReadKtx2Levels(compressedFile, compressed, pixels);
+      hashStaged();
+    });
+  } else {
+    decoders.submit(
+	[fileName, width, height, mipLevels, pixels, hashStaged](size_t) {
+	  decodeTextureFile(fileName, width, height, mipLevels, pixels);
+	  hashStaged();
+	});
+  }
 
   // Add texture data to vector for reference
   textureImages.push_back(texImage);
   textureImageMemory.push_back(texImageMemory);
-
-  // Destroy staging buffers
-  vkDestroyBuffer(mainDevice.logicalDevice, imageStagingBuffer, nullptr);
-  vkFreeMemory(mainDevice.logicalDevice, imageStagingBufferMemory, nullptr);
+  textureFormats.push_back(format);
 
   // Return index of new texture image
   return textureImages.size() - 1;
 }
 
-int VulkanRenderer::createTexture(std::string fileName) {
+int VulkanRenderer::acquireTexture(std::string fileName,
+				   vkx::UploadBatch &uploads,
+				   ThreadPool &decoders, bool *created,
+				   uint64_t *contentHash) {
+  if (created) {
+    *created = false;
+  }
+  std::string fileLoc = "Textures/" + fileName;
+  std::error_code error;
+  auto resolved = std::filesystem::weakly_canonical(fileLoc, error);
+  std::string path = error ? fileLoc : resolved.string();
+
+  // Same file, whatever name the material used for it
+  auto byPath = texturesByPath.find(path);
+  if (byPath != texturesByPath.end()) {
+    textureEntries[byPath->second].references++;
+    return byPath->second;
+  }
+
   // Create Texture Image and get its location in array
-  int textureImageLoc = createTextureImage(fileName);
+  int textureImageLoc =
+      createTextureImage(fileName, uploads, decoders, contentHash);
 
-  // Create Image View and add to list
+  // Create Image View over the whole mip chain and add to list
   VkImageView imageView =
-      createImageView(textureImages[textureImageLoc], VK_FORMAT_R8G8B8A8_UNORM,
-		      VK_IMAGE_ASPECT_COLOR_BIT);
+      createImageView(textureImages[textureImageLoc],
+		      textureFormats[textureImageLoc],
+		      VK_IMAGE_ASPECT_COLOR_BIT, VK_REMAINING_MIP_LEVELS);
   textureImageViews.push_back(imageView);
 
   // Create Texture Descriptor
   int descriptorLoc = createTextureDescriptor(imageView);
 
+  // Register it, the location of its set identifies the texture
+  if (descriptorLoc >= static_cast<int>(textureEntries.size())) {
+    textureEntries.resize(descriptorLoc + 1);
+  }
+  textureEntries[descriptorLoc] = {0, textureImageLoc, 1,
+				   vkx::UploadTicket()};
+  texturesByPath[path] = descriptorLoc;
+  if (created) {
+    *created = true;
+  }
+
   // Return location of set with texture
   return descriptorLoc;
 }
 
+void VulkanRenderer::releaseTexture(int texId) {
+  auto &entry = textureEntries[texId];
+  if (entry.references == 0 || --entry.references > 0) {
+    return;
+  }
+
+  // Last user gone, the set is kept for the next texture
+  vkDestroyImageView(mainDevice.logicalDevice,
+		     textureImageViews[entry.imageLoc], nullptr);
+  textureImageViews[entry.imageLoc] = VK_NULL_HANDLE;
+  textureImages[entry.imageLoc] = vkx::Image();
+  allocator.Free(textureImageMemory[entry.imageLoc]);
+  freeTextureDescriptors.push_back(texId);
+
+  auto byHash = texturesByHash.find(entry.contentHash);
+  if (byHash != texturesByHash.end() && byHash->second == texId) {
+    texturesByHash.erase(byHash);
+  }
+  for (auto it = texturesByPath.begin(); it != texturesByPath.end();) {
+    it = it->second == texId ? texturesByPath.erase(it) : std::next(it);
+  }
+}
+
+int VulkanRenderer::shareTextureContent(int texId, uint64_t contentHash) {
+  textureEntries[texId].contentHash = contentHash;
+  auto byHash = texturesByHash.find(contentHash);
+  if (byHash == texturesByHash.end()) {
+    texturesByHash[contentHash] = texId;
+    return texId;
+  }
+
+  // Same content under another name, e.g. a copy next to every model. The
+  // duplicate keeps one reference until its copy is done.
+  int shared = byHash->second;
+  textureEntries[shared].references += textureEntries[texId].references;
+  textureEntries[texId].references = 1;
+  for (auto &byPath : texturesByPath) {
+    if (byPath.second == texId) {
+      byPath.second = shared;
+    }
+  }
+  return shared;
+}
+
 int VulkanRenderer::createTextureDescriptor(VkImageView textureImage) {
   VkDescriptorSet descriptorSet;
+  int descriptorLoc = -1;
+
+  // The set of an evicted texture is rewritten instead of allocating another
+  if (!freeTextureDescriptors.empty()) {
+    descriptorLoc = freeTextureDescriptors.back();
+    freeTextureDescriptors.pop_back();
+    descriptorSet = samplerDescriptorSets[descriptorLoc];
+  } else if (bindlessSupported) {
+    // Next element of the array
+    if (samplerDescriptorSets.size() >= textureArraySize) {
+      throw std::runtime_error("Texture array is full!");
+    }
+    descriptorSet = textureArraySet;
+  } else {
+    // Descriptor Set Allocation Info
+    VkDescriptorSetAllocateInfo setAllocInfo = {};
+    setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    setAllocInfo.descriptorPool = samplerDescriptorPool;
+    setAllocInfo.descriptorSetCount = 1;
+    setAllocInfo.pSetLayouts = samplerSetLayout;
+
+    // Allocate Descriptor Sets
+    VkResult result = vkAllocateDescriptorSets(mainDevice.logicalDevice,
+					       &setAllocInfo, &descriptorSet);
+    if (result != VK_SUCCESS) {
+      throw std::runtime_error("Failed to allocate Texture Descriptor Sets!");
+    }
+  }
 
-  // Descriptor Set Allocation Info
-  VkDescriptorSetAllocateInfo setAllocInfo = {};
-  setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-  setAllocInfo.descriptorPool = samplerDescriptorPool;
-  setAllocInfo.descriptorSetCount = 1;
-  setAllocInfo.pSetLayouts = samplerSetLayout;
-
-  // Allocate Descriptor Sets
-  VkResult result = vkAllocateDescriptorSets(mainDevice.logicalDevice,
-					     &setAllocInfo, &descriptorSet);
-  if (result != VK_SUCCESS) {
-    throw std::runtime_error("Failed to allocate Texture Descriptor Sets!");
+  // The texture id is the array element if bindless
+  uint32_t arrayElement = 0;
+  if (bindlessSupported) {
+    arrayElement = static_cast<uint32_t>(
+	descriptorLoc >= 0 ? descriptorLoc : samplerDescriptorSets.size());
   }
 
   // Texture Image Info
@@ -1320,7 +3002,7 @@ int VulkanRenderer::createTextureDescriptor(VkImageView textureImage) {
   descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
   descriptorWrite.dstSet = descriptorSet;
   descriptorWrite.dstBinding = 0;
-  descriptorWrite.dstArrayElement = 0;
+  descriptorWrite.dstArrayElement = arrayElement;
   descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
   descriptorWrite.descriptorCount = 1;
   descriptorWrite.pImageInfo = &imageInfo;
@@ -1328,6 +3010,9 @@ int VulkanRenderer::createTextureDescriptor(VkImageView textureImage) {
   // Update new descriptor set
   vkUpdateDescriptorSets(mainDevice.logicalDevice, 1, &descriptorWrite, 0,
 			 nullptr);
+  if (descriptorLoc >= 0) {
+    return descriptorLoc;
+  }
 
   // Add descriptor set to list
   samplerDescriptorSets.push_back(descriptorSet);
@@ -1337,62 +3022,224 @@ int VulkanRenderer::createTextureDescriptor(VkImageView textureImage) {
 }
 
 int VulkanRenderer::createMeshModel(std::string modelFile) {
-  // Import model "scene"
-  Assimp::Importer importer;
-  const aiScene *scene =
-      importer.ReadFile(modelFile, aiProcess_Triangulate | aiProcess_FlipUVs |
-				       aiProcess_JoinIdenticalVertices);
-  if (!scene) {
-    throw std::runtime_error("Failed to load model! (" + modelFile + ")");
+  const unsigned int importFlags = aiProcess_Triangulate | aiProcess_FlipUVs |
+				   aiProcess_JoinIdenticalVertices;
+
+  // Earlier runs leave a binary copy of the import, meshes then point
+  // straight into the mapped cache
+  MeshCache cache;
+  std::vector<std::string> textureNames;
+  std::vector<MeshData> importedMeshes;
+  std::vector<MeshView> meshViews;
+  if (cache.open(modelFile, importFlags, meshOptimization)) {
+    textureNames = cache.getTextureNames();
+    meshViews = cache.getMeshes();
+  } else {
+    // Import model "scene"
+    Assimp::Importer importer;
+    const aiScene *scene = importer.ReadFile(modelFile, importFlags);
+    if (!scene) {
+      throw std::runtime_error("Failed to load model! (" + modelFile + ")");
+    }
+
+    // Get vector of all materials with 1:1 ID placement
+    textureNames = MeshModel::LoadMaterials(scene);
+    // Recording is the only other use of the threads and happens in draw()
+    VertexCacheStats before;
+    VertexCacheStats after;
+    importedMeshes = MeshModel::LoadScene(scene, *recordingThreads,
+					  meshOptimization, &before, &after);
+    for (auto const &meshData : importedMeshes) {
+      meshViews.push_back(meshData.view());
+    }
+    if (after.triangles > 0) {
+      printf("mesh optimization: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f (%s)\n",
+	     before.getAcmr(), after.getAcmr(), before.getAtvr(),
+	     after.getAtvr(), modelFile.c_str());
+    }
+
+    // Without a cache the next run just imports again
+    try {
+      MeshCache::write(modelFile, importFlags, meshOptimization, textureNames,
+		       importedMeshes);
+    } catch (const std::runtime_error &e) {
+      printf("ERROR: %s\n", e.what());
+    }
   }
 
-  // Get vector of all materials with 1:1 ID placement
-  std::vector<std::string> textureNames = MeshModel::LoadMaterials(scene);
+  // Every texture and mesh upload of this model goes into one submission on
+  // the transfer queue, then ownership moves to the graphics queue
+  auto uploads = vkx::CreateUploadBatch(
+      mainDevice.logicalDevice, allocator, transferQueue, transferCommandPool,
+      queueFamilies.transferFamily, graphicsQueue, graphicsCommandPool,
+      queueFamilies.graphicsFamily);
+  // Staging gets its own buffers here, not the ring: the ring belongs to the
+  // graphics family, and rewinding a region would wait for this upload
 
   // Conversion from the materials list IDs to our Descriptor Array IDs
   std::vector<int> matToTex(textureNames.size());
+  std::vector<int> acquiredTextures;
+  std::vector<int> createdTextures;
+  std::vector<size_t> createdMaterials; // the material of each created one
+  std::vector<int> duplicateTextures;
+  std::vector<uint64_t> contentHashes(textureNames.size(), 0);
+  std::vector<Mesh> modelMeshes;
 
-  // Loop over textureNames and create textures for them
-  for (size_t i = 0; i < textureNames.size(); i++) {
-    // If material had no texture, set '0' to indicate no texture, texture 0
-    // will be reserved for a default texture
-    if (textureNames[i].empty()) {
-      matToTex[i] = 0;
-    } else {
-      // Otherwise, create texture and set value to index of new texture
-      matToTex[i] = createTexture(textureNames[i]);
+  try {
+    // Loop over textureNames and create textures for them
+    for (size_t i = 0; i < textureNames.size(); i++) {
+      // If material had no texture, set '0' to indicate no texture, texture 0
+      // will be reserved for a default texture
+      if (textureNames[i].empty()) {
+	matToTex[i] = 0;
+      } else {
+	// Otherwise, share a loaded texture with the same file, or create it,
+	// and set value to its index
+	bool created = false;
+	matToTex[i] = acquireTexture(textureNames[i], uploads,
+				     *recordingThreads, &created,
+				     &contentHashes[i]);
+	acquiredTextures.push_back(matToTex[i]);
+	if (created) {
+	  createdTextures.push_back(matToTex[i]);
+	  createdMaterials.push_back(i);
+	}
+      }
     }
-  }
 
-  // Load in all our meshes
-  std::vector<Mesh> modelMeshes = MeshModel::LoadNode(
-      mainDevice.physicalDevice, mainDevice.logicalDevice, graphicsQueue,
-      graphicsCommandPool, scene->mRootNode, scene, matToTex);
+    // Load in all our meshes while the textures decode, their data is copied
+    // into staging memory here
+    for (auto const &meshView : meshViews) {
+      modelMeshes.push_back(Mesh(&geometryPool, uploads, meshView,
+				 matToTex[meshView.materialIndex]));
+    }
+    recordingThreads->wait();
+
+    // The content of new textures is known now, one that matches a loaded
+    // texture is replaced by it
+    for (size_t c = 0; c < createdTextures.size(); c++) {
+      int texId = createdTextures[c];
+      int shared =
+	  shareTextureContent(texId, contentHashes[createdMaterials[c]]);
+      if (shared == texId) {
+	continue;
+      }
+
+      duplicateTextures.push_back(texId);
+      std::replace(matToTex.begin(), matToTex.end(), texId, shared);
+      std::replace(acquiredTextures.begin(), acquiredTextures.end(), texId,
+		   shared);
+      for (auto &mesh : modelMeshes) {
+	if (mesh.getTexId() == texId) {
+	  mesh.setTexId(shared);
+	}
+      }
+    }
+  } catch (...) {
+    // Nothing reached the GPU. Once no decoder writes into staging memory
+    // any more, give back what this model took.
+    try {
+      recordingThreads->wait();
+    } catch (...) {
+    }
+    uploads.Discard();
+    for (auto &mesh : modelMeshes) {
+      mesh.destroyBuffers();
+    }
+    for (int texId : acquiredTextures) {
+      releaseTexture(texId);
+    }
+    throw;
+  }
+  cache.close();
 
   // Create mesh model and add to list
   MeshModel meshModel = MeshModel(modelMeshes);
   modelList.push_back(meshModel);
+  modelTextures.push_back(acquiredTextures);
+
+  // Don't wait for the GPU, the ticket can be polled through getModelUpload
+  auto ticket = uploads.Submit();
+  // Shared textures keep the ticket of the batch that uploads them
+  for (int texId : createdTextures) {
+    textureEntries[texId].upload = ticket;
+  }
+  for (int texId : duplicateTextures) {
+    retiringTextures.push_back({ticket, texId});
+  }
+  modelUploads.push_back(ticket);
+  modelReady.push_back(false);
+  pendingUploads.push_back(ticket);
 
   return modelList.size() - 1;
 }
 
-stbi_uc *VulkanRenderer::loadTextureFile(std::string fileName, int *width,
-					 int *height, VkDeviceSize *imageSize) {
+void VulkanRenderer::loadTextureInfo(std::string fileName, int *width,
+				     int *height, VkDeviceSize *imageSize) {
   // Number of channels image uses
   int channels;
 
-  // Load pixel data for image
   std::string fileLoc = "Textures/" + fileName;
-  stbi_uc *image =
-      stbi_load(fileLoc.c_str(), width, height, &channels, STBI_rgb_alpha);
+  if (!stbi_info(fileLoc.c_str(), width, height, &channels)) {
+    throw std::runtime_error("Failed to load a Texture file! (" + fileName +
+			     ")");
+  }
+
+  // Always decoded to RGBA
+  *imageSize = static_cast<VkDeviceSize>(*width) * *height * 4;
+}
+
+uint64_t VulkanRenderer::hashTextureData(const void *data, size_t size,
+					 uint64_t hash) {
+  auto bytes = static_cast<const uint8_t *>(data);
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ bytes[i]) * 1099511628211ull;
+  }
+  return hash;
+}
+
+void VulkanRenderer::decodeTextureFile(std::string fileName, int width,
+				       int height, uint32_t mipLevels,
+				       void *pixels) {
+  int channels;
+  int decodedWidth, decodedHeight;
 
+  // Load pixel data for image
+  std::string fileLoc = "Textures/" + fileName;
+  stbi_uc *image = stbi_load(fileLoc.c_str(), &decodedWidth, &decodedHeight,
+			     &channels, STBI_rgb_alpha);
   if (!image) {
     throw std::runtime_error("Failed to load a Texture file! (" + fileName +
 			     ")");
   }
 
-  // Calculate image size using given and known data
-  *imageSize = *width * *height * 4;
-
-  return image;
+  // stb_image always allocates its output, this copy runs on the decoding
+  // thread instead of the render thread
+  bool sizeMatches = decodedWidth == width && decodedHeight == height;
+  if (!sizeMatches) {
+    stbi_image_free(image);
+    throw std::runtime_error("Texture file changed while loading! (" +
+			     fileName + ")");
+  }
+  auto out = static_cast<uint8_t *>(pixels);
+  size_t levelSize = static_cast<size_t>(width) * height * 4;
+  memcpy(out, image, levelSize);
+  out += levelSize;
+
+  // Every level is downsampled from the previous one in ordinary memory,
+  // staging memory is often uncached and only ever written
+  const uint8_t *previous = image;
+  std::vector<uint8_t> levelPixels[2];
+  for (uint32_t level = 1; level < mipLevels; level++) {
+    auto &next = levelPixels[level % 2];
+    levelSize = static_cast<size_t>(GetMipWidth(width, level)) *
+		GetMipHeight(height, level) * 4;
+    next.resize(levelSize);
+    DownsampleRgba8(previous, GetMipWidth(width, level - 1),
+		    GetMipHeight(height, level - 1), next.data());
+    memcpy(out, next.data(), levelSize);
+    out += levelSize;
+    previous = next.data();
+  }
+  stbi_image_free(image);
 }
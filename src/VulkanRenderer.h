@@ -13,39 +13,99 @@
 #include <stdexcept>
 #include <vector>
 #include <set>
+#include <unordered_map>
 #include <algorithm>
 #include <array>
+#include <memory>
 
 #include "stb_image.h"
 
+#include "GeometryPool.h"
+#include "Ktx2.h"
 #include "Mesh.h"
+#include "MeshCache.h"
 #include "MeshModel.h"
+#include "MipGeneration.h"
+#include "PipelineCompiler.h"
+#include "ThreadPool.h"
 #include "VulkanValidation.h"
 #include "Utilities.h"
 
+#include <vkx/memory.hpp>
+#include <vkx/pipeline_cache.hpp>
 #include <vkx/raii.hpp>
+#include <vkx/upload.hpp>
 
 class VulkanRenderer {
 public:
   VulkanRenderer();
 
-  int init(vkx::Window const &window);
+  // Compact vertices take 12 instead of 32 bytes, ignored if the device
+  // can't read their formats
+  int init(vkx::Window const &window,
+	   VertexFormat requestedVertexFormat = VertexFormat::Full);
 
   int createMeshModel(std::string modelFile);
+  // Frees the meshes of modelId and its references on textures, textures no
+  // other model uses are destroyed. Waits for the GPU. The id stays valid and
+  // draws nothing.
+  void destroyMeshModel(int modelId);
+  vkx::UploadTicket getModelUpload(int modelId);
   void updateModel(int modelId, glm::mat4 newModel);
+  // Draws modelId once more with its own transform, without uploading the
+  // meshes again. Returns the instance index, the model itself is 0.
+  int createModelInstance(int modelId, glm::mat4 newModel);
+  void updateModelInstance(int modelId, int instance, glm::mat4 newModel);
+  // Toggle GPU driven drawing, ignored if the device can't do it
+  void setIndirectDrawing(bool enabled);
+  // Toggle GPU culling of indirect draws, ignored if the device can't do it
+  void setCulling(bool enabled);
+  // False if culling was turned off or the device can't do it
+  bool getCulling();
+  // Full if the requested compact format isn't supported
+  VertexFormat getVertexFormat();
+  // MeshOptimization passes run on models imported from now on
+  void setMeshOptimization(uint32_t optimization);
 
   void draw();
   void cleanup();
 
+  vkx::AllocatorStats getMemoryStats();
+
+  struct StartupTimings {
+    double initMilliseconds = 0.0;
+    double pipelineMilliseconds = 0.0; // pipeline cache and all pipelines
+    size_t pipelineCacheBytes = 0;     // 0 on a cold start
+  };
+  StartupTimings getStartupTimings();
+
+  // Draws cull.comp tested and kept in the last finished frame it ran in
+  struct CullStats {
+    uint32_t testedDraws = 0;
+    uint32_t visibleDraws = 0;
+  };
+  CullStats getCullStats();
+
   ~VulkanRenderer();
 
 private:
   vkx::Window window;
 
   int currentFrame = 0;
+  StartupTimings startupTimings;
 
   // Scene Objects
   std::vector<MeshModel> modelList;
+  std::vector<vkx::UploadTicket> modelUploads;
+  std::vector<bool> modelReady; // upload finished, model may be drawn
+  std::vector<uint32_t> modelInstanceBase; // first transform of each model
+  // Level of detail of every mesh of each model, shared by its instances
+  std::vector<std::vector<uint32_t>> modelLods;
+  GeometryPool geometryPool;
+  VertexFormat vertexFormat = VertexFormat::Full;
+  uint32_t meshOptimization =
+      MESH_OPTIMIZE_VERTEX_CACHE | MESH_OPTIMIZE_OVERDRAW | MESH_OPTIMIZE_LODS |
+      MESH_OPTIMIZE_MESHLETS;
 
   // Scene Settings
   struct UboViewProjection {
@@ -63,22 +123,36 @@ private:
     VkPhysicalDevice physicalDevice;
     vkx::Device logicalDevice;
   } mainDevice;
+  vkx::Allocator allocator;
   VkQueue graphicsQueue;
   VkQueue presentationQueue;
+  VkQueue transferQueue;
+  QueueFamilyIndices queueFamilies;
+  VkPhysicalDeviceFeatures deviceFeatures;
 
   vkx::Surface surface;
   vkx::Swapchain swapchain;
   std::vector<vkx::ImageView> swapchainImages;
 
   std::vector<VkFramebuffer> swapChainFramebuffers;
+  // Indexed by getCommandSlot(), recorded commands are reused until
+  // anything baked into them changes
+  struct RecordedCommands {
+    uint64_t generation = 0; // drawGeneration, 0 if never recorded
+    uint32_t vpUniformOffset = 0;
+    uint32_t cullUniformOffset = 0;
+    bool depthPyramidValid = false;
+  };
   std::vector<VkCommandBuffer> commandBuffers;
+  std::vector<RecordedCommands> recordedCommands;
 
   std::vector<vkx::Image> colourBufferImage;
-  std::vector<VkDeviceMemory> colourBufferImageMemory;
+  std::vector<vkx::Allocation> colourBufferImageMemory;
   std::vector<VkImageView> colourBufferImageView;
 
+  VkFormat depthFormat;
   std::vector<vkx::Image> depthBufferImage;
-  std::vector<VkDeviceMemory> depthBufferImageMemory;
+  std::vector<vkx::Allocation> depthBufferImageMemory;
   std::vector<VkImageView> depthBufferImageView;
 
   VkSampler textureSampler;
@@ -87,18 +161,36 @@ private:
   vkx::DescriptorSetLayout descriptorSetLayout;
   vkx::DescriptorSetLayout samplerSetLayout;
   vkx::DescriptorSetLayout inputSetLayout;
+  vkx::DescriptorSetLayout drawSetLayout;
+  vkx::DescriptorSetLayout cullSetLayout;
+  vkx::DescriptorSetLayout reduceSetLayout;
   VkPushConstantRange pushConstantRange;
 
   vkx::DescriptorPool descriptorPool;
   vkx::DescriptorPool samplerDescriptorPool;
   vkx::DescriptorPool inputDescriptorPool;
+  vkx::DescriptorPool drawDescriptorPool;
+  vkx::DescriptorPool cullDescriptorPool;
+  vkx::DescriptorPool reduceDescriptorPool;
 
   std::vector<VkDescriptorSet> descriptorSets;
   std::vector<VkDescriptorSet> samplerDescriptorSets;
   std::vector<VkDescriptorSet> inputDescriptorSets;
-
-  std::vector<VkBuffer> vpUniformBuffer;
-  std::vector<VkDeviceMemory> vpUniformBufferMemory;
+  std::vector<VkDescriptorSet> drawDescriptorSets;
+  std::vector<VkDescriptorSet> cullDescriptorSets;
+  std::vector<VkDescriptorSet> reduceDepthSets; // depth buffer -> level 0
+  std::vector<VkDescriptorSet> reduceLevelSets; // level n -> level n + 1
+
+  // Per frame view projection data and staging, rewound every frame
+  vkx::StagingRing stagingRing;
+  VkDeviceSize uniformAlignment;
+  uint32_t vpUniformOffset = 0; // dynamic offset of this frame's VP data
+  uint32_t cullUniformOffset = 0; // dynamic offset of this frame's CullData
+
+  // Transforms of all model instances, rewritten every frame. Bound as
+  // instance rate vertex buffer, the indirect path reads it as storage.
+  std::vector<VkBuffer> instanceBuffers;
+  std::vector<vkx::Allocation> instanceMemory;
 
   std::vector<VkBuffer> modelDUniformBuffer;
   std::vector<VkDeviceMemory> modelDUniformBufferMemory;
@@ -110,13 +202,61 @@ private:
   // - Assets
 
   std::vector<vkx::Image> textureImages;
-  std::vector<VkDeviceMemory> textureImageMemory;
-  std::vector<VkImageView> textureImageViews;
+  std::vector<vkx::Allocation> textureImageMemory;
+  std::vector<VkFormat> textureFormats;
+  std::vector<VkImageView> textureImageViews; // VK_NULL_HANDLE once evicted
+
+  // Loaded textures by descriptor location, materials naming the same file
+  // or a copy of it share one
+  struct TextureEntry {
+    uint64_t contentHash; // of the uploaded data, known once it is decoded
+    int imageLoc;
+    uint32_t references; // 0 once evicted
+    vkx::UploadTicket upload; // of the model that loaded it
+  };
+  std::vector<TextureEntry> textureEntries;
+  std::unordered_map<std::string, int> texturesByPath; // resolved paths
+  std::unordered_map<uint64_t, int> texturesByHash;
+  std::vector<int> freeTextureDescriptors; // sets of evicted textures
+
+  // With descriptor indexing all textures are elements of textureArraySet,
+  // bound once per frame. A texture id is then its element and every entry
+  // of samplerDescriptorSets is that one set.
+  bool bindlessSupported = false; // VK_EXT_descriptor_indexing
+  uint32_t textureArraySize = 0;
+  VkDescriptorSet textureArraySet = VK_NULL_HANDLE;
+  std::vector<std::vector<int>> modelTextures; // references of each model
 
   // - Pipeline
+  vkx::PipelineCache pipelineCache;
+  std::unique_ptr<PipelineCompiler> pipelineCompiler;
+  // Queued by createGraphicsPipeline() and createCullPipelines(), moved
+  // into the members below once waited for
+  struct {
+    std::shared_future<vkx::Pipeline> graphics;
+    std::shared_future<vkx::Pipeline> instanced;
+    std::shared_future<vkx::Pipeline> indirect;
+    std::shared_future<vkx::Pipeline> second;
+    std::shared_future<vkx::Pipeline> cull;
+    std::shared_future<vkx::Pipeline> reduce;
+  } pendingPipelines;
   vkx::Pipeline graphicsPipeline;
   vkx::PipelineLayout pipelineLayout;
 
+  // graphicsPipeline with transforms from the instance buffer instead of
+  // push constants
+  vkx::Pipeline instancedPipeline;
+  bool instancingSupported = false;
+
+  vkx::Pipeline indirectPipeline;
+  vkx::PipelineLayout indirectPipelineLayout;
+
+  vkx::Pipeline cullPipeline;
+  vkx::PipelineLayout cullPipelineLayout;
+
+  vkx::Pipeline reducePipeline;
+  vkx::PipelineLayout reducePipelineLayout;
+
   vkx::Pipeline secondPipeline;
   vkx::PipelineLayout secondPipelineLayout;
 
@@ -124,6 +264,86 @@ private:
 
   // - Pools
   VkCommandPool graphicsCommandPool;
+  VkCommandPool transferCommandPool;
+
+  // - Indirect drawing
+  // Commands are grouped by texture and index type, one indirect draw per
+  // group. Each frame in flight rebuilds its commands only when the drawable
+  // meshes changed (drawGeneration), there is one command per mesh and model
+  // instance.
+  struct IndirectBatch {
+    int texId;
+    VkIndexType indexType;
+    uint32_t firstCommand;
+    uint32_t commandCount;
+  };
+  struct IndirectFrame {
+    VkBuffer commandBuffer;
+    vkx::Allocation commandMemory;
+    VkBuffer culledCommandBuffer; // written by cull.comp, drawn from
+    vkx::Allocation culledCommandMemory;
+    VkBuffer countBuffer; // surviving draws per batch
+    vkx::Allocation countMemory;
+    VkBuffer countReadbackBuffer; // copy of the counts, for getCullStats
+    vkx::Allocation countReadbackMemory;
+    bool culled = false; // last submission of this frame ran cull.comp
+    VkBuffer drawBuffer;
+    vkx::Allocation drawMemory;
+    uint64_t generation = 0;
+    uint32_t drawCount = 0;
+    std::vector<IndirectBatch> batches;
+  };
+  std::vector<IndirectFrame> indirectFrames;
+  uint64_t drawGeneration = 1;
+  bool indirectSupported = false;
+  bool indirectDrawing = false;
+
+  // - Culling
+  // cull.comp tests every indirect draw against the view frustum and the
+  // depth pyramid of the previous frame before the render pass. Survivors
+  // are compacted per batch if draw counts can be read from a buffer,
+  // otherwise culled commands just get an instanceCount of 0.
+  bool cullingSupported = false;
+  bool occlusionSupported = false; // depth buffer can be sampled
+  bool drawCountSupported = false; // VK_KHR_draw_indirect_count
+  bool culling = false;
+  CullStats cullStats;
+  PFN_vkCmdDrawIndexedIndirectCountKHR cmdDrawIndexedIndirectCount = nullptr;
+
+  // Farthest depth of the last frame, each level halves the one below
+  vkx::Image depthPyramid;
+  vkx::Allocation depthPyramidMemory;
+  VkImageView depthPyramidView; // all levels, sampled by cull.comp
+  std::vector<VkImageView> depthPyramidLevelViews;
+  VkExtent2D depthPyramidExtent;
+  uint32_t depthPyramidLevels = 0;
+  VkSampler depthSampler;
+  bool depthPyramidValid = false;
+  glm::mat4 depthPyramidViewProjection; // camera the pyramid was built with
+
+  // - Multithreaded recording
+  // Without indirect drawing the mesh draws are split into jobs, each
+  // recorded into a secondary command buffer by a worker thread. Every
+  // worker has its own pool per primary command buffer, reset when the
+  // primary is re-recorded.
+  struct MeshDraw {
+    uint32_t model;
+    uint32_t mesh;
+  };
+  struct RecordingContext {
+    VkCommandPool commandPool;
+    std::vector<VkCommandBuffer> commandBuffers; // reused after a reset
+    size_t used = 0;
+  };
+  std::unique_ptr<ThreadPool> recordingThreads;
+  std::vector<std::vector<RecordingContext>> recordingContexts; // [slot][worker]
+  std::vector<MeshDraw> meshDraws;
+
+  // - Uploads still in flight, retired once their fence signals
+  std::vector<vkx::UploadTicket> pendingUploads;
+  // Textures that turned out to duplicate a loaded one, released once the
+  // upload that copies them is done
+  std::vector<std::pair<vkx::UploadTicket, int>> retiringTextures;
 
   // - Synchronisation
   std::vector<VkSemaphore> imageAvailable;
@@ -147,27 +367,52 @@ private:
   void createFramebuffers();
   void createCommandPool();
   void createCommandBuffers();
+  void createRecordingThreads();
   void createSynchronisation();
   void createTextureSampler();
 
   void createUniformBuffers();
+  void createInstanceBuffers();
   void createDescriptorPool();
   void createDescriptorSets();
   void createInputDescriptorSets();
+  void createIndirectBuffers();
+  void createCullPipelines();
+  // Wait for the queued pipelines, frame ones are needed by every frame,
+  // mesh ones only without indirect drawing
+  void resolveFramePipelines();
+  void resolveMeshPipelines();
+  void createDepthPyramid();
 
   void updateUniformBuffers(uint32_t imageIndex);
+  void updateInstances();
+  // Picks the level of detail of every mesh from its projected size
+  void selectLods();
+  // False if the scene doesn't fit the indirect buffers
+  bool updateIndirectDraws();
+  void updateCullData();
+  // Sums the counts this frame's last culling pass left, its fence must have
+  // signalled
+  void readCullStats();
+  void retireUploads();
 
   // - Record Functions
   void recordCommands(uint32_t currentImage);
+  void recordIndirectDraws(uint32_t currentImage);
+  void recordMeshDraws(VkCommandBuffer commandBuffer, uint32_t currentImage,
+		       size_t first, size_t last);
+  void recordMeshDrawsParallel(uint32_t currentImage);
+  void recordCulling(uint32_t currentImage);
+  void recordDepthReduce(uint32_t currentImage);
 
   // - Get Functions
   void getPhysicalDevice();
+  size_t getCommandSlot(uint32_t imageIndex);
 
   // - Allocate Functions
   void allocateDynamicBufferTransferSpace();
 
   // -- Getter Functions
-  QueueFamilyIndices getQueueFamilies(VkPhysicalDevice device);
   SwapChainDetails getSwapChainDetails(VkPhysicalDevice device);
 
   // -- Choose Functions
@@ -180,22 +425,57 @@ private:
   VkFormat chooseSupportedFormat(const std::vector<VkFormat> &formats,
 				 VkImageTiling tiling,
 				 VkFormatFeatureFlags featureFlags);
+  VertexFormat chooseVertexFormat(VertexFormat requested);
+  // Looks for a block compressed copy of a texture written by
+  // texture_encoder in a format the device can sample, false if there is
+  // none
+  bool chooseCompressedTexture(const std::string &fileName, std::string *path,
+			       Ktx2Info *info);
 
   // -- Create Functions
   vkx::Image createImage(uint32_t width, uint32_t height, VkFormat format,
 			 VkImageTiling tiling, VkImageUsageFlags useFlags,
 			 VkMemoryPropertyFlags propFlags,
-			 VkDeviceMemory *imageMemory);
+			 vkx::Allocation *imageMemory, uint32_t mipLevels = 1);
   VkImageView createImageView(VkImage image, VkFormat format,
-			      VkImageAspectFlags aspectFlags);
+			      VkImageAspectFlags aspectFlags,
+			      uint32_t mipLevels = 1);
   VkShaderModule createShaderModule(const std::vector<char> &code);
 
-  int createTextureImage(std::string fileName);
-  int createTexture(std::string fileName);
+  // The image and its staging memory are created right away, the file is
+  // decoded into the staging memory by a job on decoders. Wait for decoders
+  // before submitting uploads. The job also writes the hash of the staged
+  // data to contentHash, if given.
+  int createTextureImage(std::string fileName, vkx::UploadBatch &uploads,
+			 ThreadPool &decoders, uint64_t *contentHash = nullptr);
+  // Returns the descriptor location of the texture of fileName and takes a
+  // reference on it. A loaded texture with the same resolved path is shared,
+  // only a new one is created. created tells which happened, only a new
+  // texture is uploaded by this batch and gets its contentHash once decoders
+  // are done, see shareTextureContent.
+  int acquireTexture(std::string fileName, vkx::UploadBatch &uploads,
+		     ThreadPool &decoders, bool *created = nullptr,
+		     uint64_t *contentHash = nullptr);
+  // Registers the content of the new texture texId. If a loaded texture has
+  // the same, that one is returned and takes over the references, texId is
+  // kept until its upload is done. Returns texId otherwise.
+  int shareTextureContent(int texId, uint64_t contentHash);
+  // Destroys the texture with its last reference, the GPU must be done with
+  // it
+  void releaseTexture(int texId);
   int createTextureDescriptor(VkImageView textureImage);
 
   // -- Loader Functions
-  stbi_uc *loadTextureFile(std::string fileName, int *width, int *height,
-			   VkDeviceSize *imageSize);
+  // Only reads the file header
+  void loadTextureInfo(std::string fileName, int *width, int *height,
+		       VkDeviceSize *imageSize);
+  // Decodes to RGBA and fills pixels with mipLevels levels of it as
+  // GetMipChainSize lays them out, safe on any thread
+  static void decodeTextureFile(std::string fileName, int width, int height,
+				uint32_t mipLevels, void *pixels);
+  // 64 bit FNV-1a of data continuing hash, only compared between the
+  // textures of one run
+  static uint64_t hashTextureData(const void *data, size_t size,
+				  uint64_t hash = 14695981039346656037ull);
 };
 
@@ -4,7 +4,9 @@
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 
+#include <filesystem>
 #include <stdexcept>
+#include <string>
 #include <vector>
 #include <iostream>
 
@@ -12,12 +14,68 @@
 
 VulkanRenderer vulkanRenderer;
 
-int main() {
-  // Create Window
-  auto window = vkx::Window::Create(1366, 768, "vkapp");
+// Exit code of runs that can't say anything here, see SKIP_RETURN_CODE
+const int EXIT_SKIPPED = 77;
+
+// --frames <n>       exit after n frames instead of when the window closes
+// --model <file>     draw file instead of the skull
+// --require-culling  fail unless GPU culling runs and culls an instance placed
+//                    behind the camera, to check a device such as lavapipe
+// --compact          draw with CompactVertex, fails if the device can't read
+//                    it
+int main(int argc, char **argv) {
+  int frameLimit = -1;
+  std::string modelFile = "Models/12140_Skull_v3_L2.obj";
+  bool requireCulling = false;
+  auto vertexFormat = VertexFormat::Full;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--frames" && i + 1 < argc) {
+      frameLimit = std::stoi(argv[++i]);
+    } else if (arg == "--model" && i + 1 < argc) {
+      modelFile = argv[++i];
+    } else if (arg == "--require-culling") {
+      requireCulling = true;
+    } else if (arg == "--compact") {
+      vertexFormat = VertexFormat::Compact;
+    } else {
+      std::cout << "unknown argument: " << arg << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (!std::filesystem::exists(modelFile)) {
+    std::cout << "skipped: " << modelFile << " is missing" << std::endl;
+    return EXIT_SKIPPED;
+  }
+
+  // Create Window, without a display or a Vulkan driver there's nothing to
+  // run on
+  vkx::Window window;
+  try {
+    window = vkx::Window::Create(1366, 768, "vkapp");
+  } catch (const std::runtime_error &e) {
+    std::cout << "skipped: " << e.what() << std::endl;
+    return EXIT_SKIPPED;
+  }
+  if (!glfwVulkanSupported()) {
+    std::cout << "skipped: no Vulkan driver" << std::endl;
+    return EXIT_SKIPPED;
+  }
 
   // Create Vulkan Renderer instance
-  if (vulkanRenderer.init(window) == EXIT_FAILURE) {
+  if (vulkanRenderer.init(window, vertexFormat) == EXIT_FAILURE) {
+    return EXIT_FAILURE;
+  }
+
+  if (requireCulling && !vulkanRenderer.getCulling()) {
+    std::cout << "GPU culling is not available" << std::endl;
+    vulkanRenderer.cleanup();
+    return EXIT_FAILURE;
+  }
+  if (vertexFormat != vulkanRenderer.getVertexFormat()) {
+    std::cout << "Compact vertices are not available" << std::endl;
+    vulkanRenderer.cleanup();
     return EXIT_FAILURE;
   }
 
@@ -25,11 +83,32 @@ int main() {
   float deltaTime = 0.0f;
   float lastTime = 0.0f;
 
-  int helicopter =
-      vulkanRenderer.createMeshModel("Models/12140_Skull_v3_L2.obj");
+  int helicopter = vulkanRenderer.createMeshModel(modelFile);
+  if (requireCulling) {
+    // The camera looks down -z from z = 90, this copy is behind it
+    vulkanRenderer.createModelInstance(
+	helicopter,
+	glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, 200.0f)));
+  }
+
+  auto memoryStats = vulkanRenderer.getMemoryStats();
+  std::cout << "memory: " << memoryStats.blockCount << " blocks, "
+	    << memoryStats.allocationCount << " allocations, "
+	    << memoryStats.usedBytes << "/" << memoryStats.reservedBytes
+	    << " bytes used, fragmentation " << memoryStats.fragmentation
+	    << std::endl;
+
+  // Run twice to compare a cold pipeline cache with a warm one
+  auto startupTimings = vulkanRenderer.getStartupTimings();
+  std::cout << "startup: " << startupTimings.initMilliseconds << " ms, "
+	    << "pipelines " << startupTimings.pipelineMilliseconds << " ms ("
+	    << (startupTimings.pipelineCacheBytes > 0 ? "warm" : "cold")
+	    << " cache, " << startupTimings.pipelineCacheBytes << " bytes)"
+	    << std::endl;
 
   // Loop until closed
-  while (!glfwWindowShouldClose(window)) {
+  for (int frame = 0; frame != frameLimit && !glfwWindowShouldClose(window);
+       frame++) {
     glfwPollEvents();
 
     float now = glfwGetTime();
@@ -50,7 +129,18 @@ int main() {
     vulkanRenderer.draw();
   }
 
+  // Draws of the instance behind the camera must not survive
+  auto cullStats = vulkanRenderer.getCullStats();
   vulkanRenderer.cleanup();
+  if (requireCulling) {
+    std::cout << "culling: " << cullStats.visibleDraws << " of "
+	      << cullStats.testedDraws << " draws visible" << std::endl;
+    if (cullStats.testedDraws == 0 ||
+	cullStats.visibleDraws >= cullStats.testedDraws) {
+      std::cout << "GPU culling didn't cull anything" << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
 
   return 0;
 }
@@ -0,0 +1,91 @@
+// Offline encoder for the renderer's textures. Decodes an image, builds its
+// full mip chain and writes it block compressed to a KTX2 file:
+//
+//   texture_encoder bc7 Textures/panda.jpg Textures/panda.bc7.ktx2
+//   texture_encoder bc1 Textures/panda.jpg Textures/panda.bc1.ktx2
+//
+// The renderer looks for <name>.bc7.ktx2, <name>.astc.ktx2 and
+// <name>.bc1.ktx2 next to a texture and uses the first one the device can
+// sample. ASTC files come from other tools (e.g. toktx), any 4x4, 6x6 or
+// 8x8 ASTC KTX2 without supercompression is read.
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "Ktx2.h"
+#include "MipGeneration.h"
+#include "TextureCompression.h"
+
+int main(int argc, char **argv) {
+  if (argc != 4 ||
+      (strcmp(argv[1], "bc1") != 0 && strcmp(argv[1], "bc7") != 0)) {
+    std::cerr << "usage: texture_encoder <bc1|bc7> <input image> <output.ktx2>"
+	      << std::endl;
+    return EXIT_FAILURE;
+  }
+  bool bc7 = strcmp(argv[1], "bc7") == 0;
+
+  int width, height, channels;
+  stbi_uc *image =
+      stbi_load(argv[2], &width, &height, &channels, STBI_rgb_alpha);
+  if (!image) {
+    std::cerr << "Failed to load " << argv[2] << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (!bc7 && (channels == 2 || channels == 4)) {
+    std::cerr << "warning: bc1 drops the alpha channel of " << argv[2]
+	      << std::endl;
+  }
+
+  // Same chain the renderer builds for uncompressed textures
+  uint32_t mipLevels = GetMipLevelCount(width, height);
+  std::vector<uint8_t> previous(image, image + size_t(width) * height * 4);
+  stbi_image_free(image);
+
+  uint32_t blockSize = bc7 ? BC7_BLOCK_SIZE : BC1_BLOCK_SIZE;
+  std::vector<std::vector<uint8_t>> levels(mipLevels);
+  size_t uncompressedSize = 0;
+  for (uint32_t level = 0; level < mipLevels; level++) {
+    uint32_t levelWidth = GetMipWidth(width, level);
+    uint32_t levelHeight = GetMipHeight(height, level);
+    if (level > 0) {
+      std::vector<uint8_t> next(size_t(levelWidth) * levelHeight * 4);
+      DownsampleRgba8(previous.data(), GetMipWidth(width, level - 1),
+		      GetMipHeight(height, level - 1), next.data());
+      previous.swap(next);
+    }
+    uncompressedSize += previous.size();
+
+    auto &blocks = levels[level];
+    blocks.resize(GetCompressedSize(levelWidth, levelHeight, blockSize));
+    if (bc7) {
+      EncodeBc7(previous.data(), levelWidth, levelHeight, blocks.data());
+    } else {
+      EncodeBc1(previous.data(), levelWidth, levelHeight, blocks.data());
+    }
+  }
+
+  try {
+    WriteKtx2(argv[3],
+	      bc7 ? VK_FORMAT_BC7_UNORM_BLOCK : VK_FORMAT_BC1_RGB_UNORM_BLOCK,
+	      width, height, levels);
+  } catch (const std::runtime_error &e) {
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  size_t compressedSize = 0;
+  for (auto &level : levels) {
+    compressedSize += level.size();
+  }
+  std::cout << argv[3] << ": " << width << "x" << height << ", " << mipLevels
+	    << " levels, " << uncompressedSize << " -> " << compressedSize
+	    << " bytes" << std::endl;
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <vkx/raii.hpp>
+#include <vulkan/vulkan_core.h>
+
+#include <memory>
+#include <vector>
+
+namespace vkx {
+
+// A sub-range of a VkDeviceMemory block handed out by an Allocator.
+struct Allocation {
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+  VkDeviceSize offset = 0; // offset into memory, already aligned
+  VkDeviceSize size = 0;
+  void *mapped = nullptr; // host address of offset, if memory is host visible
+  uint32_t memoryType = 0;
+};
+
+struct AllocatorStats {
+  uint32_t blockCount = 0;     // VkDeviceMemory objects currently alive
+  uint32_t dedicatedCount = 0; // blocks holding a single large allocation
+  uint32_t allocationCount = 0;
+  VkDeviceSize reservedBytes = 0; // sum of all block sizes
+  VkDeviceSize usedBytes = 0;	  // bytes handed out, including padding
+  uint32_t freeRangeCount = 0;
+  VkDeviceSize largestFreeRange = 0;
+  // 0 when all free space is one contiguous range, approaching 1 as it is
+  // split into many small holes
+  float fragmentation = 0.0f;
+};
+
+// Sub-allocates buffers and images out of large per memory type blocks, so
+// the number of vkAllocateMemory calls stays far below
+// maxMemoryAllocationCount. Host visible blocks are mapped once for their
+// whole lifetime.
+class Allocator {
+  struct Impl;
+  std::shared_ptr<Impl> _impl;
+
+  Allocator(std::shared_ptr<Impl> impl) : _impl(impl) {}
+
+public:
+  static constexpr VkDeviceSize DefaultBlockSize = 64 * 1024 * 1024;
+
+  Allocator() = default;
+
+  static auto Create(VkPhysicalDevice physicalDevice, Device const &device,
+		     VkDeviceSize blockSize = DefaultBlockSize) -> Allocator;
+
+  // linear is true for buffers and linear images; optimal images are kept
+  // bufferImageGranularity apart from linear resources
+  auto Allocate(VkMemoryRequirements const &requirements,
+		VkMemoryPropertyFlags properties, bool linear) -> Allocation;
+  auto Free(Allocation const &allocation) -> void;
+
+  auto GetStats() const -> AllocatorStats;
+};
+
+inline auto CreateAllocator(VkPhysicalDevice physicalDevice,
+			    Device const &device,
+			    VkDeviceSize blockSize = Allocator::DefaultBlockSize)
+    -> Allocator {
+  return Allocator::Create(physicalDevice, device, blockSize);
+}
+
+// Creates a buffer and binds it to memory taken from allocator.
+auto CreateBuffer(Allocator &allocator, VkDevice device, VkDeviceSize size,
+		  VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
+		  VkBuffer *buffer) -> Allocation;
+// Same, but the buffer is shared concurrently if queueFamilies holds more
+// than one family.
+auto CreateBuffer(Allocator &allocator, VkDevice device, VkDeviceSize size,
+		  VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
+		  std::vector<uint32_t> const &queueFamilies, VkBuffer *buffer)
+    -> Allocation;
+
+// Creates memory for image and binds it.
+auto BindImageMemory(Allocator &allocator, VkDevice device, VkImage image,
+		     VkImageTiling tiling, VkMemoryPropertyFlags properties)
+    -> Allocation;
+
+} // namespace vkx
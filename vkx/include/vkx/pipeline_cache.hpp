@@ -0,0 +1,38 @@
+#pragma once
+
+#include <vkx/raii.hpp>
+#include <vulkan/vulkan_core.h>
+
+#include <string>
+
+namespace vkx {
+
+// VkPipelineCache backed by a file. The file is only used to seed the cache
+// if its header was written by the same vendor, device and driver
+// (pipelineCacheUUID), anything else starts an empty cache.
+class PipelineCache : public Resource<VkPipelineCache> {
+private:
+  using Resource::Resource;
+  Device _device;
+  std::string _path;
+  size_t _loadedSize = 0;
+
+public:
+  static auto Create(VkPhysicalDevice physicalDevice, Device const &device,
+		     std::string const &path) -> PipelineCache;
+
+  // Writes the cache to a temporary file and renames it over path, so an
+  // interrupted save never leaves a truncated cache behind
+  auto Save() const -> void;
+
+  // Bytes of cache data accepted from the file, 0 on a cold start
+  inline auto GetLoadedSize() const -> size_t { return _loadedSize; }
+};
+
+inline auto CreatePipelineCache(VkPhysicalDevice physicalDevice,
+				Device const &device, std::string const &path)
+    -> PipelineCache {
+  return PipelineCache::Create(physicalDevice, device, path);
+}
+
+} // namespace vkx
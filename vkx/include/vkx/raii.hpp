@@ -200,6 +200,9 @@ public:
   static auto Create(Device const &device, VkPipelineCache pipelineCache,
 		     const VkGraphicsPipelineCreateInfo *pCreateInfo,
 		     const VkAllocationCallbacks *pAllocator) -> Pipeline;
+  static auto Create(Device const &device, VkPipelineCache pipelineCache,
+		     const VkComputePipelineCreateInfo *pCreateInfo,
+		     const VkAllocationCallbacks *pAllocator) -> Pipeline;
 };
 
 inline auto CreatePipeline(Device const &device, VkPipelineCache pipelineCache,
@@ -209,6 +212,13 @@ inline auto CreatePipeline(Device const &device, VkPipelineCache pipelineCache,
   return Pipeline::Create(device, pipelineCache, pCreateInfo, pAllocator);
 }
 
+inline auto CreatePipeline(Device const &device, VkPipelineCache pipelineCache,
+			   const VkComputePipelineCreateInfo *pCreateInfo,
+			   const VkAllocationCallbacks *pAllocator)
+    -> Pipeline {
+  return Pipeline::Create(device, pipelineCache, pCreateInfo, pAllocator);
+}
+
 class Image : public Resource<VkImage> {
 private:
   using Resource::Resource;
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <vkx/memory.hpp>
+#include <vkx/raii.hpp>
+#include <vulkan/vulkan_core.h>
+
+#include <memory>
+
+namespace vkx {
+
+class UploadTicket;
+
+// One persistently mapped, host coherent buffer split into a region per frame
+// in flight. Each region is a linear allocator that is rewound by
+// BeginFrame(), so per frame uniform data and staging copies need neither
+// map/unmap nor buffer creation.
+class StagingRing {
+  struct Impl;
+  std::shared_ptr<Impl> _impl;
+
+  StagingRing(std::shared_ptr<Impl> impl) : _impl(impl) {}
+
+public:
+  static constexpr VkDeviceSize DefaultFrameSize = 8 * 1024 * 1024;
+
+  struct Range {
+    VkBuffer buffer = VK_NULL_HANDLE; // VK_NULL_HANDLE if the region is full
+    VkDeviceSize offset = 0;
+    void *mapped = nullptr;
+  };
+
+  StagingRing() = default;
+
+  static auto Create(Device const &device, Allocator const &allocator,
+		     uint32_t frameCount,
+		     VkDeviceSize frameSize = DefaultFrameSize) -> StagingRing;
+
+  // Rewinds the region of frameIndex and makes it current. The fence of the
+  // frame that used the region last must already have signalled; uploads
+  // retained in the region are waited for here.
+  auto BeginFrame(uint32_t frameIndex) -> void;
+
+  // Sub-range of the current region, usable as transfer source and as
+  // (dynamic) uniform buffer
+  auto Allocate(VkDeviceSize size, VkDeviceSize alignment) -> Range;
+
+  // Keeps the current region from being rewound until ticket completed, for
+  // copies that do not run on the frame's queue
+  auto Retain(UploadTicket const &ticket) -> void;
+
+  auto GetBuffer() const -> VkBuffer;
+  auto GetFrameSize() const -> VkDeviceSize;
+
+  explicit operator bool() const { return _impl != nullptr; }
+};
+
+inline auto CreateStagingRing(Device const &device, Allocator const &allocator,
+			      uint32_t frameCount,
+			      VkDeviceSize frameSize = StagingRing::DefaultFrameSize)
+    -> StagingRing {
+  return StagingRing::Create(device, allocator, frameCount, frameSize);
+}
+
+} // namespace vkx
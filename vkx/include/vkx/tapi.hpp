@@ -29,8 +29,8 @@ auto MakePipelineDepthStencilStateCreateInfo()
     -> VkPipelineDepthStencilStateCreateInfo;
 
 auto MakeImageCreateInfo(VkExtent3D extent, VkFormat format,
-			 VkImageTiling tiling, VkImageUsageFlags useFlags)
-    -> VkImageCreateInfo;
+			 VkImageTiling tiling, VkImageUsageFlags useFlags,
+			 uint32_t mipLevels = 1) -> VkImageCreateInfo;
 
 } // namespace helper
 
@@ -47,11 +47,26 @@ auto CreateDebugReportCallback(Instance instance,
 
 auto CreateDevice(VkPhysicalDevice physicalDevice, int graphicQueueIndex,
 		  int presentationQueueIndex) -> Device;
+auto CreateDevice(VkPhysicalDevice physicalDevice, int graphicQueueIndex,
+		  int presentationQueueIndex, int transferQueueIndex) -> Device;
+auto CreateDevice(VkPhysicalDevice physicalDevice, int graphicQueueIndex,
+		  int presentationQueueIndex, int transferQueueIndex,
+		  VkPhysicalDeviceFeatures const &enabledFeatures) -> Device;
+// extensions are enabled on top of GetRequiredDeviceExtension(), pNext chains
+// extension feature structures
+auto CreateDevice(VkPhysicalDevice physicalDevice, int graphicQueueIndex,
+		  int presentationQueueIndex, int transferQueueIndex,
+		  VkPhysicalDeviceFeatures const &enabledFeatures,
+		  std::vector<std::string> const &extensions,
+		  void const *pNext = nullptr) -> Device;
 
 auto CreateSwapchain(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface,
 		     Device device, VkExtent2D prefered) -> Swapchain;
 
-auto CreateRenderPass(Device const &device, VkFormat const &swapchainFormat)
+// depthStoreOp has to be STORE if the depth buffer is read after the pass
+auto CreateRenderPass(
+    Device const &device, VkFormat const &swapchainFormat,
+    VkAttachmentStoreOp depthStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE)
     -> RenderPass;
 
 auto CreateImageView(Device const &device, VkImage image, VkFormat format,
@@ -89,6 +104,13 @@ inline auto MakeVertexDescriptorSetLayoutBinding(
   return {binding, descriptorType, descriptorCount, VK_SHADER_STAGE_VERTEX_BIT};
 }
 
+inline auto MakeComputeDescriptorSetLayoutBinding(
+    uint32_t binding, VkDescriptorType descriptorType,
+    uint32_t descriptorCount = 1) -> VkDescriptorSetLayoutBinding {
+  return {binding, descriptorType, descriptorCount,
+	  VK_SHADER_STAGE_COMPUTE_BIT};
+}
+
 auto MakeDescriptorPoolSize(VkDescriptorType type, uint32_t count)
     -> VkDescriptorPoolSize;
 
@@ -173,6 +195,10 @@ auto MakePipelineColorBlendStateCreateInfo(
 auto ChooseGraphicsQueueIndex(VkPhysicalDevice device) -> int32_t;
 auto ChoosePresentQueueIndex(VkPhysicalDevice device, VkSurfaceKHR surface)
     -> int32_t;
+// Prefers a transfer only family (typically a DMA engine), then any family
+// without graphics. Returns -1 if transfers have to share the graphics
+// family.
+auto ChooseTransferQueueIndex(VkPhysicalDevice device) -> int32_t;
 
 auto ChooseSurfaceFormat(std::vector<VkSurfaceFormatKHR> const &formats)
     -> VkSurfaceFormatKHR;
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <vkx/memory.hpp>
+#include <vkx/raii.hpp>
+#include <vkx/staging.hpp>
+#include <vulkan/vulkan_core.h>
+
+#include <memory>
+#include <vector>
+
+namespace vkx {
+
+// Handle to a submitted UploadBatch. Staging memory and the command buffers
+// are released once the GPU is done with them, either when IsComplete()
+// first observes the fences or when the last ticket copy goes away.
+// Uploaded resources may only be used by work submitted after IsComplete()
+// returned true.
+class UploadTicket {
+public:
+  struct State;
+
+  UploadTicket() = default;
+  UploadTicket(std::shared_ptr<State> state) : _state(state) {}
+
+  auto IsComplete() const -> bool;
+  auto Wait() const -> void;
+
+private:
+  std::shared_ptr<State> _state;
+};
+
+// Records many staging copies and layout transitions into one command
+// buffer and submits them with a single fence, instead of a
+// vkQueueWaitIdle round trip per copy.
+class UploadBatch {
+public:
+  static auto Create(Device const &device, Allocator const &allocator,
+		     VkQueue queue, VkCommandPool commandPool) -> UploadBatch;
+  // Copies run on transferQueue and the resources are handed over to
+  // dstFamily with release/acquire barriers. The acquire is submitted to
+  // dstQueue only after the copies finished, so rendering on dstQueue is
+  // never blocked by an upload. Same as above if both families are equal.
+  static auto Create(Device const &device, Allocator const &allocator,
+		     VkQueue transferQueue, VkCommandPool transferPool,
+		     uint32_t transferFamily, VkQueue dstQueue,
+		     VkCommandPool dstPool, uint32_t dstFamily) -> UploadBatch;
+
+  // Stage through ring instead of creating a staging buffer per copy. Copies
+  // that don't fit into the ring's current region still get their own. Only
+  // for batches on the family the ring is used by that are waited for right
+  // away, the region can't be rewound before the batch completed.
+  auto UseStagingRing(StagingRing const &ring) -> void;
+
+  // data is copied into staging memory immediately. Concurrently shared
+  // buffers need no ownership transfer, the semaphore orders the copy.
+  auto CopyToBuffer(void const *data, VkDeviceSize size, VkBuffer dst,
+		    VkDeviceSize dstOffset = 0,
+		    VkSharingMode sharingMode = VK_SHARING_MODE_EXCLUSIVE)
+      -> void;
+  // image ends up in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+  auto CopyToImage(void const *data, VkDeviceSize size, VkImage dst,
+		   uint32_t width, uint32_t height) -> void;
+  // Same, but returns the staging memory instead of copying into it. The
+  // caller fills all size bytes, from any thread, before Submit().
+  auto StageImage(VkDeviceSize size, VkImage dst, uint32_t width,
+		  uint32_t height) -> void *;
+
+  // Where one mip level lives in the staged data
+  struct ImageLevel {
+    VkDeviceSize offset;
+    uint32_t width;
+    uint32_t height;
+  };
+  // Same for a whole mip chain, levels[i] is copied to mip level i and all
+  // of them end up in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+  auto StageImage(VkDeviceSize size, VkImage dst,
+		  std::vector<ImageLevel> const &levels) -> void *;
+
+  auto IsEmpty() const -> bool;
+
+  // Drops everything added since the last Submit() and frees its staging
+  // buffers, e.g. after filling the batch failed half way
+  auto Discard() -> void;
+
+  // Records and submits everything added so far. The batch can be reused
+  // afterwards.
+  auto Submit() -> UploadTicket;
+
+private:
+  struct BufferCopy {
+    VkBuffer src;
+    VkBuffer dst;
+    VkBufferCopy region;
+    bool exclusive;
+  };
+
+  struct ImageCopy {
+    VkBuffer src;
+    VkImage dst;
+    std::vector<VkBufferImageCopy> regions; // one per mip level
+  };
+
+  struct Staging {
+    VkBuffer buffer;
+    Allocation memory;
+  };
+
+  Device _device;
+  Allocator _allocator;
+  StagingRing _ring;
+  bool _ringUsed = false;
+  VkQueue _queue = VK_NULL_HANDLE;
+  VkCommandPool _commandPool = VK_NULL_HANDLE;
+
+  // Set only when ownership has to move to another queue family
+  VkQueue _dstQueue = VK_NULL_HANDLE;
+  VkCommandPool _dstCommandPool = VK_NULL_HANDLE;
+  uint32_t _srcFamily = VK_QUEUE_FAMILY_IGNORED;
+  uint32_t _dstFamily = VK_QUEUE_FAMILY_IGNORED;
+
+  std::vector<BufferCopy> _bufferCopies;
+  std::vector<ImageCopy> _imageCopies;
+  std::vector<Staging> _staging;
+
+  // data may be null, the range is left for the caller to fill then
+  auto Stage(void const *data, VkDeviceSize size) -> StagingRing::Range;
+  auto RecordTransfer(VkCommandBuffer commandBuffer) const -> void;
+  auto RecordAcquire(VkCommandBuffer commandBuffer) const -> void;
+  auto MakeOwnershipBarriers(VkAccessFlags srcAccess,
+			     VkAccessFlags dstAccess) const
+      -> std::vector<VkBufferMemoryBarrier>;
+  // barriers keep their image and subresource range
+  auto MakeOwnershipBarriers(VkAccessFlags srcAccess, VkAccessFlags dstAccess,
+			     std::vector<VkImageMemoryBarrier> barriers) const
+      -> std::vector<VkImageMemoryBarrier>;
+
+  friend struct UploadTicket::State;
+};
+
+inline auto CreateUploadBatch(Device const &device, Allocator const &allocator,
+			      VkQueue queue, VkCommandPool commandPool)
+    -> UploadBatch {
+  return UploadBatch::Create(device, allocator, queue, commandPool);
+}
+
+inline auto CreateUploadBatch(Device const &device, Allocator const &allocator,
+			      VkQueue transferQueue, VkCommandPool transferPool,
+			      uint32_t transferFamily, VkQueue dstQueue,
+			      VkCommandPool dstPool, uint32_t dstFamily)
+    -> UploadBatch {
+  return UploadBatch::Create(device, allocator, transferQueue, transferPool,
+			     transferFamily, dstQueue, dstPool, dstFamily);
+}
+
+} // namespace vkx
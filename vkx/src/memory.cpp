@@ -0,0 +1,370 @@
+#include "vkx/memory.hpp"
+
+#include <vulkan/vulkan_core.h>
+
+#include <algorithm>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+namespace vkx {
+
+namespace details {
+
+inline auto AlignUp(VkDeviceSize value, VkDeviceSize alignment)
+    -> VkDeviceSize {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+// Whether the last byte of one resource and the first byte of the next one
+// share a bufferImageGranularity "page".
+inline auto OnSamePage(VkDeviceSize lastByte, VkDeviceSize nextOffset,
+		       VkDeviceSize pageSize) -> bool {
+  return lastByte / pageSize == nextOffset / pageSize;
+}
+
+struct Chunk {
+  VkDeviceSize offset;
+  VkDeviceSize size;
+  bool free;
+  bool linear;
+};
+
+struct Block {
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+  VkDeviceSize size = 0;
+  void *mapped = nullptr;
+  bool dedicated = false;
+  // sorted by offset, covers [0, size) without gaps, neighbouring free chunks
+  // are always merged
+  std::vector<Chunk> chunks;
+};
+
+} // namespace details
+
+struct Allocator::Impl {
+  Device device;
+  VkPhysicalDeviceMemoryProperties memoryProperties;
+  VkDeviceSize bufferImageGranularity;
+  uint32_t maxAllocationCount;
+  VkDeviceSize blockSize;
+
+  std::mutex mutex;
+  std::vector<std::vector<details::Block>> blocks; // per memory type
+
+  ~Impl() {
+    for (auto &typeBlocks : blocks) {
+      for (auto &block : typeBlocks) {
+	vkFreeMemory(device, block.memory, nullptr);
+      }
+    }
+  }
+
+  auto FindMemoryType(uint32_t allowedTypes, VkMemoryPropertyFlags properties)
+      -> uint32_t {
+    for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+      if ((allowedTypes & (1u << i)) &&
+	  (memoryProperties.memoryTypes[i].propertyFlags & properties) ==
+	      properties) {
+	return i;
+      }
+    }
+    throw std::runtime_error("Failed to find a suitable memory type!");
+  }
+
+  auto CountBlocks() const -> uint32_t {
+    uint32_t count = 0;
+    for (auto const &typeBlocks : blocks) {
+      count += static_cast<uint32_t>(typeBlocks.size());
+    }
+    return count;
+  }
+
+  auto NewBlock(uint32_t memoryType, VkDeviceSize size, bool dedicated)
+      -> details::Block & {
+    if (CountBlocks() >= maxAllocationCount) {
+      throw std::runtime_error("Exceeded maxMemoryAllocationCount!");
+    }
+
+    VkMemoryAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.memoryTypeIndex = memoryType;
+
+    // Fall back to smaller blocks while the heap is nearly exhausted
+    auto minimum = size;
+    auto requested = dedicated ? size : std::max(size, blockSize);
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkResult result = VK_ERROR_OUT_OF_DEVICE_MEMORY;
+    while (requested >= minimum) {
+      allocInfo.allocationSize = requested;
+      result = vkAllocateMemory(device, &allocInfo, nullptr, &memory);
+      if (result == VK_SUCCESS || requested / 2 < minimum) {
+	break;
+      }
+      requested /= 2;
+    }
+    if (result != VK_SUCCESS) {
+      throw std::runtime_error("Failed to allocate a memory block!");
+    }
+
+    details::Block block;
+    block.memory = memory;
+    block.size = requested;
+    block.dedicated = dedicated;
+    block.chunks.push_back({0, requested, true, true});
+
+    if (memoryProperties.memoryTypes[memoryType].propertyFlags &
+	VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+      if (vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, &block.mapped) !=
+	  VK_SUCCESS) {
+	vkFreeMemory(device, memory, nullptr);
+	throw std::runtime_error("Failed to map a memory block!");
+      }
+    }
+
+    blocks[memoryType].push_back(std::move(block));
+    return blocks[memoryType].back();
+  }
+
+  // First fit inside one block, honouring alignment and keeping linear and
+  // optimal resources on distinct bufferImageGranularity pages.
+  auto TryAllocate(details::Block &block, VkMemoryRequirements const &req,
+		   bool linear, Allocation *allocation) -> bool {
+    auto &chunks = block.chunks;
+    for (size_t i = 0; i < chunks.size(); i++) {
+      auto const &chunk = chunks[i];
+      if (!chunk.free || chunk.size < req.size) {
+	continue;
+      }
+
+      auto offset = details::AlignUp(chunk.offset, req.alignment);
+      if (i > 0) {
+	auto const &prev = chunks[i - 1];
+	if (prev.linear != linear &&
+	    details::OnSamePage(prev.offset + prev.size - 1, offset,
+				bufferImageGranularity)) {
+	  offset = details::AlignUp(offset, bufferImageGranularity);
+	}
+      }
+
+      auto end = offset + req.size;
+      if (end > chunk.offset + chunk.size) {
+	continue;
+      }
+      if (i + 1 < chunks.size()) {
+	auto const &next = chunks[i + 1];
+	if (next.linear != linear &&
+	    details::OnSamePage(end - 1, next.offset, bufferImageGranularity)) {
+	  continue;
+	}
+      }
+
+      // Split the free chunk into [padding][allocation][remainder]
+      auto chunkEnd = chunk.offset + chunk.size;
+      auto padding = offset - chunk.offset;
+      std::vector<details::Chunk> replacement;
+      if (padding > 0) {
+	replacement.push_back({chunk.offset, padding, true, true});
+      }
+      replacement.push_back({offset, req.size, false, linear});
+      if (chunkEnd > end) {
+	replacement.push_back({end, chunkEnd - end, true, true});
+      }
+      chunks.erase(chunks.begin() + i);
+      chunks.insert(chunks.begin() + i, replacement.begin(), replacement.end());
+
+      allocation->memory = block.memory;
+      allocation->offset = offset;
+      allocation->size = req.size;
+      allocation->mapped =
+	  block.mapped ? static_cast<char *>(block.mapped) + offset : nullptr;
+      return true;
+    }
+    return false;
+  }
+};
+
+auto Allocator::Create(VkPhysicalDevice physicalDevice, Device const &device,
+		       VkDeviceSize blockSize) -> Allocator {
+  auto impl = std::make_shared<Impl>();
+  impl->device = device;
+  impl->blockSize = blockSize;
+
+  vkGetPhysicalDeviceMemoryProperties(physicalDevice, &impl->memoryProperties);
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+  impl->bufferImageGranularity =
+      std::max<VkDeviceSize>(properties.limits.bufferImageGranularity, 1);
+  impl->maxAllocationCount = properties.limits.maxMemoryAllocationCount;
+
+  impl->blocks.resize(impl->memoryProperties.memoryTypeCount);
+
+  return Allocator(impl);
+}
+
+auto Allocator::Allocate(VkMemoryRequirements const &requirements,
+			 VkMemoryPropertyFlags properties, bool linear)
+    -> Allocation {
+  std::lock_guard<std::mutex> lock(_impl->mutex);
+
+  Allocation allocation;
+  allocation.memoryType =
+      _impl->FindMemoryType(requirements.memoryTypeBits, properties);
+
+  // Large resources get a block of their own instead of wasting half a block
+  if (requirements.size > _impl->blockSize / 2) {
+    auto &block =
+	_impl->NewBlock(allocation.memoryType, requirements.size, true);
+    _impl->TryAllocate(block, requirements, linear, &allocation);
+    return allocation;
+  }
+
+  for (auto &block : _impl->blocks[allocation.memoryType]) {
+    if (!block.dedicated &&
+	_impl->TryAllocate(block, requirements, linear, &allocation)) {
+      return allocation;
+    }
+  }
+
+  auto &block =
+      _impl->NewBlock(allocation.memoryType, requirements.size, false);
+  if (!_impl->TryAllocate(block, requirements, linear, &allocation)) {
+    throw std::runtime_error("Failed to sub-allocate memory!");
+  }
+  return allocation;
+}
+
+auto Allocator::Free(Allocation const &allocation) -> void {
+  if (allocation.memory == VK_NULL_HANDLE) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(_impl->mutex);
+
+  auto &typeBlocks = _impl->blocks[allocation.memoryType];
+  auto block = std::find_if(typeBlocks.begin(), typeBlocks.end(),
+			    [&allocation](details::Block const &b) {
+			      return b.memory == allocation.memory;
+			    });
+  if (block == typeBlocks.end()) {
+    throw std::runtime_error("Freeing memory not owned by this allocator!");
+  }
+
+  auto &chunks = block->chunks;
+  auto chunk = std::find_if(chunks.begin(), chunks.end(),
+			    [&allocation](details::Chunk const &c) {
+			      return c.offset == allocation.offset && !c.free;
+			    });
+  if (chunk == chunks.end()) {
+    throw std::runtime_error("Freeing an unknown allocation!");
+  }
+
+  chunk->free = true;
+  chunk->linear = true;
+
+  // Coalesce with the next and previous free neighbours
+  auto index = chunk - chunks.begin();
+  if (index + 1 < static_cast<long>(chunks.size()) && chunks[index + 1].free) {
+    chunks[index].size += chunks[index + 1].size;
+    chunks.erase(chunks.begin() + index + 1);
+  }
+  if (index > 0 && chunks[index - 1].free) {
+    chunks[index - 1].size += chunks[index].size;
+    chunks.erase(chunks.begin() + index);
+  }
+
+  // Keep one empty block per memory type around to avoid allocation churn
+  auto empty = [](details::Block const &b) {
+    return b.chunks.size() == 1 && b.chunks[0].free;
+  };
+  if (empty(*block)) {
+    auto emptyBlocks = std::count_if(typeBlocks.begin(), typeBlocks.end(),
+				     [&empty](details::Block const &b) {
+				       return !b.dedicated && empty(b);
+				     });
+    if (block->dedicated || emptyBlocks > 1) {
+      vkFreeMemory(_impl->device, block->memory, nullptr);
+      typeBlocks.erase(block);
+    }
+  }
+}
+
+auto Allocator::GetStats() const -> AllocatorStats {
+  std::lock_guard<std::mutex> lock(_impl->mutex);
+
+  AllocatorStats stats;
+  VkDeviceSize freeBytes = 0;
+  for (auto const &typeBlocks : _impl->blocks) {
+    for (auto const &block : typeBlocks) {
+      stats.blockCount++;
+      stats.dedicatedCount += block.dedicated ? 1 : 0;
+      stats.reservedBytes += block.size;
+      for (auto const &chunk : block.chunks) {
+	if (chunk.free) {
+	  stats.freeRangeCount++;
+	  stats.largestFreeRange = std::max(stats.largestFreeRange, chunk.size);
+	  freeBytes += chunk.size;
+	} else {
+	  stats.allocationCount++;
+	}
+      }
+    }
+  }
+  stats.usedBytes = stats.reservedBytes - freeBytes;
+  if (freeBytes > 0) {
+    stats.fragmentation =
+	1.0f - static_cast<float>(stats.largestFreeRange) / freeBytes;
+  }
+  return stats;
+}
+
+auto CreateBuffer(Allocator &allocator, VkDevice device, VkDeviceSize size,
+		  VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
+		  VkBuffer *buffer) -> Allocation {
+  return CreateBuffer(allocator, device, size, usage, properties, {}, buffer);
+}
+
+auto CreateBuffer(Allocator &allocator, VkDevice device, VkDeviceSize size,
+		  VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
+		  std::vector<uint32_t> const &queueFamilies, VkBuffer *buffer)
+    -> Allocation {
+  VkBufferCreateInfo bufferInfo = {};
+  bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  bufferInfo.size = size;
+  bufferInfo.usage = usage;
+  bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  if (queueFamilies.size() > 1) {
+    bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+    bufferInfo.queueFamilyIndexCount =
+	static_cast<uint32_t>(queueFamilies.size());
+    bufferInfo.pQueueFamilyIndices = queueFamilies.data();
+  }
+
+  if (vkCreateBuffer(device, &bufferInfo, nullptr, buffer) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create a Buffer!");
+  }
+
+  VkMemoryRequirements requirements;
+  vkGetBufferMemoryRequirements(device, *buffer, &requirements);
+
+  auto allocation = allocator.Allocate(requirements, properties, true);
+  vkBindBufferMemory(device, *buffer, allocation.memory, allocation.offset);
+
+  return allocation;
+}
+
+auto BindImageMemory(Allocator &allocator, VkDevice device, VkImage image,
+		     VkImageTiling tiling, VkMemoryPropertyFlags properties)
+    -> Allocation {
+  VkMemoryRequirements requirements;
+  vkGetImageMemoryRequirements(device, image, &requirements);
+
+  auto allocation = allocator.Allocate(requirements, properties,
+				       tiling == VK_IMAGE_TILING_LINEAR);
+  vkBindImageMemory(device, image, allocation.memory, allocation.offset);
+
+  return allocation;
+}
+
+} // namespace vkx
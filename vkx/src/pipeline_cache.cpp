@@ -0,0 +1,121 @@
+#include "vkx/pipeline_cache.hpp"
+
+#include <vulkan/vulkan_core.h>
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+namespace vkx {
+
+namespace {
+
+// Layout of VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+constexpr size_t CacheHeaderSize = 16 + VK_UUID_SIZE;
+
+auto ReadCacheFile(std::string const &path) -> std::vector<char> {
+  std::ifstream file(path, std::ios::binary | std::ios::ate);
+  if (!file.is_open()) {
+    return {};
+  }
+
+  auto size = static_cast<size_t>(file.tellg());
+  std::vector<char> data(size);
+  file.seekg(0);
+  if (!file.read(data.data(), size)) {
+    return {};
+  }
+  return data;
+}
+
+auto IsCompatible(std::vector<char> const &data,
+		  VkPhysicalDeviceProperties const &properties) -> bool {
+  if (data.size() < CacheHeaderSize) {
+    return false;
+  }
+
+  uint32_t header[4];
+  memcpy(header, data.data(), sizeof(header));
+  auto headerSize = header[0];
+  auto headerVersion = header[1];
+  auto vendorID = header[2];
+  auto deviceID = header[3];
+
+  return headerSize >= CacheHeaderSize && headerSize <= data.size() &&
+	 headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+	 vendorID == properties.vendorID && deviceID == properties.deviceID &&
+	 memcmp(data.data() + sizeof(header), properties.pipelineCacheUUID,
+		VK_UUID_SIZE) == 0;
+}
+
+} // namespace
+
+auto PipelineCache::Create(VkPhysicalDevice physicalDevice,
+			   Device const &device, std::string const &path)
+    -> PipelineCache {
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+  // A stale or foreign cache is dropped rather than handed to the driver
+  auto data = ReadCacheFile(path);
+  if (!IsCompatible(data, properties)) {
+    data.clear();
+  }
+
+  VkPipelineCacheCreateInfo createInfo = {};
+  createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+  createInfo.initialDataSize = data.size();
+  createInfo.pInitialData = data.empty() ? nullptr : data.data();
+
+  auto cache = std::shared_ptr<VkPipelineCache>(
+      new VkPipelineCache(VK_NULL_HANDLE), [device](VkPipelineCache *pCache) {
+	vkDestroyPipelineCache(device, *pCache, nullptr);
+	delete pCache;
+      });
+
+  auto result =
+      vkCreatePipelineCache(device, &createInfo, nullptr, cache.get());
+  if (result != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create a Pipeline Cache!");
+  }
+
+  auto pipelineCache = PipelineCache(cache);
+  pipelineCache._device = device;
+  pipelineCache._path = path;
+  pipelineCache._loadedSize = data.size();
+  return pipelineCache;
+}
+
+auto PipelineCache::Save() const -> void {
+  VkPipelineCache cache = *this;
+
+  size_t size = 0;
+  auto result = vkGetPipelineCacheData(_device, cache, &size, nullptr);
+  if (result != VK_SUCCESS) {
+    throw std::runtime_error("Failed to get Pipeline Cache data!");
+  }
+  std::vector<char> data(size);
+  result = vkGetPipelineCacheData(_device, cache, &size, data.data());
+  if (result != VK_SUCCESS) {
+    throw std::runtime_error("Failed to get Pipeline Cache data!");
+  }
+
+  auto tempPath = _path + ".tmp";
+  {
+    std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+    if (!file.is_open() || !file.write(data.data(), size) || !file.flush()) {
+      throw std::runtime_error("Failed to write Pipeline Cache file!");
+    }
+  }
+
+  std::error_code error;
+  std::filesystem::rename(tempPath, _path, error);
+  if (error) {
+    std::filesystem::remove(tempPath, error);
+    throw std::runtime_error("Failed to replace Pipeline Cache file!");
+  }
+}
+
+} // namespace vkx
@@ -342,6 +342,26 @@ auto Pipeline::Create(Device const &device, VkPipelineCache pipelineCache,
   return Pipeline(pipeline);
 }
 
+auto Pipeline::Create(Device const &device, VkPipelineCache pipelineCache,
+		      const VkComputePipelineCreateInfo *pCreateInfo,
+		      const VkAllocationCallbacks *pAllocator) -> Pipeline {
+
+  auto pipeline = std::shared_ptr<VkPipeline>(
+      new VkPipeline(VK_NULL_HANDLE),
+      [device, pAllocator](VkPipeline *pPipeline) {
+	vkDestroyPipeline(device, *pPipeline, pAllocator);
+	delete pPipeline;
+      });
+
+  auto result = vkCreateComputePipelines(device, pipelineCache, 1, pCreateInfo,
+					 pAllocator, pipeline.get());
+  if (result != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create a Compute Pipeline!");
+  }
+
+  return Pipeline(pipeline);
+}
+
 auto Image::Create(Device const &device, const VkImageCreateInfo *pCreateInfo,
 		   const VkAllocationCallbacks *pAllocator) -> Image {
 
@@ -0,0 +1,101 @@
+#include "vkx/staging.hpp"
+#include "vkx/upload.hpp"
+
+#include <vulkan/vulkan_core.h>
+
+#include <stdexcept>
+#include <vector>
+
+namespace vkx {
+
+struct StagingRing::Impl {
+  Device device;
+  Allocator allocator;
+  VkBuffer buffer = VK_NULL_HANDLE;
+  Allocation memory;
+  VkDeviceSize frameSize = 0;
+
+  struct Region {
+    VkDeviceSize head = 0;
+    std::vector<UploadTicket> retained;
+  };
+  std::vector<Region> regions;
+  uint32_t current = 0;
+
+  ~Impl() {
+    for (auto &region : regions) {
+      for (auto &ticket : region.retained) {
+	ticket.Wait();
+      }
+    }
+    vkDestroyBuffer(device, buffer, nullptr);
+    allocator.Free(memory);
+  }
+};
+
+auto StagingRing::Create(Device const &device, Allocator const &allocator,
+			 uint32_t frameCount, VkDeviceSize frameSize)
+    -> StagingRing {
+  if (frameCount == 0) {
+    throw std::runtime_error("Staging ring needs at least one frame!");
+  }
+
+  auto impl = std::make_shared<Impl>();
+  impl->device = device;
+  impl->allocator = allocator;
+  impl->frameSize = frameSize;
+  impl->regions.resize(frameCount);
+  impl->memory =
+      CreateBuffer(impl->allocator, device, frameSize * frameCount,
+		   VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+		       VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+		   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+		       VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		   &impl->buffer);
+  return StagingRing(impl);
+}
+
+auto StagingRing::BeginFrame(uint32_t frameIndex) -> void {
+  auto &region = _impl->regions.at(frameIndex);
+  for (auto &ticket : region.retained) {
+    ticket.Wait();
+  }
+  region.retained.clear();
+  region.head = 0;
+  _impl->current = frameIndex;
+}
+
+auto StagingRing::Allocate(VkDeviceSize size, VkDeviceSize alignment)
+    -> Range {
+  auto &region = _impl->regions[_impl->current];
+  auto base = _impl->frameSize * _impl->current;
+
+  // Offsets are aligned relative to the buffer, which starts aligned to
+  // anything a buffer can require
+  auto offset = base + region.head;
+  if (alignment > 1) {
+    offset = (offset + alignment - 1) / alignment * alignment;
+  }
+  if (offset + size > base + _impl->frameSize) {
+    return Range();
+  }
+  region.head = offset + size - base;
+
+  Range range;
+  range.buffer = _impl->buffer;
+  range.offset = offset;
+  range.mapped = static_cast<char *>(_impl->memory.mapped) + offset;
+  return range;
+}
+
+auto StagingRing::Retain(UploadTicket const &ticket) -> void {
+  _impl->regions[_impl->current].retained.push_back(ticket);
+}
+
+auto StagingRing::GetBuffer() const -> VkBuffer { return _impl->buffer; }
+
+auto StagingRing::GetFrameSize() const -> VkDeviceSize {
+  return _impl->frameSize;
+}
+
+} // namespace vkx
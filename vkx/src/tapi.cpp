@@ -89,14 +89,14 @@ auto MakePipelineColorBlendStateCreateInfo(
 }
 
 auto MakeImageCreateInfo(VkExtent3D extent, VkFormat format,
-			 VkImageTiling tiling, VkImageUsageFlags useFlags)
-    -> VkImageCreateInfo {
+			 VkImageTiling tiling, VkImageUsageFlags useFlags,
+			 uint32_t mipLevels) -> VkImageCreateInfo {
 
   VkImageCreateInfo crateInfo = {};
   crateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
   crateInfo.imageType = VK_IMAGE_TYPE_2D;
   crateInfo.extent = extent;
-  crateInfo.mipLevels = 1;
+  crateInfo.mipLevels = mipLevels;
   crateInfo.arrayLayers = 1;
   crateInfo.format = format;
   crateInfo.tiling = tiling;
@@ -157,6 +157,13 @@ auto CreateInstance(std::string const &appName) -> Instance {
     throw std::runtime_error("Not supported required layers!");
   }
 
+  // Optional, lets the device query extension features (descriptor indexing)
+  auto const properties2 =
+      std::string(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+  if (vkx::ValidateInstanceExtensions({properties2})) {
+    extensions.push_back(properties2);
+  }
+
   return vkx::CreateInstance(appName, extensions, layers);
 }
 
@@ -176,12 +183,40 @@ auto CreateDebugReportCallback(Instance instance,
 
 auto CreateDevice(VkPhysicalDevice physicalDevice, int graphicQueueIndex,
 		  int presentationQueueIndex) -> Device {
+  return CreateDevice(physicalDevice, graphicQueueIndex,
+		      presentationQueueIndex, graphicQueueIndex);
+}
+
+auto CreateDevice(VkPhysicalDevice physicalDevice, int graphicQueueIndex,
+		  int presentationQueueIndex, int transferQueueIndex)
+    -> Device {
+  VkPhysicalDeviceFeatures deviceFeatures = {};
+  deviceFeatures.samplerAnisotropy = VK_TRUE; // Enable Anisotropy
+  return CreateDevice(physicalDevice, graphicQueueIndex,
+		      presentationQueueIndex, transferQueueIndex,
+		      deviceFeatures);
+}
+
+auto CreateDevice(VkPhysicalDevice physicalDevice, int graphicQueueIndex,
+		  int presentationQueueIndex, int transferQueueIndex,
+		  VkPhysicalDeviceFeatures const &enabledFeatures) -> Device {
+  return CreateDevice(physicalDevice, graphicQueueIndex,
+		      presentationQueueIndex, transferQueueIndex,
+		      enabledFeatures, {});
+}
+
+auto CreateDevice(VkPhysicalDevice physicalDevice, int graphicQueueIndex,
+		  int presentationQueueIndex, int transferQueueIndex,
+		  VkPhysicalDeviceFeatures const &enabledFeatures,
+		  std::vector<std::string> const &extensions,
+		  void const *pNext) -> Device {
 
   // 1. Needs Physcial Device
   // 2. QueueFamiliyIdices
 
   auto queueCreateInfos = std::vector<VkDeviceQueueCreateInfo>{};
-  auto queueIndices = std::set<int>{graphicQueueIndex, presentationQueueIndex};
+  auto queueIndices = std::set<int>{graphicQueueIndex, presentationQueueIndex,
+				    transferQueueIndex};
 
   for (int index : queueIndices) {
     VkDeviceQueueCreateInfo createInfo = {};
@@ -194,11 +229,14 @@ auto CreateDevice(VkPhysicalDevice physicalDevice, int graphicQueueIndex,
   }
   VkDeviceCreateInfo deviceCreateInfo = {};
   deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+  deviceCreateInfo.pNext = pNext;
   deviceCreateInfo.queueCreateInfoCount =
       static_cast<uint32_t>(queueCreateInfos.size());
   deviceCreateInfo.pQueueCreateInfos = queueCreateInfos.data();
 
   auto deviceExtensions = GetRequiredDeviceExtension();
+  deviceExtensions.insert(deviceExtensions.end(), extensions.begin(),
+			  extensions.end());
   deviceCreateInfo.enabledExtensionCount =
       static_cast<uint32_t>(deviceExtensions.size());
 
@@ -208,10 +246,8 @@ auto CreateDevice(VkPhysicalDevice physicalDevice, int graphicQueueIndex,
 		 [](auto const &s) { return s.data(); });
   deviceCreateInfo.ppEnabledExtensionNames = pDeviceExtensions.data();
 
-  VkPhysicalDeviceFeatures deviceFeatures = {};
-  deviceFeatures.samplerAnisotropy = VK_TRUE; // Enable Anisotropy
   deviceCreateInfo.pEnabledFeatures =
-      &deviceFeatures; // Physical Device features Logical Device will use
+      &enabledFeatures; // Physical Device features Logical Device will use
 
   return Device::Create(physicalDevice, &deviceCreateInfo, nullptr);
 }
@@ -419,8 +455,8 @@ auto CreateRenderPassDependencies() -> std::array<VkSubpassDependency, 3> {
 
 } // namespace details
 
-auto CreateRenderPass(Device const &device, VkFormat const &swapchainFormat)
-    -> RenderPass {
+auto CreateRenderPass(Device const &device, VkFormat const &swapchainFormat,
+		      VkAttachmentStoreOp depthStoreOp) -> RenderPass {
 
   std::array<VkSubpassDescription, 2> subpasses{};
 
@@ -443,7 +479,7 @@ auto CreateRenderPass(Device const &device, VkFormat const &swapchainFormat)
   depthAttachment.format = VK_FORMAT_D32_SFLOAT_S8_UINT;
   depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
   depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-  depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  depthAttachment.storeOp = depthStoreOp;
   depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
   depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
   depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
@@ -691,6 +727,26 @@ auto ChooseGraphicsQueueIndex(VkPhysicalDevice device) -> int32_t {
   return -1;
 }
 
+auto ChooseTransferQueueIndex(VkPhysicalDevice device) -> int32_t {
+  auto properties = vkx::GetPhysicalDeviceQueueFamilyProperties(device);
+  int32_t fallback = -1;
+  for (uint32_t i = 0; i < properties.size(); i++) {
+    if (properties[i].queueCount <= 0)
+      continue;
+    auto flags = properties[i].queueFlags;
+    if (flags & VK_QUEUE_GRAPHICS_BIT)
+      continue;
+    // Compute queues support transfers implicitly
+    if (!(flags & (VK_QUEUE_TRANSFER_BIT | VK_QUEUE_COMPUTE_BIT)))
+      continue;
+    if (!(flags & VK_QUEUE_COMPUTE_BIT))
+      return static_cast<int32_t>(i);
+    if (fallback < 0)
+      fallback = static_cast<int32_t>(i);
+  }
+  return fallback;
+}
+
 auto ChoosePresentQueueIndex(VkPhysicalDevice device, VkSurfaceKHR surface)
     -> int32_t {
   auto properties = vkx::GetPhysicalDeviceQueueFamilyProperties(device);
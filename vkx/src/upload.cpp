@@ -0,0 +1,479 @@
+#include "vkx/upload.hpp"
+
+#include <vulkan/vulkan_core.h>
+
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+namespace vkx {
+
+namespace {
+
+// Every stage that may read uploaded data, and how it reads it
+constexpr VkPipelineStageFlags ConsumerStages =
+    VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT |
+    VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+    VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+constexpr VkAccessFlags BufferReadAccess =
+    VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT |
+    VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT |
+    VK_ACCESS_SHADER_READ_BIT;
+
+auto AllocateCommandBuffer(VkDevice device, VkCommandPool commandPool)
+    -> VkCommandBuffer {
+  VkCommandBufferAllocateInfo allocInfo = {};
+  allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  allocInfo.commandPool = commandPool;
+  allocInfo.commandBufferCount = 1;
+
+  VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+  if (vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("Failed to allocate an upload Command Buffer!");
+  }
+  return commandBuffer;
+}
+
+auto CreateFence(VkDevice device) -> VkFence {
+  VkFenceCreateInfo fenceInfo = {};
+  fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+  VkFence fence = VK_NULL_HANDLE;
+  if (vkCreateFence(device, &fenceInfo, nullptr, &fence) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create an upload Fence!");
+  }
+  return fence;
+}
+
+auto Begin(VkCommandBuffer commandBuffer) -> void {
+  VkCommandBufferBeginInfo beginInfo = {};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  vkBeginCommandBuffer(commandBuffer, &beginInfo);
+}
+
+} // namespace
+
+struct UploadTicket::State {
+  Device device;
+  Allocator allocator;
+  VkCommandPool commandPool = VK_NULL_HANDLE;
+  VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+  VkFence fence = VK_NULL_HANDLE;
+  std::vector<UploadBatch::Staging> staging;
+
+  // Only used when ownership moves to another queue family. The acquire half
+  // is submitted once the copies are done, so it never stalls the queue.
+  VkQueue acquireQueue = VK_NULL_HANDLE;
+  VkCommandPool acquirePool = VK_NULL_HANDLE;
+  VkCommandBuffer acquireBuffer = VK_NULL_HANDLE;
+  VkSemaphore semaphore = VK_NULL_HANDLE;
+  VkFence acquireFence = VK_NULL_HANDLE;
+
+  bool copied = false;
+  bool released = false;
+
+  auto ReleaseStaging() -> void {
+    for (auto &s : staging) {
+      vkDestroyBuffer(device, s.buffer, nullptr);
+      allocator.Free(s.memory);
+    }
+    staging.clear();
+  }
+
+  auto Release() -> void {
+    if (released) {
+      return;
+    }
+    ReleaseStaging();
+    vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
+    vkDestroyFence(device, fence, nullptr);
+    if (acquireBuffer != VK_NULL_HANDLE) {
+      vkFreeCommandBuffers(device, acquirePool, 1, &acquireBuffer);
+    }
+    vkDestroyFence(device, acquireFence, nullptr);
+    vkDestroySemaphore(device, semaphore, nullptr);
+    released = true;
+  }
+
+  auto SubmitAcquire() -> void {
+    VkPipelineStageFlags waitStage = ConsumerStages;
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.waitSemaphoreCount = 1;
+    submitInfo.pWaitSemaphores = &semaphore;
+    submitInfo.pWaitDstStageMask = &waitStage;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &acquireBuffer;
+    if (vkQueueSubmit(acquireQueue, 1, &submitInfo, acquireFence) !=
+	VK_SUCCESS) {
+      throw std::runtime_error("Failed to submit an upload acquire!");
+    }
+  }
+
+  // Advances the upload as far as the GPU allows, returns true once every
+  // submission has finished and all resources are released
+  auto Poll(bool wait) -> bool {
+    if (released) {
+      return true;
+    }
+    auto const timeout = std::numeric_limits<uint64_t>::max();
+    if (!copied) {
+      if (wait) {
+	vkWaitForFences(device, 1, &fence, VK_TRUE, timeout);
+      } else if (vkGetFenceStatus(device, fence) != VK_SUCCESS) {
+	return false;
+      }
+      copied = true;
+      ReleaseStaging();
+      if (acquireBuffer != VK_NULL_HANDLE) {
+	SubmitAcquire();
+      }
+    }
+    if (acquireBuffer != VK_NULL_HANDLE) {
+      if (wait) {
+	vkWaitForFences(device, 1, &acquireFence, VK_TRUE, timeout);
+      } else if (vkGetFenceStatus(device, acquireFence) != VK_SUCCESS) {
+	return false;
+      }
+    }
+    Release();
+    return true;
+  }
+
+  ~State() {
+    try {
+      Poll(true);
+    } catch (...) {
+      // The copies are done at this point, only the acquire failed
+      Release();
+    }
+  }
+};
+
+auto UploadTicket::IsComplete() const -> bool {
+  return !_state || _state->Poll(false);
+}
+
+auto UploadTicket::Wait() const -> void {
+  if (_state) {
+    _state->Poll(true);
+  }
+}
+
+auto UploadBatch::Create(Device const &device, Allocator const &allocator,
+			 VkQueue queue, VkCommandPool commandPool)
+    -> UploadBatch {
+  UploadBatch batch;
+  batch._device = device;
+  batch._allocator = allocator;
+  batch._queue = queue;
+  batch._commandPool = commandPool;
+  return batch;
+}
+
+auto UploadBatch::Create(Device const &device, Allocator const &allocator,
+			 VkQueue transferQueue, VkCommandPool transferPool,
+			 uint32_t transferFamily, VkQueue dstQueue,
+			 VkCommandPool dstPool, uint32_t dstFamily)
+    -> UploadBatch {
+  auto batch = Create(device, allocator, transferQueue, transferPool);
+  if (transferFamily != dstFamily) {
+    batch._srcFamily = transferFamily;
+    batch._dstFamily = dstFamily;
+    batch._dstQueue = dstQueue;
+    batch._dstCommandPool = dstPool;
+  }
+  return batch;
+}
+
+auto UploadBatch::UseStagingRing(StagingRing const &ring) -> void {
+  _ring = ring;
+}
+
+auto UploadBatch::Stage(void const *data, VkDeviceSize size)
+    -> StagingRing::Range {
+  // 16 satisfies the texel alignment of every uncompressed format and the
+  // block size of every compressed one
+  if (_ring) {
+    auto range = _ring.Allocate(size, 16);
+    if (range.buffer != VK_NULL_HANDLE) {
+      if (data) {
+	memcpy(range.mapped, data, static_cast<size_t>(size));
+      }
+      _ringUsed = true;
+      return range;
+    }
+  }
+
+  Staging staging;
+  staging.memory = CreateBuffer(
+      _allocator, _device, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+	  VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+      &staging.buffer);
+  if (data) {
+    memcpy(staging.memory.mapped, data, static_cast<size_t>(size));
+  }
+  _staging.push_back(staging);
+
+  StagingRing::Range range;
+  range.buffer = staging.buffer;
+  range.mapped = staging.memory.mapped;
+  return range;
+}
+
+auto UploadBatch::CopyToBuffer(void const *data, VkDeviceSize size,
+			       VkBuffer dst, VkDeviceSize dstOffset,
+			       VkSharingMode sharingMode) -> void {
+  if (size == 0) {
+    return;
+  }
+  auto src = Stage(data, size);
+  _bufferCopies.push_back({src.buffer, dst, {src.offset, dstOffset, size},
+			   sharingMode == VK_SHARING_MODE_EXCLUSIVE});
+}
+
+auto UploadBatch::CopyToImage(void const *data, VkDeviceSize size,
+			      VkImage dst, uint32_t width, uint32_t height)
+    -> void {
+  memcpy(StageImage(size, dst, width, height), data, static_cast<size_t>(size));
+}
+
+auto UploadBatch::StageImage(VkDeviceSize size, VkImage dst, uint32_t width,
+			     uint32_t height) -> void * {
+  return StageImage(size, dst, {{0, width, height}});
+}
+
+auto UploadBatch::StageImage(VkDeviceSize size, VkImage dst,
+			     std::vector<ImageLevel> const &levels) -> void * {
+  auto src = Stage(nullptr, size);
+
+  std::vector<VkBufferImageCopy> regions(levels.size());
+  for (size_t i = 0; i < levels.size(); i++) {
+    auto &region = regions[i];
+    region.bufferOffset = src.offset + levels[i].offset;
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel = static_cast<uint32_t>(i);
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent = {levels[i].width, levels[i].height, 1};
+  }
+
+  _imageCopies.push_back({src.buffer, dst, std::move(regions)});
+  return src.mapped;
+}
+
+auto UploadBatch::IsEmpty() const -> bool {
+  return _bufferCopies.empty() && _imageCopies.empty();
+}
+
+auto UploadBatch::Discard() -> void {
+  // Ring ranges come back with the ring's region, nothing retains them
+  for (auto &s : _staging) {
+    vkDestroyBuffer(_device, s.buffer, nullptr);
+    _allocator.Free(s.memory);
+  }
+  _staging.clear();
+  _bufferCopies.clear();
+  _imageCopies.clear();
+  _ringUsed = false;
+}
+
+auto UploadBatch::RecordTransfer(VkCommandBuffer cb) const -> void {
+  auto ownershipTransfer = _dstQueue != VK_NULL_HANDLE;
+
+  // All images to TRANSFER_DST in one barrier
+  std::vector<VkImageMemoryBarrier> imageBarriers;
+  for (auto const &copy : _imageCopies) {
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = copy.dst;
+    barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0,
+				static_cast<uint32_t>(copy.regions.size()), 0,
+				1};
+    imageBarriers.push_back(barrier);
+  }
+  if (!imageBarriers.empty()) {
+    vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+			 VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+			 nullptr, static_cast<uint32_t>(imageBarriers.size()),
+			 imageBarriers.data());
+  }
+
+  for (auto const &copy : _bufferCopies) {
+    vkCmdCopyBuffer(cb, copy.src, copy.dst, 1, &copy.region);
+  }
+  for (auto const &copy : _imageCopies) {
+    vkCmdCopyBufferToImage(cb, copy.src, copy.dst,
+			   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			   static_cast<uint32_t>(copy.regions.size()),
+			   copy.regions.data());
+  }
+
+  if (ownershipTransfer) {
+    // Release half of the queue family ownership transfer, the graphics
+    // stages it would make writes visible to don't exist on this queue
+    auto bufferBarriers = MakeOwnershipBarriers(VK_ACCESS_TRANSFER_WRITE_BIT, 0);
+    auto releaseImages = MakeOwnershipBarriers(
+	VK_ACCESS_TRANSFER_WRITE_BIT, 0, imageBarriers);
+    vkCmdPipelineBarrier(
+	cb, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+	0, 0, nullptr, static_cast<uint32_t>(bufferBarriers.size()),
+	bufferBarriers.data(), static_cast<uint32_t>(releaseImages.size()),
+	releaseImages.data());
+    return;
+  }
+
+  // Make every write visible to the stages that consume uploaded data, and
+  // move the images to their shader readable layout
+  for (auto &barrier : imageBarriers) {
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  }
+  VkMemoryBarrier memoryBarrier = {};
+  memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  memoryBarrier.dstAccessMask = BufferReadAccess;
+  vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_TRANSFER_BIT, ConsumerStages, 0,
+		       1, &memoryBarrier, 0, nullptr,
+		       static_cast<uint32_t>(imageBarriers.size()),
+		       imageBarriers.data());
+}
+
+auto UploadBatch::RecordAcquire(VkCommandBuffer cb) const -> void {
+  std::vector<VkImageMemoryBarrier> imageBarriers(_imageCopies.size());
+  for (size_t i = 0; i < _imageCopies.size(); i++) {
+    imageBarriers[i].image = _imageCopies[i].dst;
+    imageBarriers[i].subresourceRange = {
+	VK_IMAGE_ASPECT_COLOR_BIT, 0,
+	static_cast<uint32_t>(_imageCopies[i].regions.size()), 0, 1};
+  }
+  auto bufferBarriers = MakeOwnershipBarriers(0, BufferReadAccess);
+  imageBarriers =
+      MakeOwnershipBarriers(0, VK_ACCESS_SHADER_READ_BIT, imageBarriers);
+
+  // Acquire half, must match the release barriers exactly
+  vkCmdPipelineBarrier(cb, ConsumerStages, ConsumerStages, 0, 0, nullptr,
+		       static_cast<uint32_t>(bufferBarriers.size()),
+		       bufferBarriers.data(),
+		       static_cast<uint32_t>(imageBarriers.size()),
+		       imageBarriers.data());
+}
+
+auto UploadBatch::MakeOwnershipBarriers(VkAccessFlags srcAccess,
+					VkAccessFlags dstAccess) const
+    -> std::vector<VkBufferMemoryBarrier> {
+  std::vector<VkBufferMemoryBarrier> barriers;
+  for (auto const &copy : _bufferCopies) {
+    if (!copy.exclusive) {
+      continue;
+    }
+    VkBufferMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstAccessMask = dstAccess;
+    barrier.srcQueueFamilyIndex = _srcFamily;
+    barrier.dstQueueFamilyIndex = _dstFamily;
+    barrier.buffer = copy.dst;
+    barrier.offset = copy.region.dstOffset;
+    barrier.size = copy.region.size;
+    barriers.push_back(barrier);
+  }
+  return barriers;
+}
+
+auto UploadBatch::MakeOwnershipBarriers(
+    VkAccessFlags srcAccess, VkAccessFlags dstAccess,
+    std::vector<VkImageMemoryBarrier> barriers) const
+    -> std::vector<VkImageMemoryBarrier> {
+  for (auto &barrier : barriers) {
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstAccessMask = dstAccess;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.srcQueueFamilyIndex = _srcFamily;
+    barrier.dstQueueFamilyIndex = _dstFamily;
+  }
+  return barriers;
+}
+
+auto UploadBatch::Submit() -> UploadTicket {
+  if (IsEmpty()) {
+    return UploadTicket();
+  }
+
+  auto state = std::make_shared<UploadTicket::State>();
+  state->device = _device;
+  state->allocator = _allocator;
+  state->commandPool = _commandPool;
+  // From here on the state owns the staging buffers
+  state->staging = std::move(_staging);
+  _staging.clear();
+
+  VkSubmitInfo submitInfo = {};
+  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submitInfo.commandBufferCount = 1;
+  submitInfo.pCommandBuffers = &state->commandBuffer;
+
+  try {
+    state->commandBuffer = AllocateCommandBuffer(_device, _commandPool);
+    state->fence = CreateFence(_device);
+
+    Begin(state->commandBuffer);
+    RecordTransfer(state->commandBuffer);
+    vkEndCommandBuffer(state->commandBuffer);
+
+    if (_dstQueue != VK_NULL_HANDLE) {
+      state->acquireQueue = _dstQueue;
+      state->acquirePool = _dstCommandPool;
+      state->acquireBuffer = AllocateCommandBuffer(_device, _dstCommandPool);
+      state->acquireFence = CreateFence(_device);
+
+      VkSemaphoreCreateInfo semaphoreInfo = {};
+      semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+      if (vkCreateSemaphore(_device, &semaphoreInfo, nullptr,
+			    &state->semaphore) != VK_SUCCESS) {
+	throw std::runtime_error("Failed to create an upload Semaphore!");
+      }
+      submitInfo.signalSemaphoreCount = 1;
+      submitInfo.pSignalSemaphores = &state->semaphore;
+
+      Begin(state->acquireBuffer);
+      RecordAcquire(state->acquireBuffer);
+      vkEndCommandBuffer(state->acquireBuffer);
+    }
+
+    if (vkQueueSubmit(_queue, 1, &submitInfo, state->fence) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to submit an upload batch!");
+    }
+  } catch (...) {
+    // Nothing reached the GPU, don't let the destructor wait for it
+    state->Release();
+    _ringUsed = false;
+    throw;
+  }
+
+  _bufferCopies.clear();
+  _imageCopies.clear();
+
+  auto ticket = UploadTicket(state);
+  if (_ringUsed) {
+    _ring.Retain(ticket);
+    _ringUsed = false;
+  }
+  return ticket;
+}
+
+} // namespace vkx